@@ -0,0 +1,94 @@
+#include "bench_json.h"
+#include "container.h"
+#include "encryption.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// End-to-end encrypt_file_advanced / decrypt_file_advanced throughput for
+// file sizes in every get_chunk_size tier (unchunked, 512KB, 2MB and 8MB
+// chunks). Each figure is the best of `repeats` runs and includes the key
+// derivation at cost 8. The pool width is fixed per process: set
+// MYCRYPT_THREADS to measure other thread counts (bench/run_bench.sh does).
+// Usage: bench_e2e [--json] [repeats] [directory]
+
+static const size_t SIZES_MB[] = {4, 16, 64, 256};
+static const int COST = 8;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool write_input(const std::string &path, size_t size_mb) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    std::vector<uint8_t> block(1024 * 1024);
+    uint32_t state = 1;
+    for (size_t mb = 0; mb < size_mb; mb++) {
+        for (size_t i = 0; i < block.size(); i++) {
+            state = state * 1103515245u + 12345u;
+            block[i] = (uint8_t)(state >> 16);
+        }
+        fwrite(block.data(), 1, block.size(), f);
+    }
+    return fclose(f) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    bool json;
+    argc = parse_bench_json(argc, argv, &json);
+    int repeats = (argc > 1) ? std::max(1, atoi(argv[1])) : 3;
+    std::string dir = (argc > 2) ? argv[2] : ".";
+    std::string plain = dir + "/bench_e2e.bin";
+    std::string enc = dir + "/bench_e2e.enc";
+    std::string dec = dir + "/bench_e2e_dec.bin";
+    size_t threads = ThreadPool::shared().size();
+
+    if (!json) {
+        printf("========================================\n");
+        printf("Encrypt/decrypt end to end (%zu threads, best of %d)\n", threads, repeats);
+        printf("========================================\n");
+        printf("%10s %12s %14s %14s\n", "size (MB)", "chunk (KB)", "encrypt MB/s", "decrypt MB/s");
+    }
+
+    BenchJson *out = json ? new BenchJson("end_to_end") : nullptr;
+    bool ok = true;
+    for (size_t size_mb : SIZES_MB) {
+        ok = write_input(plain, size_mb);
+        double best_enc = 0, best_dec = 0;
+        for (int r = 0; r < repeats && ok; r++) {
+            auto start = std::chrono::steady_clock::now();
+            ok = encrypt_file_advanced(plain.c_str(), enc.c_str(), "benchpass", COST) == 0;
+            double enc_secs = seconds_since(start);
+            start = std::chrono::steady_clock::now();
+            ok = ok && decrypt_file_advanced(enc.c_str(), dec.c_str(), "benchpass") == 0;
+            double dec_secs = seconds_since(start);
+            best_enc = std::max(best_enc, size_mb / enc_secs);
+            best_dec = std::max(best_dec, size_mb / dec_secs);
+        }
+        if (!ok) break;
+        size_t chunk_kb = get_chunk_size(size_mb * 1024 * 1024) / 1024;
+        if (out) {
+            out->begin_result();
+            out->field("size_mb", (long long)size_mb);
+            out->field("chunk_kb", (long long)chunk_kb);
+            out->field("threads", (long long)threads);
+            out->field("encrypt_mbps", best_enc);
+            out->field("decrypt_mbps", best_dec);
+            out->end_result();
+        } else {
+            printf("%10zu %12zu %14.1f %14.1f\n", size_mb, chunk_kb, best_enc, best_dec);
+        }
+    }
+    delete out;
+    if (!ok) fprintf(stderr, "Encrypt or decrypt failed\n");
+
+    remove(plain.c_str());
+    remove(enc.c_str());
+    remove(dec.c_str());
+    return ok ? 0 : 1;
+}
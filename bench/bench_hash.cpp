@@ -0,0 +1,75 @@
+#include "bench_json.h"
+#include "crypto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <new>
+
+// Time and peak heap use of hash_password per cost level.
+// Usage: bench_hash [--json] [min_cost] [max_cost]
+
+static std::atomic<size_t> live_bytes(0);
+static std::atomic<size_t> peak_bytes(0);
+
+// Every allocation carries its size in a header so frees can be counted too.
+static const size_t HEADER = alignof(std::max_align_t);
+
+void *operator new(size_t n) {
+    void *p = malloc(n + HEADER);
+    if (!p) throw std::bad_alloc();
+    *(size_t*)p = n;
+    size_t live = live_bytes.fetch_add(n) + n;
+    size_t peak = peak_bytes.load();
+    while (live > peak && !peak_bytes.compare_exchange_weak(peak, live)) {}
+    return (char*)p + HEADER;
+}
+
+void operator delete(void *p) noexcept {
+    if (!p) return;
+    char *base = (char*)p - HEADER;
+    live_bytes.fetch_sub(*(size_t*)base);
+    free(base);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+int main(int argc, char *argv[]) {
+    bool json;
+    argc = parse_bench_json(argc, argv, &json);
+    int min_cost = (argc > 1) ? atoi(argv[1]) : 8;
+    int max_cost = (argc > 2) ? atoi(argv[2]) : 16;
+
+    if (!json) {
+        printf("========================================\n");
+        printf("hash_password (cost %d-%d)\n", min_cost, max_cost);
+        printf("========================================\n");
+        printf("%6s %12s %12s %14s\n", "cost", "iterations", "time (ms)", "peak heap (MB)");
+    }
+
+    BenchJson *out = json ? new BenchJson("hash_password") : nullptr;
+    for (int cost = min_cost; cost <= max_cost; cost++) {
+        peak_bytes.store(live_bytes.load());
+        size_t base = live_bytes.load();
+        auto start = std::chrono::steady_clock::now();
+        char *hash = hash_password("benchmark password", cost, "benchSalt1234567");
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        free(hash);
+        double peak_mb = (peak_bytes.load() - base) / (1024.0 * 1024.0);
+        if (out) {
+            out->begin_result();
+            out->field("cost", (long long)cost);
+            out->field("iterations", (long long)1 << cost);
+            out->field("ms", ms);
+            out->field("peak_heap_mb", peak_mb);
+            out->end_result();
+        } else {
+            printf("%6d %12d %12.1f %14.2f\n", cost, 1 << cost, ms, peak_mb);
+        }
+    }
+    delete out;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <stdio.h>
+#include <string.h>
+
+// --json output shared by the benchmarks: one object per run,
+//   {"benchmark": NAME, "results": [{field: value, ...}, ...]}
+// printed to stdout, so bench/run_bench.sh can collect several of them into
+// one document.
+class BenchJson {
+public:
+    explicit BenchJson(const char *benchmark) : first_result_(true), first_field_(true) {
+        printf("{\"benchmark\": \"%s\", \"results\": [", benchmark);
+    }
+
+    ~BenchJson() { printf("\n]}\n"); }
+
+    void begin_result() {
+        printf("%s\n  {", first_result_ ? "" : ",");
+        first_result_ = false;
+        first_field_ = true;
+    }
+
+    void end_result() { printf("}"); }
+
+    void field(const char *name, const char *value) {
+        key(name);
+        putchar('"');
+        for (const char *p = value; *p; p++) {
+            if (*p == '"' || *p == '\\') putchar('\\');
+            putchar(*p);
+        }
+        putchar('"');
+    }
+
+    void field(const char *name, double value) {
+        key(name);
+        printf("%.3f", value);
+    }
+
+    void field(const char *name, long long value) {
+        key(name);
+        printf("%lld", value);
+    }
+
+private:
+    void key(const char *name) {
+        printf("%s\"%s\": ", first_field_ ? "" : ", ", name);
+        first_field_ = false;
+    }
+
+    bool first_result_;
+    bool first_field_;
+};
+
+// Removes --json from argv, setting *json if it was there, and returns the
+// new argc so the positional arguments keep their places.
+inline int parse_bench_json(int argc, char *argv[], bool *json) {
+    *json = false;
+    int out = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            *json = true;
+        } else {
+            argv[out++] = argv[i];
+        }
+    }
+    return out;
+}
@@ -0,0 +1,162 @@
+#include "bench_json.h"
+#include "encryption.h"
+#include "kernels.h"
+#include "key_schedule.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+// Single-threaded throughput of every transform kernel variant this CPU
+// supports, on one L1-resident block, then of the public byte functions with
+// the active variant at sizes from one cache line to 1MB.
+// Usage: bench_kernels [--json]
+
+static const double MIN_SECONDS = 0.3;
+
+static const size_t SWEEP_SIZES[] = {64, 1024, 64 * 1024, 1024 * 1024};
+
+static double measure_mbps(const std::function<void()> &fn, size_t bytes) {
+    // Batches of ~256KB between clock reads, and at least one call.
+    size_t batch = std::max<size_t>(1, 256 * 1024 / bytes);
+    size_t rounds = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < MIN_SECONDS) {
+        for (size_t i = 0; i < batch; i++) fn();
+        rounds += batch;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return rounds * (double)bytes / (1024.0 * 1024.0) / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    bool json;
+    parse_bench_json(argc, argv, &json);
+
+    const char *key_str = "$benchSalt123456$/$bench-key-material-0123456789";
+    const uint8_t *key = (const uint8_t*)key_str;
+    size_t key_len = strlen(key_str);
+    const size_t TAIL = 1000;
+
+    std::vector<uint8_t> block(SUB_CHUNK_SIZE);
+    for (size_t i = 0; i < block.size(); i++) block[i] = (uint8_t)(i * 131 + 7);
+    uint8_t *data = block.data();
+
+    std::vector<uint8_t> key_stream(SUB_CHUNK_SIZE);
+    expand_key_stream(key_stream.data(), SUB_CHUNK_SIZE, key, key_len);
+    const uint8_t *ks = key_stream.data();
+
+    std::vector<const KernelSet*> variants;
+    for (int isa = 0; isa < KERNEL_ISA_COUNT; isa++) {
+        if (kernel_set((KernelIsa)isa)) variants.push_back(kernel_set((KernelIsa)isa));
+    }
+
+    struct Case {
+        char name[40];
+        size_t bytes;
+        std::function<void()> fn;
+    };
+    std::vector<Case> cases;
+    auto add = [&](const char *name, size_t bytes, std::function<void()> fn) {
+        Case c;
+        snprintf(c.name, sizeof(c.name), "%s", name);
+        c.bytes = bytes;
+        c.fn = fn;
+        cases.push_back(c);
+    };
+    for (int shift = 1; shift <= 7; shift += 3) {
+        char name[40];
+        snprintf(name, sizeof(name), "round forward k=%d", shift);
+        add(name, SUB_CHUNK_SIZE, [=] { active_kernels().round_forward[shift](data, ks); });
+        snprintf(name, sizeof(name), "round reverse k=%d", shift);
+        add(name, SUB_CHUNK_SIZE, [=] { active_kernels().round_reverse[shift](data, ks); });
+    }
+    add("rotate_left 1KB k=3", SUB_CHUNK_SIZE, [=] { rotate_left(data, SUB_CHUNK_SIZE, 3); });
+    add("xor_bytes 1KB", SUB_CHUNK_SIZE, [=] { xor_bytes(data, SUB_CHUNK_SIZE, key, key_len); });
+    add("byte_manipulations 1KB", SUB_CHUNK_SIZE,
+        [=] { byte_manipulations(data, SUB_CHUNK_SIZE, key, key_len, 2); });
+    add("byte_manipulations tail", TAIL, [=] { byte_manipulations(data, TAIL, key, key_len, 2); });
+    // 15 rounds (the slowest chunk class) round by round vs. the closed form.
+    const KeySchedule *schedule = new KeySchedule(key, key_len);
+    add("schedule rounds 1KB", SUB_CHUNK_SIZE, [=] { schedule->forward_rounds(data, SUB_CHUNK_SIZE, 5); });
+    add("schedule closed 1KB", SUB_CHUNK_SIZE, [=] { schedule->forward(data, SUB_CHUNK_SIZE, 5); });
+    add("schedule rounds tail", TAIL, [=] { schedule->forward_rounds(data, TAIL, 5); });
+    add("schedule closed tail", TAIL, [=] { schedule->forward(data, TAIL, 5); });
+    add("schedule closed rev 1KB", SUB_CHUNK_SIZE, [=] { schedule->reverse(data, SUB_CHUNK_SIZE, 5); });
+
+    struct SweepCase {
+        const char *name;
+        std::function<void(uint8_t*, size_t)> fn;
+    };
+    std::vector<uint8_t> large(SWEEP_SIZES[sizeof(SWEEP_SIZES) / sizeof(SWEEP_SIZES[0]) - 1]);
+    for (size_t i = 0; i < large.size(); i++) large[i] = (uint8_t)(i * 131 + 7);
+    const SweepCase sweep[] = {
+        {"rotate_left", [](uint8_t *d, size_t n) { rotate_left(d, n, 3); }},
+        {"rotate_right", [](uint8_t *d, size_t n) { rotate_right(d, n, 3); }},
+        {"xor_bytes", [=](uint8_t *d, size_t n) { xor_bytes(d, n, key, key_len); }},
+        {"byte_manipulations", [=](uint8_t *d, size_t n) { byte_manipulations(d, n, key, key_len, 2); }},
+    };
+
+    if (json) {
+        BenchJson out("kernels");
+        for (const Case &c : cases) {
+            for (const KernelSet *set : variants) {
+                select_kernels(set->name);
+                out.begin_result();
+                out.field("kernel", c.name);
+                out.field("variant", set->name);
+                out.field("bytes", (long long)c.bytes);
+                out.field("mbps", measure_mbps(c.fn, c.bytes));
+                out.end_result();
+            }
+        }
+        select_kernels("auto");
+        for (const SweepCase &c : sweep) {
+            for (size_t size : SWEEP_SIZES) {
+                out.begin_result();
+                out.field("kernel", c.name);
+                out.field("variant", active_kernels().name);
+                out.field("bytes", (long long)size);
+                out.field("mbps", measure_mbps([&] { c.fn(large.data(), size); }, size));
+                out.end_result();
+            }
+        }
+        delete schedule;
+        return 0;
+    }
+
+    printf("========================================\n");
+    printf("Transform kernels (%zu-byte block, MB/s)\n", SUB_CHUNK_SIZE);
+    printf("========================================\n");
+    printf("%-26s", "kernel");
+    for (const KernelSet *set : variants) printf(" %10s", set->name);
+    printf(" %9s\n", "best/scl");
+
+    for (const Case &c : cases) {
+        printf("%-26s", c.name);
+        double scalar = 0, best = 0;
+        for (const KernelSet *set : variants) {
+            select_kernels(set->name);
+            double mbps = measure_mbps(c.fn, c.bytes);
+            if (set == variants.front()) scalar = mbps;
+            if (mbps > best) best = mbps;
+            printf(" %10.1f", mbps);
+        }
+        printf(" %8.2fx\n", best / scalar);
+    }
+    select_kernels("auto");
+
+    printf("\nBy size (%s, MB/s)\n", active_kernels().name);
+    printf("%-26s", "function");
+    for (size_t size : SWEEP_SIZES) printf(" %10zu", size);
+    printf("\n");
+    for (const SweepCase &c : sweep) {
+        printf("%-26s", c.name);
+        for (size_t size : SWEEP_SIZES) printf(" %10.1f", measure_mbps([&] { c.fn(large.data(), size); }, size));
+        printf("\n");
+    }
+    delete schedule;
+    return 0;
+}
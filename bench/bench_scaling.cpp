@@ -0,0 +1,72 @@
+#include "bench_json.h"
+#include "encryption.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Measures how the byte transform scales with the number of pool workers.
+// Usage: bench_scaling [--json] [size_mb] [max_threads]
+
+static const size_t SUB_CHUNK = 1024;
+static const size_t GROUP = 64 * SUB_CHUNK;
+
+static double run(ThreadPool &pool, std::vector<uint8_t> &buf, const uint8_t *key, size_t key_len) {
+    size_t groups = (buf.size() + GROUP - 1) / GROUP;
+    auto start = std::chrono::steady_clock::now();
+    parallel_for(pool, groups, [&](size_t g) {
+        size_t end = std::min(buf.size(), (g + 1) * GROUP);
+        for (size_t i = g * GROUP; i < end; i += SUB_CHUNK) {
+            byte_manipulations(buf.data() + i, std::min(SUB_CHUNK, end - i), key, key_len, (int)(g % 6));
+        }
+    });
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    bool json;
+    argc = parse_bench_json(argc, argv, &json);
+    size_t size_mb = (argc > 1) ? (size_t)atoi(argv[1]) : 16;
+    size_t max_threads = (argc > 2) ? (size_t)atoi(argv[2]) : std::thread::hardware_concurrency();
+    if (max_threads == 0) max_threads = 2;
+
+    const char *key_str = "$benchSalt123456$/$bench-key-material-0123456789";
+    const uint8_t *key = (const uint8_t*)key_str;
+    size_t key_len = strlen(key_str);
+
+    std::vector<uint8_t> buf(size_mb * 1024 * 1024);
+    for (size_t i = 0; i < buf.size(); i++) buf[i] = (uint8_t)(i * 131 + 7);
+
+    if (!json) {
+        printf("========================================\n");
+        printf("Transform scaling (%zu MB, up to %zu threads)\n", size_mb, max_threads);
+        printf("========================================\n");
+        printf("%8s %12s %10s %12s\n", "threads", "MB/s", "speedup", "efficiency");
+    }
+
+    BenchJson *out = json ? new BenchJson("transform_scaling") : nullptr;
+    double base = 0;
+    for (size_t t = 1; t <= max_threads; t = (t * 2 > max_threads && t != max_threads) ? max_threads : t * 2) {
+        ThreadPool pool(t);
+        run(pool, buf, key, key_len);  // warm-up
+        double secs = run(pool, buf, key, key_len);
+        double mbps = size_mb / secs;
+        if (t == 1) base = mbps;
+        if (out) {
+            out->begin_result();
+            out->field("threads", (long long)t);
+            out->field("size_mb", (long long)size_mb);
+            out->field("mbps", mbps);
+            out->field("speedup", mbps / base);
+            out->field("efficiency", mbps / base / t);
+            out->end_result();
+        } else {
+            printf("%8zu %12.1f %9.2fx %11.0f%%\n", t, mbps, mbps / base, mbps / base / t * 100);
+        }
+    }
+    delete out;
+    return 0;
+}
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# Runs the benchmarks with --json and collects their output into one document:
+#   {"timestamp": ..., "commit": ..., "cpus": N, "benchmarks": [...]}
+# The end-to-end benchmark runs once per thread count (1, 2, 4, ... up to the
+# number of CPUs), since the shared pool is sized once per process.
+# bench_io runs in the current directory, so its direct figures are for the
+# filesystem the tree is on.
+# Usage: bench/run_bench.sh [output.json]   (default build/bench.json)
+
+OUT=${1:-build/bench.json}
+BIN=./build
+EXE_EXT=.exe
+CPUS=$(nproc 2>/dev/null || echo 1)
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+THREADS=""
+t=1
+while [ "$t" -lt "$CPUS" ]; do
+    THREADS="$THREADS $t"
+    t=$((t * 2))
+done
+THREADS="$THREADS $CPUS"
+
+{
+    echo "{\"timestamp\": \"$(date -u +%Y-%m-%dT%H:%M:%SZ)\", \"commit\": \"$COMMIT\", \"cpus\": $CPUS, \"benchmarks\": ["
+    $BIN/bench_kernels$EXE_EXT --json || exit 1
+    echo ","
+    $BIN/bench_hash$EXE_EXT --json || exit 1
+    echo ","
+    $BIN/bench_scaling$EXE_EXT --json || exit 1
+    echo ","
+    $BIN/bench_io$EXE_EXT --json || exit 1
+    for t in $THREADS; do
+        echo ","
+        MYCRYPT_THREADS=$t $BIN/bench_e2e$EXE_EXT --json || exit 1
+    done
+    echo "]}"
+} > "$OUT.tmp" && mv "$OUT.tmp" "$OUT" && echo "Benchmark results written to $OUT"
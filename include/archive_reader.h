@@ -0,0 +1,61 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include "compression.h"
+#include "key_schedule.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// Random access to the chunks of an encrypted file whose password has been
+// checked. Chunks are fixed-size (get_chunk_size) and transformed in
+// independent 1KB sub-chunks, so any plaintext byte range maps to a known run
+// of sub-chunks in a known set of chunks. A compressed chunk has no such map
+// and is read, transformed and decompressed whole. Reads are safe from
+// several threads.
+class ArchiveReader {
+public:
+    virtual ~ArchiveReader() {}
+
+    uint64_t size() const { return size_; }
+    size_t chunk_size() const { return chunk_size_; }
+    size_t num_chunks() const { return chunk_size_ ? (size_t)((size_ + chunk_size_ - 1) / chunk_size_) : 0; }
+    const KeySchedule &schedule() const { return *schedule_; }
+
+    // Plaintext bytes in chunk i.
+    size_t chunk_length(size_t i) const {
+        uint64_t begin = (uint64_t)i * chunk_size_;
+        return (size_t)std::min<uint64_t>(chunk_size_, size_ - begin);
+    }
+
+    // Stored bytes of chunk i, and whether they hold a compressed encoding.
+    virtual size_t stored_length(size_t chunk) const = 0;
+    virtual bool compressed(size_t chunk) const = 0;
+
+    // Reads len stored (encrypted) bytes of chunk i starting at offset.
+    virtual bool read_stored(size_t chunk, size_t offset, size_t len, uint8_t *out) const = 0;
+
+    // Decrypts plaintext bytes [begin, end) of chunk i into out. For a raw
+    // chunk only the sub-chunks covering the range are read and transformed;
+    // scratch is reused between calls to avoid reallocating.
+    bool decrypt_span(size_t chunk, size_t begin, size_t end, std::vector<uint8_t> &scratch, uint8_t *out) const;
+
+protected:
+    uint64_t size_ = 0;
+    size_t chunk_size_ = 0;
+    CompressionCodec codec_ = COMPRESS_STORE;
+    std::unique_ptr<KeySchedule> schedule_;
+};
+
+// Opens a ZIP (v1) or native v2 file and checks the password. Returns 0, -1
+// on error (stream containers have no random access and are refused), or -2
+// for a wrong password.
+int open_archive_reader(const char *path, const char *password, std::unique_ptr<ArchiveReader> &reader);
+
+// Per-format openers behind open_archive_reader.
+int open_zip_reader(const char *path, const char *password, std::unique_ptr<ArchiveReader> &reader);
+int open_native_reader(const char *path, const char *password, std::unique_ptr<ArchiveReader> &reader);
+
+#endif
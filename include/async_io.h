@@ -0,0 +1,167 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+// Asynchronous file I/O for the direct backend (IO_DIRECT in file_io.h).
+//
+// Large encrypts through the page cache evict the working set of everything
+// else on the host, and blocking reads and writes leave the CPU idle while
+// the disk works. The direct backend opens files with O_DIRECT where the
+// filesystem allows it and keeps several aligned requests in flight, so
+// compute overlaps I/O; where O_DIRECT is refused it reads and writes through
+// the cache with fadvise hints and drops pages as soon as they are done with.
+
+// Alignment O_DIRECT needs for buffers, file offsets and lengths.
+const size_t DIRECT_IO_ALIGN = 4096;
+// Size of each request the direct reader and writer issue.
+const size_t DIRECT_IO_BLOCK = 1024 * 1024;
+// Requests the direct reader and writer keep in flight.
+const unsigned DIRECT_IO_DEPTH = 8;
+
+// Queue of outstanding positional reads and writes. One thread submits and
+// reaps. Uses io_uring when the kernel provides it, otherwise a few worker
+// threads issuing blocking pread/pwrite. A short write is resubmitted for the
+// rest; a short read completes as is (end of file).
+class IoQueue {
+public:
+    // allow_uring = false forces the thread fallback.
+    explicit IoQueue(unsigned depth, bool allow_uring = true);
+    ~IoQueue();
+
+    IoQueue(const IoQueue &) = delete;
+    IoQueue &operator=(const IoQueue &) = delete;
+
+    bool uses_io_uring() const { return ring_ != nullptr; }
+    unsigned outstanding() const { return outstanding_; }
+
+    // Queue a request; false when `depth` requests are already outstanding or
+    // the kernel refuses it. The buffer must stay valid until it completes.
+    bool submit_read(int fd, uint8_t *buf, size_t len, uint64_t offset, uint64_t tag);
+    bool submit_write(int fd, const uint8_t *buf, size_t len, uint64_t offset, uint64_t tag);
+
+    // Waits for the next completed request and reports its tag and the bytes
+    // transferred (or -errno). Returns false if nothing is outstanding.
+    bool wait(uint64_t *tag, long long *result);
+
+private:
+    struct Ring;
+    struct Request {
+        int fd;
+        bool write;
+        uint8_t *buf;
+        size_t len;
+        size_t done;
+        uint64_t offset;
+        uint64_t tag;
+        bool busy;
+    };
+
+    bool submit(int fd, bool write, uint8_t *buf, size_t len, uint64_t offset, uint64_t tag);
+    bool issue(size_t slot);
+    bool reap(size_t *slot, long long *res);
+    void worker_loop();
+
+    std::vector<Request> requests_;
+    unsigned outstanding_;
+    std::unique_ptr<Ring> ring_;
+
+    // Thread fallback.
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::deque<size_t> pending_;
+    std::deque<std::pair<size_t, long long>> completed_;
+    bool stop_;
+};
+
+// Aligned block buffer for O_DIRECT requests.
+struct AlignedBlock {
+    uint8_t *data;
+    AlignedBlock();
+    ~AlignedBlock();
+    AlignedBlock(const AlignedBlock &) = delete;
+    AlignedBlock &operator=(const AlignedBlock &) = delete;
+};
+
+// Sequential read stream for the direct backend: a std::streambuf, so it can
+// feed a ChunkPipeline in place of an ifstream. It keeps DIRECT_IO_DEPTH
+// blocks in flight ahead of the reader and, when O_DIRECT is unavailable,
+// drops every block from the page cache once it has been consumed.
+class DirectReadBuf : public std::streambuf {
+public:
+    explicit DirectReadBuf(bool allow_uring = true);
+    ~DirectReadBuf();
+
+    bool open(const char *path);
+    bool direct() const { return direct_; }
+    bool failed() const { return failed_; }
+    const IoQueue &queue() const { return queue_; }
+
+protected:
+    int_type underflow() override;
+
+private:
+    bool submit_next();
+
+    IoQueue queue_;
+    std::vector<AlignedBlock> blocks_;
+    std::vector<long long> results_;  // bytes read per slot, -1 while in flight
+    int fd_;
+    bool direct_;
+    bool failed_;
+    uint64_t size_;
+    uint64_t next_offset_;   // of the next block to submit
+    uint64_t block_;         // index of the block being consumed, +1
+};
+
+// Read stream for path when the backend is IO_DIRECT; null otherwise or if
+// the file cannot be opened that way, and the caller keeps its own stream.
+std::unique_ptr<DirectReadBuf> open_direct_input(const char *path);
+
+// Append-only output for the direct backend. Writes are gathered into aligned
+// blocks and DIRECT_IO_DEPTH of them are kept in flight; close() writes the
+// padded tail block and trims the file to its real length. Without O_DIRECT,
+// each block's pages are written back and dropped before its buffer is reused.
+class DirectWriter {
+public:
+    explicit DirectWriter(bool allow_uring = true);
+    ~DirectWriter();
+
+    bool open(const char *path);
+    bool write(const uint8_t *data, size_t len);
+    uint64_t size() const { return size_; }
+    bool direct() const { return direct_; }
+    const IoQueue &queue() const { return queue_; }
+    bool close();
+
+private:
+    bool flush_block(size_t len);
+    bool wait_one();  // false only if no completion could be reaped
+    void drop(uint64_t block);
+
+    IoQueue queue_;
+    std::vector<AlignedBlock> blocks_;
+    std::vector<bool> busy_;
+    int fd_;
+    bool direct_;
+    bool failed_;
+    uint64_t size_;     // bytes accepted by write()
+    uint64_t block_;    // index of the block being filled
+    size_t fill_;       // bytes in it
+};
+
+// Writer for path when the backend is IO_DIRECT; null otherwise or if the
+// file cannot be created that way.
+std::unique_ptr<DirectWriter> open_direct_output(const char *path);
+
+#endif
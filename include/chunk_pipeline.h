@@ -0,0 +1,305 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include "container.h"
+#include "run_stats.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+struct ChunkData {
+    std::vector<uint8_t> data;
+    const uint8_t *source;         // mapped plaintext still to be copied into data, or null
+    int index;
+    uint32_t flags;                // CHUNK_* bits set by the prepare stage
+    std::vector<uint8_t> scratch;  // kept with the slot for the prepare stage
+    size_t plain_length;           // before the prepare stage
+    uint64_t compress_ns;          // spent in the codec by the prepare stage
+    uint64_t sample_ns;            // spent sampling entropy
+};
+
+// Number of chunks allowed between the reader and the archive writer per worker.
+// Peak memory of an encrypt is roughly chunk_size * num_threads * PIPELINE_DEPTH_PER_THREAD.
+const size_t PIPELINE_DEPTH_PER_THREAD = 2;
+
+// Bounded reader -> pool transform tasks -> ordered consumer pipeline.
+// Chunk i lives in slot i % depth; the reader only refills a slot once the
+// consumer has released the chunk that previously occupied it, so at most
+// `depth` chunks are ever resident regardless of the input size.
+//
+// An optional prepare stage (compression) runs as one pool task per chunk
+// before its transform groups are scheduled. It may replace the chunk's data
+// with a shorter encoding; the transform then covers the new length.
+//
+// Input comes from a stream, or from a mapped file. With a mapping the reader
+// thread only hands out pointers: each transform group copies its own range
+// out of the mapping just before transforming it, while it is hot in cache,
+// and the prepare stage compresses straight from the mapping.
+//
+// With a recorder, the pipeline times its read, prepare (PHASE_COMPRESS) and
+// transform work as it runs it. A prepare stage reading a mapping directly
+// pays that chunk's page faults in PHASE_COMPRESS.
+class ChunkPipeline {
+public:
+    typedef std::function<void(ChunkData &, size_t group)> Transform;
+    typedef std::function<void(ChunkData &)> Prepare;
+
+    ChunkPipeline(std::istream &in, size_t total_size, size_t chunk_size,
+                  size_t depth, ThreadPool &pool, Transform transform, Prepare prepare = Prepare(),
+                  RunRecorder *recorder = nullptr)
+        : ChunkPipeline(in, nullptr, total_size, chunk_size, depth, pool, transform, prepare, recorder) {}
+
+    // Takes the plaintext from `mapped` when it is not null, otherwise from `in`.
+    ChunkPipeline(std::istream &in, const uint8_t *mapped, size_t total_size, size_t chunk_size,
+                  size_t depth, ThreadPool &pool, Transform transform, Prepare prepare = Prepare(),
+                  RunRecorder *recorder = nullptr)
+        : in_(in), mapped_(mapped), total_size_(total_size), chunk_size_(chunk_size),
+          num_chunks_(chunk_size ? (total_size + chunk_size - 1) / chunk_size : 0),
+          slots_(depth), state_(depth, SLOT_FREE), groups_left_(depth, 0),
+          transform_(transform), prepare_(prepare), recorder_(recorder), pool_(pool), tasks_(pool), released_(0),
+          aborted_(false), failed_(false) {
+        reader_ = std::thread(&ChunkPipeline::read_loop, this);
+    }
+
+    ~ChunkPipeline() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            aborted_ = true;
+        }
+        cv_.notify_all();
+        if (reader_.joinable()) reader_.join();
+        tasks_.wait();
+    }
+
+    size_t num_chunks() const { return num_chunks_; }
+
+    size_t chunk_length(size_t index) const {
+        return std::min(chunk_size_, total_size_ - index * chunk_size_);
+    }
+
+    // Blocks until chunk `index` is transformed. Chunks must be acquired in order.
+    // While waiting it runs queued pool work, so a batch of encrypts blocked on
+    // their own chunks still keeps every core busy.
+    ChunkData *acquire(size_t index) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        size_t slot = index % slots_.size();
+        auto ready = [&] {
+            return aborted_ || failed_ || (state_[slot] == SLOT_DONE && (size_t)slots_[slot].index == index);
+        };
+        // Traced as a stall: the consumer got ahead of the transforms.
+        TraceScope stall(ready() ? nullptr : "wait", "chunk", (int64_t)index);
+        while (!ready()) {
+            lock.unlock();
+            bool ran = pool_.run_pending();
+            lock.lock();
+            if (!ran) cv_.wait_for(lock, std::chrono::milliseconds(1), ready);
+        }
+        if (aborted_ || failed_) return nullptr;
+        return &slots_[slot];
+    }
+
+    // Hands the slot holding chunk `index` back to the reader. The slot keeps its
+    // buffer, so steady-state encryption performs no per-chunk allocation.
+    void release(size_t index) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            size_t slot = index % slots_.size();
+            if (prepare_) count_chunk(slots_[slot]);
+            state_[slot] = SLOT_FREE;
+            released_++;
+        }
+        cv_.notify_all();
+    }
+
+    bool failed() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return failed_;
+    }
+
+    // What the prepare stage did to the chunks released so far.
+    CompressionStats compression_stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    enum SlotState { SLOT_FREE, SLOT_BUSY, SLOT_DONE };
+
+    void count_chunk(const ChunkData &chunk) {
+        stats_.chunks++;
+        stats_.bytes_in += chunk.plain_length;
+        stats_.bytes_out += chunk.data.size();
+        stats_.compress_ns += chunk.compress_ns;
+        stats_.sample_ns += chunk.sample_ns;
+        if (chunk.flags & CHUNK_COMPRESSED) {
+            stats_.chunks_compressed++;
+        } else if (chunk.flags & CHUNK_INCOMPRESSIBLE) {
+            stats_.chunks_skipped++;
+            stats_.bytes_skipped += chunk.plain_length;
+        } else {
+            stats_.chunks_not_smaller++;
+            stats_.bytes_not_smaller += chunk.plain_length;
+            stats_.compress_ns_not_smaller += chunk.compress_ns;
+        }
+    }
+
+    void read_loop() {
+        trace_set_thread_name("chunk reader");
+        for (size_t i = 0; i < num_chunks_; i++) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                // Traced as a stall: every slot is in flight.
+                TraceScope stall(i < released_ + slots_.size() ? nullptr : "slot wait", "chunk", (int64_t)i);
+                cv_.wait(lock, [&] { return aborted_ || i < released_ + slots_.size(); });
+                if (aborted_) return;
+            }
+            // A free slot is owned by the reader alone, so it is filled outside the lock.
+            size_t slot = i % slots_.size();
+            size_t want = chunk_length(i);
+            slots_[slot].data.resize(want);
+            size_t bytes_read = want;
+            if (mapped_) {
+                // Counted here: a compressed chunk is read by the prepare stage.
+                if (recorder_) recorder_->add_bytes(PHASE_READ, want);
+                slots_[slot].source = mapped_ + i * chunk_size_;
+            } else {
+                slots_[slot].source = nullptr;
+                PhaseTimer timer(recorder_, PHASE_READ, want, (int64_t)i);
+                in_.read((char*)slots_[slot].data.data(), want);
+                bytes_read = in_.gcount();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (bytes_read != want) {
+                    failed_ = true;
+                } else {
+                    slots_[slot].index = (int)i;
+                    slots_[slot].flags = 0;
+                    slots_[slot].plain_length = want;
+                    slots_[slot].compress_ns = 0;
+                    slots_[slot].sample_ns = 0;
+                    state_[slot] = SLOT_BUSY;
+                }
+            }
+            if (bytes_read != want) {
+                cv_.notify_all();
+                return;
+            }
+            if (prepare_) {
+                tasks_.run([this, slot]() {
+                    if (!aborted_) {
+                        PhaseTimer timer(recorder_, PHASE_COMPRESS, slots_[slot].plain_length, slots_[slot].index);
+                        prepare_(slots_[slot]);
+                    }
+                    schedule_groups(slot);
+                });
+            } else {
+                schedule_groups(slot);
+            }
+        }
+    }
+
+    void schedule_groups(size_t slot) {
+        size_t groups = task_group_count(slots_[slot].data.size());
+        if (groups == 0) {
+            finish_slot(slot);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            groups_left_[slot] = groups;
+        }
+        for (size_t g = 0; g < groups; g++) {
+            tasks_.run([this, slot, g]() { run_group(slot, g); });
+        }
+    }
+
+    void finish_slot(size_t slot) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            state_[slot] = SLOT_DONE;
+        }
+        cv_.notify_all();
+    }
+
+    void run_group(size_t slot, size_t group) {
+        ChunkData &chunk = slots_[slot];
+        size_t begin = group * TASK_GROUP_SIZE;
+        size_t end = std::min(chunk.data.size(), begin + TASK_GROUP_SIZE);
+        if (chunk.source && !aborted_) {
+            PhaseTimer timer(recorder_, PHASE_READ, 0, chunk.index);
+            memcpy(chunk.data.data() + begin, chunk.source + begin, end - begin);
+        }
+        if (!aborted_) {
+            PhaseTimer timer(recorder_, PHASE_TRANSFORM, end - begin, chunk.index);
+            transform_(chunk, group);
+        }
+        bool done;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done = --groups_left_[slot] == 0;
+            if (done) state_[slot] = SLOT_DONE;
+        }
+        if (done) cv_.notify_all();
+    }
+
+    std::istream &in_;
+    const uint8_t *mapped_;
+    size_t total_size_;
+    size_t chunk_size_;
+    size_t num_chunks_;
+    std::vector<ChunkData> slots_;
+    std::vector<SlotState> state_;
+    std::vector<size_t> groups_left_;
+    Transform transform_;
+    Prepare prepare_;
+    RunRecorder *recorder_;
+    CompressionStats stats_ = {};
+    ThreadPool &pool_;
+    TaskGroup tasks_;
+    size_t released_;
+    std::atomic<bool> aborted_;
+    bool failed_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread reader_;
+};
+
+// Prepare stage that compresses each chunk's plaintext with opts and marks it
+// CHUNK_COMPRESSED. A chunk whose sampled entropy is at least
+// INCOMPRESSIBLE_ENTROPY is marked CHUNK_INCOMPRESSIBLE and stored raw without
+// running the codec; chunks that are tried but do not shrink also stay raw.
+// Empty for store.
+inline ChunkPipeline::Prepare compress_stage(const CompressionOptions &opts) {
+    if (opts.codec == COMPRESS_STORE) return ChunkPipeline::Prepare();
+    return [opts](ChunkData &chunk) {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+        const uint8_t *plain = chunk.source ? chunk.source : chunk.data.data();
+        bool incompressible = sample_entropy(plain, chunk.data.size()) >= INCOMPRESSIBLE_ENTROPY;
+        Clock::time_point sampled = Clock::now();
+        chunk.sample_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(sampled - start).count();
+        if (incompressible) {
+            chunk.flags |= CHUNK_INCOMPRESSIBLE;
+            return;
+        }
+        if (compress_chunk(opts, plain, chunk.data.size(), chunk.scratch)) {
+            chunk.data.swap(chunk.scratch);
+            chunk.source = nullptr;
+            chunk.flags |= CHUNK_COMPRESSED;
+        }
+        chunk.compress_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sampled).count();
+    };
+}
+
+#endif
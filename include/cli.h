@@ -11,8 +11,31 @@ typedef struct {
     char *output_file;
 } CliArgs;
 
+// Options that may appear anywhere on the command line.
+typedef struct {
+    const char *kernel;     // --kernel=NAME: force a transform kernel variant
+    const char *output_dir; // --output-dir=DIR: where batch commands write their outputs
+    const char *format;     // --format=zip|v2|stream: container written by encrypt
+    const char *compress;   // --compress=store|deflate[:N]|lzma[:N]: chunk codec for encrypt
+    const char *offset;     // --offset=N: decrypt only from plaintext byte N
+    const char *length;     // --length=N: decrypt at most N bytes
+    const char *io;         // --io=mmap|buffered|direct: how files are read and written
+    int stats;              // --stats[=text|json]: print what the run did (a CLI_STATS_* value)
+    const char *trace;      // --trace=FILE or --trace FILE: write a Chrome trace of the run
+} CliOptions;
+
+#define CLI_STATS_OFF 0
+#define CLI_STATS_TEXT 1
+#define CLI_STATS_JSON 2
+
 int parse_args(int argc, char *argv[], CliArgs *args);
 
+// Removes the recognised --options from argv, shifting the positional
+// arguments down, and returns the new argc. Anything else, including an
+// argument that merely starts with "--", stays positional; a bare "--" ends
+// the options and is dropped.
+int parse_options(int argc, char *argv[], CliOptions *opts);
+
 void free_args(CliArgs *args);
 
 #ifdef __cplusplus
@@ -0,0 +1,86 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Plaintext compression applied to each chunk before the transform, so the
+// codec sees the original data rather than scrambled bytes.
+typedef enum {
+    COMPRESS_STORE = 0,
+    COMPRESS_DEFLATE = 1,  // zlib, levels 1-9
+    COMPRESS_LZMA = 2      // xz/LZMA2 preset, levels 0-9
+} CompressionCodec;
+
+// What the compression stage did over one or more encrypts. A chunk is either
+// compressed, skipped (its sampled entropy said it would not shrink, so no
+// compression was attempted) or tried but kept raw because it did not shrink.
+typedef struct {
+    uint64_t chunks;
+    uint64_t chunks_compressed;
+    uint64_t chunks_skipped;
+    uint64_t chunks_not_smaller;
+    uint64_t bytes_in;            // plaintext bytes seen by the stage
+    uint64_t bytes_out;           // bytes handed on to the transform
+    uint64_t bytes_skipped;       // plaintext bytes of skipped chunks
+    uint64_t bytes_not_smaller;   // plaintext bytes of tried-but-raw chunks
+    uint64_t compress_ns;         // time spent in the codec, all threads
+    uint64_t compress_ns_not_smaller;  // ... of which on tried-but-raw chunks
+    uint64_t sample_ns;           // time spent sampling entropy
+} CompressionStats;
+
+typedef struct {
+    CompressionCodec codec;
+    int level;
+    CompressionStats *stats;  // optional: encrypts add their counts here
+} CompressionOptions;
+
+// Default level of each codec when the option names none.
+#define DEFLATE_DEFAULT_LEVEL 6
+#define LZMA_DEFAULT_LEVEL 6
+
+// Sampled entropy, in bits per byte, at or above which a chunk is stored raw
+// without trying the codec. Text sits around 4-5, already-compressed data
+// (JPEG, gzip, Parquet pages) just under 8.
+#define INCOMPRESSIBLE_ENTROPY 7.5
+
+// Parses "store", "deflate", "deflate:N", "lzma" or "lzma:N" into the codec
+// and level of opts; stats is left as it is. Returns 0, or -1 for an unknown
+// codec or out-of-range level.
+int parse_compression(const char *text, CompressionOptions *opts);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <vector>
+
+// "deflate:6" style name of the settings, as recorded in the metadata; empty
+// for store.
+std::string format_compression(const CompressionOptions &opts);
+
+// Estimated Shannon entropy of data in bits per byte, from a byte histogram
+// of up to 4KB sampled evenly across it.
+double sample_entropy(const uint8_t *data, size_t len);
+
+// Estimated codec time that skipping saved: the skipped bytes at the cost per
+// byte measured on chunks that were tried and did not shrink (or on all
+// tried chunks if none). 0 when nothing was tried to measure against.
+uint64_t estimated_skip_savings_ns(const CompressionStats &stats);
+
+// Compresses len bytes into out. Returns false when the codec failed or the
+// result would not be smaller than the input: the chunk is then stored raw.
+bool compress_chunk(const CompressionOptions &opts, const uint8_t *data, size_t len,
+                    std::vector<uint8_t> &out);
+
+// Decompresses a chunk that must expand to exactly plain_len bytes.
+bool decompress_chunk(CompressionCodec codec, const uint8_t *data, size_t len,
+                      uint8_t *out, size_t plain_len);
+
+// Adds src to dst. Safe to call from several threads at once (batch drivers
+// finishing files into one CompressionStats).
+void merge_compression_stats(CompressionStats *dst, const CompressionStats &src);
+
+#endif
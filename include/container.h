@@ -0,0 +1,100 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include "compression.h"
+#include "key_schedule.h"
+#include "run_stats.h"
+#include <string>
+#include <vector>
+
+// Pieces every container format shares: the metadata record, key derivation
+// and password checks, and the per-chunk transform. The ZIP (v1) format and
+// the framed stream format differ only in how they lay these out.
+
+// Sub-chunks are transformed independently, so each chunk is split into groups
+// of this many bytes and every group becomes one pool task.
+static const size_t TASK_GROUP_SIZE = 64 * SUB_CHUNK_SIZE;
+
+inline size_t task_group_count(size_t len) {
+    return (len + TASK_GROUP_SIZE - 1) / TASK_GROUP_SIZE;
+}
+
+// Chunk size for a file of this size: whole files below 5MB, then 512KB, 2MB
+// and 8MB chunks as files grow. Every chunk but the last has this size.
+size_t get_chunk_size(size_t file_size);
+
+// Applies the forward or reverse transform to the sub-chunks of one task group.
+void transform_group(uint8_t *chunk, size_t chunk_len, size_t group,
+                     const KeySchedule &schedule, int index, bool reverse);
+
+// Transforms a whole chunk, one pool task per group, each timed as
+// PHASE_TRANSFORM when there is a recorder.
+void transform_chunk(uint8_t *chunk, size_t chunk_len, const KeySchedule &schedule,
+                     int index, bool reverse, RunRecorder *recorder = nullptr);
+
+// The "key : value" lines stored in filedata.crypt. Compressed archives add
+// the codec and the plaintext size (chunks no longer map offsets by their
+// stored sizes); uncompressed ones keep the original four lines.
+struct ContainerMetadata {
+    std::string filename;
+    std::string salt;
+    int cost = 10;
+    std::string hash_verify;
+    std::string compression;  // format_compression text, empty for store
+    uint64_t size = 0;        // plaintext bytes, recorded when compressed
+};
+
+std::string format_metadata(const ContainerMetadata &meta);
+
+// Returns false if the text has no salt or verifier.
+bool parse_metadata(const std::string &text, ContainerMetadata &meta);
+
+// Per-chunk flags. CHUNK_COMPRESSED: the stored bytes are the transformed
+// output of the metadata's codec rather than of the plaintext itself.
+// CHUNK_INCOMPRESSIBLE: the chunk is raw because entropy sampling ruled out
+// compressing it (informational; it reads like any raw chunk).
+static const uint32_t CHUNK_COMPRESSED = 1;
+static const uint32_t CHUNK_INCOMPRESSIBLE = 2;
+
+// Codec named by meta.compression (store when empty). False if unknown.
+bool metadata_codec(const ContainerMetadata &meta, CompressionCodec &codec);
+
+// Picks a fresh salt and derives the file key (the hashed password) and its
+// verifier into meta. Returns false if the random source or KDF failed.
+bool derive_new_key(const char *password, int cost, ContainerMetadata &meta, std::string &key);
+
+// Derives the key for existing metadata. Returns 0, -1 on error, or -2 if the
+// password does not reproduce the stored verifier.
+int derive_key(const char *password, const ContainerMetadata &meta, std::string &key);
+
+// The metadata text transformed with the file key (filedata_enc.crypt), and
+// the matching check: decrypting it must give back the plaintext metadata.
+std::vector<uint8_t> encrypt_metadata(const KeySchedule &schedule, const std::string &metadata);
+bool metadata_matches(const KeySchedule &schedule, std::vector<uint8_t> metadata_enc,
+                      const std::string &metadata);
+
+// Leading magic of each native container; anything else is taken for ZIP (v1).
+static const char STREAM_MAGIC[8] = {'M', 'C', 'R', 'Y', 'P', 'T', 'S', '1'};
+static const char NATIVE_MAGIC[8] = {'M', 'C', 'R', 'Y', 'P', 'T', 'V', '2'};
+
+enum ContainerFormat { CONTAINER_ZIP, CONTAINER_STREAM, CONTAINER_NATIVE };
+
+// Format of an existing file, from its first bytes.
+ContainerFormat detect_container(const char *path);
+
+// decrypt_stream between two named files, timing its phases into recorder
+// when there is one.
+int decrypt_stream_file(const char *input_file, const char *output_file, const char *password,
+                        RunRecorder *recorder = nullptr);
+
+// Decrypts a native v2 container (see native_container.h), timing its phases
+// into recorder when there is one.
+int decrypt_native_file(const char *input_file, const char *output_file, const char *password,
+                        RunRecorder *recorder = nullptr);
+
+// Last path component of a file name, as recorded in the metadata.
+std::string base_name(const char *path);
+
+#endif
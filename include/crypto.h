@@ -1,5 +1,6 @@
 #pragma once
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -7,6 +8,18 @@ extern "C" {
 
 char* hash_password(const char *password, int cost, const char *salt);
 
+// Length of the salts hash_password generates when called without one.
+#define SALT_LENGTH 16
+
+// Writes a fresh salt of SALT_LENGTH characters plus a terminator to out.
+// Returns 0, or -1 if the system random source failed.
+int random_salt(char *out);
+
+// Josephus-order permutation used by hash_password: starting at position 0,
+// repeatedly step n - 1 places through the remaining bytes, emit the byte
+// landed on and remove it. Writes len bytes to out.
+void sort_by_nth_element(const uint8_t *data, size_t len, size_t n, uint8_t *out);
+
 int encrypt_file(const char *input_file, const char *output_file, const unsigned char *key, size_t key_len);
 
 int decrypt_file(const char *input_file, const char *output_file, const unsigned char *key, size_t key_len);
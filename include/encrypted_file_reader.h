@@ -0,0 +1,101 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include "archive_reader.h"
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Counters of one EncryptedFileReader since it was opened.
+struct EncryptedReaderStats {
+    uint64_t reads;            // pread calls
+    uint64_t bytes_returned;   // plaintext bytes handed to callers
+    uint64_t cache_hits;       // chunk lookups served from the cache
+    uint64_t cache_misses;     // chunk lookups that had to decrypt
+    uint64_t bytes_decrypted;  // plaintext bytes decrypted (whole chunks on a miss)
+    size_t cached_bytes;       // decrypted bytes held in the cache now
+
+    double hit_rate() const {
+        uint64_t lookups = cache_hits + cache_misses;
+        return lookups ? (double)cache_hits / lookups : 0.0;
+    }
+};
+
+// Random reads from a ZIP (v1) or native v2 archive. open() derives the key
+// once; every pread after that only reads and transforms chunks that are not
+// already in a size-bounded LRU cache of decrypted chunks.
+//
+// pread may be called from any number of threads at once (but not alongside
+// open or close). Two readers that miss on the same chunk share one
+// decryption instead of each running it. Chunks bigger than the cache are
+// never cached; reads from them decrypt just the sub-chunks they cover.
+class EncryptedFileReader {
+public:
+    static const size_t DEFAULT_CACHE_BYTES = 64 * 1024 * 1024;
+
+    // cache_bytes bounds the decrypted chunks kept; 0 disables the cache.
+    explicit EncryptedFileReader(size_t cache_bytes = DEFAULT_CACHE_BYTES);
+    ~EncryptedFileReader();
+
+    EncryptedFileReader(const EncryptedFileReader &) = delete;
+    EncryptedFileReader &operator=(const EncryptedFileReader &) = delete;
+
+    // Returns 0, -1 on error (including stream containers), or -2 for a wrong
+    // password.
+    int open(const char *path, const char *password);
+    bool is_open() const { return reader_ != nullptr; }
+    void close();
+
+    // Plaintext size of the open archive.
+    uint64_t size() const { return reader_ ? reader_->size() : 0; }
+
+    // Copies up to len plaintext bytes at offset into out. Returns the number
+    // of bytes copied (short only at the end of the file) or -1 on error.
+    long long pread(uint8_t *out, size_t len, uint64_t offset);
+
+    EncryptedReaderStats stats() const;
+
+private:
+    typedef std::shared_ptr<const std::vector<uint8_t>> ChunkPtr;
+
+    // A chunk being decrypted: later readers of it wait here for the result.
+    struct Pending {
+        std::mutex mutex;
+        std::condition_variable done_cv;
+        bool done = false;
+        ChunkPtr chunk;
+    };
+
+    struct CacheEntry {
+        size_t index;
+        ChunkPtr chunk;
+    };
+
+    ChunkPtr get_chunk(size_t index);
+    ChunkPtr decrypt_chunk(size_t index);
+    void insert_locked(size_t index, const ChunkPtr &chunk);
+
+    std::unique_ptr<ArchiveReader> reader_;
+    size_t cache_capacity_;
+
+    // Guards the LRU list (most recent first), its index and pending_.
+    mutable std::mutex mutex_;
+    std::list<CacheEntry> lru_;
+    std::unordered_map<size_t, std::list<CacheEntry>::iterator> cached_;
+    std::unordered_map<size_t, std::shared_ptr<Pending>> pending_;
+    size_t cached_bytes_;
+
+    std::atomic<uint64_t> reads_;
+    std::atomic<uint64_t> bytes_returned_;
+    std::atomic<uint64_t> cache_hits_;
+    std::atomic<uint64_t> cache_misses_;
+    std::atomic<uint64_t> bytes_decrypted_;
+};
+
+#endif
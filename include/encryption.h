@@ -1,6 +1,9 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include "compression.h"
+#include "run_stats.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,6 +20,54 @@ void byte_manipulations_reverse(uint8_t *data, size_t data_len, const uint8_t *k
 int encrypt_file_advanced(const char *input_file, const char *output_file, const char *password, int cost);
 int decrypt_file_advanced(const char *input_file, const char *output_file, const char *password);
 
+// decrypt_file_advanced that also fills stats (when not NULL) on success.
+// Stream containers report the totals only: their phases are not timed.
+int decrypt_file_stats(const char *input_file, const char *output_file, const char *password, RunStats *stats);
+
+// encrypt_file_advanced with a compression stage: each chunk's plaintext is
+// compressed on the thread pool before the transform, the codec is recorded
+// in the metadata and the chunks are added to the ZIP as stored entries.
+// NULL or COMPRESS_STORE writes the same archive as encrypt_file_advanced.
+// stats, when not NULL, receives the timings of a successful encrypt.
+int encrypt_file_compressed(const char *input_file, const char *output_file, const char *password, int cost,
+                            const CompressionOptions *compression, RunStats *stats);
+
+// Native v2 container: binary header, chunks stored back to back and a
+// fixed-width chunk index in the footer, so opening an archive of any size
+// takes three positional reads. decrypt_file_advanced reads it too.
+// compression may be NULL (store), and so may stats.
+int encrypt_file_v2(const char *input_file, const char *output_file, const char *password, int cost,
+                    const CompressionOptions *compression, RunStats *stats);
+
+// Decrypts plaintext bytes [offset, offset + length) of a ZIP or v2 archive
+// into output_file, reading and transforming only the 1KB sub-chunks that
+// overlap the range. length is clamped to the end of the file; an offset past
+// the end, or a stream container (no random access), fails with -1.
+int decrypt_file_range(const char *input_file, const char *output_file, const char *password,
+                       uint64_t offset, uint64_t length);
+
+// Framed stream container: a header, length-prefixed chunk frames and a
+// trailer, written and read strictly front to back with bounded memory, so
+// either end can be a pipe. name goes into the metadata (NULL records "-").
+// decrypt_file_advanced recognises stream containers as well as ZIP archives.
+int encrypt_stream(FILE *in, FILE *out, const char *name, const char *password, int cost);
+int decrypt_stream(FILE *in, FILE *out, const char *password);
+
+// One file of a batch. status receives the file's encrypt/decrypt return code
+// (0 ok, -1 error, -2 wrong password).
+typedef struct {
+    const char *input_file;
+    const char *output_file;
+    int status;
+} BatchEntry;
+
+// Processes every entry with the same password, many files at a time on the
+// shared thread pool. Returns the number of entries whose status is non-zero.
+// Encrypt writes ZIP archives with the given compression (NULL for store).
+int encrypt_files_batch(BatchEntry *entries, size_t count, const char *password, int cost,
+                        const CompressionOptions *compression);
+int decrypt_files_batch(BatchEntry *entries, size_t count, const char *password);
+
 #ifdef __cplusplus
 }
 #endif
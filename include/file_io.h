@@ -0,0 +1,117 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include <mutex>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+// Positional file I/O: any thread may read or write at a fixed offset without
+// sharing a file position, so chunk workers never serialise on a seek.
+//
+// Regular files can also be memory-mapped (map()): readers then copy out of,
+// and decrypt workers write straight into, the page cache with no read or
+// write call per chunk. Mapping is best effort: it fails for empty files,
+// pipes and other non-regular files, and callers fall back to read_at /
+// write_at (or the buffered stream paths), which keep working either way.
+
+// How file data moves between the disk and chunk buffers.
+enum IoBackend {
+    IO_MMAP,      // map regular files (default)
+    IO_BUFFERED,  // streams and pread/pwrite through the page cache
+    IO_DIRECT     // O_DIRECT with queued requests (async_io.h), page cache left alone
+};
+
+// Process-wide backend. Defaults to the MYCRYPT_IO environment variable
+// (mmap, buffered or direct), else IO_MMAP; --io=NAME and tests switch it at
+// run time.
+IoBackend io_backend();
+void set_io_backend(IoBackend backend);
+const char *io_backend_name(IoBackend backend);
+// Returns 0 and sets *backend, or -1 for an unknown name.
+int parse_io_backend(const char *name, IoBackend *backend);
+
+// Writes back and evicts a file's cached pages, for files the direct backend
+// cannot reach itself (ZIP archives are read and written by libzip).
+void drop_file_cache(const char *path);
+
+// Size of a file in bytes, or 0 if it cannot be opened.
+uint64_t file_size_of(const char *path);
+
+// Read-only file for positional reads.
+class InputFile {
+public:
+    InputFile();
+    ~InputFile();
+
+    InputFile(const InputFile &) = delete;
+    InputFile &operator=(const InputFile &) = delete;
+
+    bool open(const char *path);
+    uint64_t size() const { return size_; }
+
+    // Maps the whole file read-only. Returns false (and stays unmapped) if
+    // mapping is disabled or impossible.
+    bool map();
+    const uint8_t *data() const { return map_; }
+
+    // Reads exactly len bytes at offset; false on error or end of file. With
+    // IO_DIRECT the range is dropped from the page cache once it is read.
+    bool read_at(uint8_t *data, size_t len, uint64_t offset) const;
+
+    void close();
+
+private:
+#ifdef _WIN32
+    HANDLE handle_;
+    HANDLE mapping_;
+#else
+    int fd_;
+#endif
+    uint64_t size_;
+    uint8_t *map_;
+};
+
+// Preallocated output file that any thread can write into at a fixed offset.
+class OutputFile {
+public:
+    OutputFile();
+    ~OutputFile() { close(); }
+
+    OutputFile(const OutputFile &) = delete;
+    OutputFile &operator=(const OutputFile &) = delete;
+
+    // Creates the file at its final size. With map, it is also mapped
+    // read-write when possible; data() then points at its bytes.
+    bool open(const char *path, size_t size, bool map = false);
+    uint8_t *data() { return map_; }
+
+    // Copies into the mapping when mapped, else one positional write. With
+    // IO_DIRECT writeback of the range starts at once, and it is dropped from
+    // the page cache one write later (by close for the last one).
+    bool write_at(const uint8_t *data, size_t len, size_t offset);
+    bool close();
+
+private:
+    // Waits for the previous write's writeback and drops it, leaving this
+    // one pending in its place.
+    void drop_previous(size_t offset, size_t len);
+
+#ifdef _WIN32
+    HANDLE handle_;
+    HANDLE mapping_;
+#else
+    int fd_;
+#endif
+    uint8_t *map_;
+    size_t size_;
+    std::mutex pending_mutex_;
+    size_t pending_offset_;  // range written but not yet dropped (IO_DIRECT)
+    size_t pending_len_;
+};
+
+#endif
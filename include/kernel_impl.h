@@ -0,0 +1,174 @@
+#pragma once
+// Kernel bodies shared by every instruction-set variant. Each kernels_*.cpp
+// defines a vector traits type and includes this header once, so the same
+// templates are compiled with that file's -m flags. Everything here has
+// internal linkage: an AVX2 instantiation must never be picked by the linker
+// for a caller in a baseline translation unit.
+//
+// Vector traits provide:
+//   T                   vector of 64-bit lanes
+//   BYTES               sizeof(T)
+//   load / store        unaligned, lanes in little-endian byte order
+//   sll / srl           per-lane shift left / right by a run-time count
+//   bit_or / bit_xor
+//
+// Buffers longer than 8 bytes are rotated as one little-endian bit string, so
+// rotating by 1..7 bits is a per-word shift that pulls in the top bits of the
+// previous word. Rotate-left walks down from the top and rotate-right walks up
+// from the bottom; each step reads only words it has not written yet, so
+// there is no carried dependency and every step is one vector operation.
+
+#include "kernels.h"
+
+// The SSE2/AVX2/AVX-512 variants are built with GCC/Clang -m flags on x86.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86 1
+#else
+#define KERNELS_X86 0
+#endif
+
+#if defined(__GNUC__)
+#define KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define KERNEL_INLINE inline
+#endif
+
+namespace {
+
+template <class V>
+KERNEL_INLINE void xor_stream_impl(uint8_t *data, const uint8_t *stream, size_t len) {
+    size_t i = 0;
+    for (; i + V::BYTES <= len; i += V::BYTES) {
+        V::store(data + i, V::bit_xor(V::load(data + i), V::load(stream + i)));
+    }
+    for (; i + 8 <= len; i += 8) {
+        store_le64(data + i, load_le64(data + i) ^ load_le64(stream + i));
+    }
+    for (; i < len; i++) {
+        data[i] ^= stream[i];
+    }
+}
+
+// Rotates data (len > 8) left by `bits` (1..7), then XORs it with stream if XOR.
+template <class V, bool XOR>
+KERNEL_INLINE void rotl_impl(uint8_t *data, size_t len, unsigned bits, const uint8_t *stream) {
+    const unsigned back = 64 - bits;
+    // The bits leaving the last byte wrap into byte 0; save them before the top is rewritten.
+    uint8_t wrap = (uint8_t)(data[len - 1] >> (8 - bits));
+    size_t k = len;
+    while (k >= V::BYTES + 8) {
+        k -= V::BYTES;
+        typename V::T r = V::bit_or(V::sll(V::load(data + k), bits), V::srl(V::load(data + k - 8), back));
+        if (XOR) r = V::bit_xor(r, V::load(stream + k));
+        V::store(data + k, r);
+    }
+    while (k >= 16) {
+        k -= 8;
+        uint64_t r = (load_le64(data + k) << bits) | (load_le64(data + k - 8) >> back);
+        if (XOR) r ^= load_le64(stream + k);
+        store_le64(data + k, r);
+    }
+    for (size_t i = k; i-- > 1;) {
+        uint8_t r = (uint8_t)((data[i] << bits) | (data[i - 1] >> (8 - bits)));
+        data[i] = XOR ? (uint8_t)(r ^ stream[i]) : r;
+    }
+    uint8_t r0 = (uint8_t)((data[0] << bits) | wrap);
+    data[0] = XOR ? (uint8_t)(r0 ^ stream[0]) : r0;
+}
+
+// XORs data (len > 8) with stream if XOR, then rotates it right by `bits` (1..7).
+template <class V, bool XOR>
+KERNEL_INLINE void rotr_impl(uint8_t *data, size_t len, unsigned bits, const uint8_t *stream) {
+    const unsigned back = 64 - bits;
+    // The bits leaving byte 0 wrap into the last byte; save them before byte 0 is rewritten.
+    uint8_t first = XOR ? (uint8_t)(data[0] ^ stream[0]) : data[0];
+    uint8_t wrap = (uint8_t)(first << (8 - bits));
+    size_t k = 0;
+    while (k + V::BYTES + 8 <= len) {
+        typename V::T cur = V::load(data + k);
+        typename V::T next = V::load(data + k + 8);
+        if (XOR) {
+            cur = V::bit_xor(cur, V::load(stream + k));
+            next = V::bit_xor(next, V::load(stream + k + 8));
+        }
+        V::store(data + k, V::bit_or(V::srl(cur, bits), V::sll(next, back)));
+        k += V::BYTES;
+    }
+    while (k + 16 <= len) {
+        uint64_t cur = load_le64(data + k);
+        uint64_t next = load_le64(data + k + 8);
+        if (XOR) {
+            cur ^= load_le64(stream + k);
+            next ^= load_le64(stream + k + 8);
+        }
+        store_le64(data + k, (cur >> bits) | (next << back));
+        k += 8;
+    }
+    for (; k + 1 < len; k++) {
+        uint8_t cur = XOR ? (uint8_t)(data[k] ^ stream[k]) : data[k];
+        uint8_t next = XOR ? (uint8_t)(data[k + 1] ^ stream[k + 1]) : data[k + 1];
+        data[k] = (uint8_t)((cur >> bits) | (next << (8 - bits)));
+    }
+    uint8_t last = XOR ? (uint8_t)(data[len - 1] ^ stream[len - 1]) : data[len - 1];
+    data[len - 1] = (uint8_t)((last >> bits) | wrap);
+}
+
+template <class V>
+void xor_stream_kernel(uint8_t *data, const uint8_t *stream, size_t len) {
+    xor_stream_impl<V>(data, stream, len);
+}
+
+template <class V>
+void rotl_kernel(uint8_t *data, size_t len, unsigned bits) {
+    rotl_impl<V, false>(data, len, bits, nullptr);
+}
+
+template <class V>
+void rotr_kernel(uint8_t *data, size_t len, unsigned bits) {
+    rotr_impl<V, false>(data, len, bits, nullptr);
+}
+
+template <class V>
+void rotl_xor_kernel(uint8_t *data, size_t len, unsigned bits, const uint8_t *stream) {
+    rotl_impl<V, true>(data, len, bits, stream);
+}
+
+template <class V>
+void xor_rotr_kernel(uint8_t *data, size_t len, unsigned bits, const uint8_t *stream) {
+    rotr_impl<V, true>(data, len, bits, stream);
+}
+
+// Full-sub-chunk rounds: shift and block length are compile-time constants,
+// so the compiler specialises the loops and drops the tail handling.
+template <class V, unsigned SHIFT>
+void round_forward_fixed(uint8_t *block, const uint8_t *key_stream) {
+    static_assert(SHIFT > 0 && SHIFT < 8, "sub-byte shifts only");
+    rotl_impl<V, true>(block, SUB_CHUNK_SIZE, SHIFT, key_stream);
+}
+
+template <class V, unsigned SHIFT>
+void round_reverse_fixed(uint8_t *block, const uint8_t *key_stream) {
+    static_assert(SHIFT > 0 && SHIFT < 8, "sub-byte shifts only");
+    rotr_impl<V, true>(block, SUB_CHUNK_SIZE, SHIFT, key_stream);
+}
+
+// constexpr so every variant's table is constant-initialized.
+template <class V>
+constexpr KernelSet make_kernel_set(const char *name) {
+    return KernelSet{
+        name,
+        &xor_stream_kernel<V>,
+        &rotl_kernel<V>,
+        &rotr_kernel<V>,
+        &rotl_xor_kernel<V>,
+        &xor_rotr_kernel<V>,
+        {nullptr, &round_forward_fixed<V, 1>, &round_forward_fixed<V, 2>, &round_forward_fixed<V, 3>,
+         &round_forward_fixed<V, 4>, &round_forward_fixed<V, 5>, &round_forward_fixed<V, 6>,
+         &round_forward_fixed<V, 7>},
+        {nullptr, &round_reverse_fixed<V, 1>, &round_reverse_fixed<V, 2>, &round_reverse_fixed<V, 3>,
+         &round_reverse_fixed<V, 4>, &round_reverse_fixed<V, 5>, &round_reverse_fixed<V, 6>,
+         &round_reverse_fixed<V, 7>},
+    };
+}
+
+}  // namespace
@@ -0,0 +1,109 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+#include <vector>
+
+// Size of the independently transformed blocks every chunk is split into.
+static const size_t SUB_CHUNK_SIZE = 1024;
+
+// Little-endian 64-bit load/store. Buffers longer than 8 bytes are rotated as
+// one little-endian bit string (byte 0 holds the least significant bits).
+static inline uint64_t load_le64(const uint8_t *p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+#else
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+#endif
+}
+
+static inline void store_le64(uint8_t *p, uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (int i = 0; i < 8; i++, v >>= 8) p[i] = (uint8_t)v;
+#else
+    memcpy(p, &v, 8);
+#endif
+}
+
+// Repeats key into out[0, out_len) so that out[i] == key[i % key_len].
+void expand_key_stream(uint8_t *out, size_t out_len, const uint8_t *key, size_t key_len);
+
+// data[i] ^= stream[i] for i in [0, len), through the active kernel set.
+void xor_stream(uint8_t *data, const uint8_t *stream, size_t len);
+
+// Byte i moves to (i + k) % len (up) or (i - k) % len (down). Small shifts
+// take a memmove and a stack copy; std::rotate is ~40x slower on 1KB.
+void rotate_bytes_up(uint8_t *data, size_t len, size_t k);
+void rotate_bytes_down(uint8_t *data, size_t len, size_t k);
+
+// A key expanded once into a 64-byte aligned buffer whose length (the period)
+// is a multiple of the key length and at least SUB_CHUNK_SIZE, so repeating-key
+// XOR becomes a straight vector XOR against the stream.
+class KeyStream {
+public:
+    KeyStream(const uint8_t *key, size_t key_len);
+
+    const uint8_t *data() const { return stream_; }
+    size_t period() const { return period_; }
+    size_t key_len() const { return key_len_; }
+    bool matches(const uint8_t *key, size_t key_len) const;
+
+    // data[i] ^= key[(offset + i) % key_len]
+    void apply(uint8_t *data, size_t len, size_t offset = 0) const;
+
+private:
+    std::vector<uint8_t> storage_;
+    uint8_t *stream_;
+    size_t period_;
+    size_t key_len_;
+};
+
+// One byte_manipulations round on a full SUB_CHUNK_SIZE block, with the key
+// already expanded to SUB_CHUNK_SIZE bytes. Rounds only ever rotate by 1..7
+// bits, so the tables are indexed by that shift; entry 0 is unused.
+//   forward: rotate_left(block, shift), then XOR with the key stream
+//   reverse: XOR with the key stream, then rotate_right(block, shift)
+typedef void (*BlockRoundFn)(uint8_t *block, const uint8_t *key_stream);
+
+// Every hot loop of the transform, compiled once per instruction set. The
+// rotate kernels take buffers longer than 8 bytes and shifts of 1..7 bits
+// (the sub-byte part of rotate_left/rotate_right); the fused variants also
+// XOR with a stream covering the whole buffer.
+struct KernelSet {
+    const char *name;
+    void (*xor_stream)(uint8_t *data, const uint8_t *stream, size_t len);
+    void (*rotl)(uint8_t *data, size_t len, unsigned bits);
+    void (*rotr)(uint8_t *data, size_t len, unsigned bits);
+    void (*rotl_xor)(uint8_t *data, size_t len, unsigned bits, const uint8_t *stream);
+    void (*xor_rotr)(uint8_t *data, size_t len, unsigned bits, const uint8_t *stream);
+    BlockRoundFn round_forward[8];
+    BlockRoundFn round_reverse[8];
+};
+
+enum KernelIsa {
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX2,
+    KERNEL_AVX512,
+    KERNEL_ISA_COUNT
+};
+
+// The variant in use. Chosen once, on first use, as the widest one the CPU
+// supports unless MYCRYPT_KERNEL names another (scalar, sse2, avx2, avx512).
+const KernelSet &active_kernels();
+
+// Kernel set for isa, or nullptr when it was not built or the CPU lacks it.
+const KernelSet *kernel_set(KernelIsa isa);
+
+// Switches the active variant by name ("auto" restores detection). Returns
+// false, leaving the selection unchanged, for unknown or unsupported names.
+// Not meant to be called while a transform is running.
+bool select_kernels(const char *name);
+
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include "kernels.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Everything byte_manipulations derives from the key, computed once per file
+// instead of once per sub-chunk. A transform with iteration value `iterat`
+// runs 10 + (iterat % 6) rounds; round r rotates by 1 + ((n + r) % 7) bits,
+// where n comes from the key, so the six chunk classes (index % 6) all run a
+// prefix of one shift sequence.
+class KeySchedule {
+public:
+    static const int MAX_ROUNDS = 15;
+
+    KeySchedule(const uint8_t *key, size_t key_len);
+
+    const uint8_t *key() const { return key_.data(); }
+    size_t key_len() const { return key_.size(); }
+    bool matches(const uint8_t *key, size_t key_len) const;
+
+    // Keys shorter than 6 bytes leave data untouched, as they always have.
+    bool active() const { return key_.size() >= 6; }
+
+    // Key repeated into an aligned buffer of at least SUB_CHUNK_SIZE bytes.
+    const KeyStream &stream() const { return stream_; }
+
+    static int rounds(int iterat) { return 10 + (iterat % 6); }
+    int shift(int round) const { return shifts_[round]; }
+
+    // byte_manipulations / byte_manipulations_reverse with this key. Every
+    // round is a rotation followed by a fixed XOR, so the whole transform is
+    // f(x) = rotate_left(x, T) ^ M with T the summed shifts and M = f(0).
+    // (T, M) is derived once per length and round count and then applied in a
+    // single rotate-and-XOR pass.
+    void forward(uint8_t *data, size_t len, int iterat) const;
+    void reverse(uint8_t *data, size_t len, int iterat) const;
+
+    // The same transforms round by round; derives the closed forms and covers
+    // lengths that are not cached.
+    void forward_rounds(uint8_t *data, size_t len, int iterat) const;
+    void reverse_rounds(uint8_t *data, size_t len, int iterat) const;
+
+    // Lengths above this, or beyond the first MAX_CACHED_FORMS distinct
+    // (length, rounds) pairs, run round by round instead of caching a mask.
+    static const size_t MAX_CACHED_LEN = 64 * 1024;
+    static const size_t MAX_CACHED_FORMS = 32;
+
+private:
+    struct ClosedForm {
+        size_t len = 0;
+        int rounds = 0;
+        size_t shift = 0;              // total rotation in bits, mod 8 * len
+        std::vector<uint8_t> mask;     // forward transform of an all-zero buffer
+    };
+
+    void run_forward(uint8_t *data, size_t len, int count) const;
+    void run_reverse(uint8_t *data, size_t len, int count) const;
+    void derive(ClosedForm &form, size_t len, int count) const;
+    const ClosedForm *closed_form(size_t len, int count) const;
+
+    std::vector<uint8_t> key_;
+    KeyStream stream_;
+    uint8_t shifts_[MAX_ROUNDS];
+    // Full sub-chunks for every chunk class (10..15 rounds), built up front so
+    // the hot path never takes the lock.
+    ClosedForm full_[MAX_ROUNDS + 1];
+    // Tails, metadata and other lengths, derived on first use.
+    mutable std::mutex cache_mutex_;
+    mutable std::vector<std::unique_ptr<ClosedForm>> cache_;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include "container.h"
+#include "file_io.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Native v2 container, all integers little-endian:
+//
+//   header   "MCRYPTV2" | u32 header_size | u32 flags (codec | level << 8) | u32 chunk_size | u32 cost
+//            | u64 plaintext size
+//            | u16 len | salt | u16 len | hash_verify | u16 len | file name
+//            | u32 len | encrypted metadata check
+//   data     chunk ciphertext stored back to back
+//   index    one 32-byte entry per chunk, in chunk order:
+//            u64 offset | u64 length | u64 chunk index | u32 flags | u32 reserved
+//   footer   u64 index offset | u64 chunk count | u64 plaintext size | "MCRYPTIX"
+//
+// Opening reads the header, the fixed-size footer and the index: three
+// positional reads whatever the archive size. Chunk i is entry i. Every
+// chunk but the last holds chunk_size plaintext bytes, so a plaintext offset
+// maps to its chunk by division. The metadata check is the ZIP format's
+// filedata_enc.crypt: the metadata text rebuilt from the header fields,
+// transformed with the file key.
+//
+// With a codec in the header flags, each chunk's plaintext is compressed
+// before the transform; chunks flagged CHUNK_COMPRESSED in the index hold that
+// encoding, the others (which did not shrink) are raw. Stored lengths then
+// vary, so offsets are assigned as chunks are written and the index, which
+// already sits at the end, records them.
+
+static const size_t NATIVE_INDEX_ENTRY_SIZE = 32;
+static const size_t NATIVE_FOOTER_SIZE = 32;
+
+struct NativeChunk {
+    uint64_t offset;    // of the stored bytes in the archive
+    uint64_t length;    // stored bytes
+    uint32_t flags;     // CHUNK_* bits
+};
+
+struct NativeArchive {
+    ContainerMetadata meta;  // compression and size are filled from the header
+    CompressionOptions compression = {COMPRESS_STORE, 0, NULL};
+    std::vector<uint8_t> check;
+    uint32_t chunk_size = 0;
+    uint64_t plaintext_size = 0;
+    std::vector<NativeChunk> chunks;
+
+    // Plaintext bytes in chunk i.
+    size_t chunk_plain_length(size_t i) const {
+        uint64_t begin = (uint64_t)i * chunk_size;
+        return (size_t)std::min<uint64_t>(chunk_size, plaintext_size - begin);
+    }
+};
+
+// Reads and validates the header, footer and index. Returns false if the file
+// is not a well-formed v2 container.
+bool open_native_archive(const InputFile &file, NativeArchive &archive);
+
+#endif
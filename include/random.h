@@ -0,0 +1,18 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Fills buffer with len bytes from the operating system's CSPRNG. Small
+// requests are served from a process-wide pool refilled in 4KB batches, so
+// salts and nonces do not cost a system call each. Thread-safe; the pool is
+// discarded in a forked child so parent and child never share bytes.
+// Returns 0 on success, -1 if the OS source failed (buffer is then zeroed).
+int random_bytes(uint8_t *buffer, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
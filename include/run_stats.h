@@ -0,0 +1,143 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Stages of an encrypt or decrypt, in the order the data meets them.
+typedef enum {
+    PHASE_KDF = 0,    // hash_password derivations of the key and its verifier
+    PHASE_READ,       // input bytes into chunk buffers
+    PHASE_COMPRESS,   // the chunk codec: compress on encrypt, decompress on decrypt
+    PHASE_TRANSFORM,  // the byte transform
+    PHASE_WRITE,      // chunks out to the file; for ZIP, libzip's own work in zip_close
+    PHASE_COUNT
+} RunPhase;
+
+// Phases run on several threads at once and overlap each other, so each one
+// has three times: wall from its first start to its last end, busy summed
+// over the threads working on it, and the CPU time of those threads.
+typedef struct {
+    uint64_t wall_ns;
+    uint64_t busy_ns;
+    uint64_t cpu_ns;
+    uint64_t bytes;  // bytes entering the phase
+} PhaseStats;
+
+// What one encrypt or decrypt did, filled in when it succeeds.
+typedef struct {
+    PhaseStats phases[PHASE_COUNT];
+    uint64_t wall_ns;         // the whole call
+    uint64_t cpu_ns;          // process CPU time (user + system) during the call
+    uint64_t bytes_in;        // size of the input file
+    uint64_t bytes_out;       // size of the output file
+    uint64_t chunks;
+    uint64_t chunk_size;      // plaintext bytes per chunk
+    uint32_t threads;         // pool workers
+    uint64_t peak_rss_bytes;  // process high-water mark of resident memory
+} RunStats;
+
+// "kdf", "read", "compress", "transform" or "write".
+const char *run_phase_name(RunPhase phase);
+
+// Bytes per busy second of a phase in MB/s: the rate of one thread working
+// on it. 0 for a phase that moved no bytes.
+double phase_mbps(const PhaseStats *phase);
+
+// Human-readable report: totals, then one line per phase.
+void print_run_stats(FILE *out, const RunStats *stats);
+
+// The same as one JSON object (times in milliseconds), without a newline.
+void print_run_stats_json(FILE *out, const RunStats *stats);
+
+#ifdef __cplusplus
+}
+
+#include "trace.h"
+#include <atomic>
+
+// CPU time of the calling thread.
+uint64_t thread_cpu_ns();
+
+// Collects a RunStats from every thread taking part in one call. Threads
+// record finished spans without locking; finish() writes the result out.
+// A recorder made with a null RunStats is inactive and ignores everything.
+class RunRecorder {
+public:
+    explicit RunRecorder(RunStats *out);
+
+    bool active() const { return out_ != nullptr; }
+
+    // Time since the recorder was made.
+    uint64_t now_ns() const;
+
+    // A span of `phase` from start_ns to end_ns (now_ns() clock) that used
+    // cpu_ns of its thread's CPU time and took in `bytes`.
+    void record(RunPhase phase, uint64_t start_ns, uint64_t end_ns, uint64_t cpu_ns, uint64_t bytes);
+
+    // Takes time back out of a phase, for waits nested inside a timed span.
+    void discount(RunPhase phase, uint64_t busy_ns, uint64_t cpu_ns);
+
+    void add_bytes(RunPhase phase, uint64_t bytes);
+
+    // Fills in the RunStats: the phases so far plus the totals of the call.
+    void finish(uint64_t bytes_in, uint64_t bytes_out, uint64_t chunks, uint64_t chunk_size);
+
+private:
+    struct Phase {
+        std::atomic<uint64_t> first_start;
+        std::atomic<uint64_t> last_end;
+        std::atomic<uint64_t> busy_ns;
+        std::atomic<uint64_t> cpu_ns;
+        std::atomic<uint64_t> bytes;
+    };
+
+    RunStats *out_;
+    uint64_t start_ns_;       // steady clock at construction
+    uint64_t start_cpu_ns_;   // process CPU time at construction
+    Phase phases_[PHASE_COUNT];
+};
+
+// Times a scope as one span of a phase, and traces it (tagged with the chunk
+// index when there is one) while a trace is on. Does nothing otherwise.
+class PhaseTimer {
+public:
+    PhaseTimer(RunRecorder *recorder, RunPhase phase, uint64_t bytes = 0, int64_t chunk = -1)
+        : recorder_(recorder && recorder->active() ? recorder : nullptr), phase_(phase), bytes_(bytes),
+          traced_(trace_enabled()) {
+        if (traced_) trace_event('B', run_phase_name(phase), chunk >= 0 ? "chunk" : nullptr, chunk);
+        if (recorder_) {
+            start_ns_ = recorder_->now_ns();
+            start_cpu_ns_ = thread_cpu_ns();
+        }
+    }
+
+    ~PhaseTimer() { stop(); }
+
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+    // Ends the span early; the destructor then records nothing.
+    void stop() {
+        if (recorder_) {
+            recorder_->record(phase_, start_ns_, recorder_->now_ns(), thread_cpu_ns() - start_cpu_ns_, bytes_);
+            recorder_ = nullptr;
+        }
+        if (traced_) {
+            trace_event('E', run_phase_name(phase_), nullptr, 0);
+            traced_ = false;
+        }
+    }
+
+private:
+    RunRecorder *recorder_;
+    RunPhase phase_;
+    uint64_t bytes_;
+    bool traced_;
+    uint64_t start_ns_ = 0;
+    uint64_t start_cpu_ns_ = 0;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+#include <stddef.h>
+
+#ifdef __cplusplus
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent work-stealing thread pool. Each worker owns a deque: it pops its
+// own work LIFO and steals from the front of other workers' deques when idle.
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    // num_threads == 0 means one worker per hardware thread.
+    explicit ThreadPool(size_t num_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(Task task);
+
+    // Runs one queued task on the calling thread. Returns false if none was found.
+    bool run_pending();
+
+    size_t size() const { return workers_.size(); }
+
+    // Process-wide pool shared by encrypt and decrypt. One worker per hardware
+    // thread unless MYCRYPT_THREADS sets the count (read once, at first use).
+    static ThreadPool &shared();
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void worker_loop(size_t id);
+    bool pop_task(size_t id, Task &task);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<long> pending_;
+    std::atomic<size_t> next_queue_;
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+    bool stop_;
+};
+
+// Tracks a set of tasks submitted to a pool. wait() helps run queued work, so it
+// is safe to call from inside a pool task.
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool &pool);
+    ~TaskGroup();
+
+    void run(ThreadPool::Task task);
+    void wait();
+
+private:
+    ThreadPool &pool_;
+    std::atomic<size_t> remaining_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+// Calls fn(i) for every i in [0, count) on the pool and returns when all are done.
+void parallel_for(ThreadPool &pool, size_t count, const std::function<void(size_t)> &fn);
+
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Timeline tracing for chrome://tracing or Perfetto. While a trace is on,
+// every PhaseTimer span (per chunk read, compress, transform and write, and
+// the key derivations), each block of KDF_TRACE_BLOCK hash_password
+// iterations and each pipeline stall is recorded as a begin/end pair on its
+// thread.
+//
+// Threads append to their own buffers without locking; the buffers are only
+// read by trace_stop, so start and stop a trace between operations, not
+// during one.
+
+// hash_password iterations per traced block.
+#define KDF_TRACE_BLOCK 16
+
+// Starts recording, dropping anything recorded before.
+void trace_start(void);
+
+// Stops recording and writes the events recorded since trace_start as Chrome
+// Trace Event JSON, then drops them. Returns 0, or -1 if the file could not
+// be written.
+int trace_stop(const char *path);
+
+// Names the calling thread in traces (pool workers, the chunk reader).
+void trace_set_thread_name(const char *name);
+
+#ifdef __cplusplus
+}
+
+#include <atomic>
+
+extern std::atomic<bool> trace_on;
+
+inline bool trace_enabled() {
+    return trace_on.load(std::memory_order_relaxed);
+}
+
+// Appends a begin ('B') or end ('E') event to the calling thread's buffer.
+// name and arg_name must be string literals (only the pointers are kept);
+// arg is left out of the event when arg_name is null.
+void trace_event(char phase, const char *name, const char *arg_name, int64_t arg);
+
+// A begin/end pair around a scope, recorded only if tracing was on when the
+// scope began.
+class TraceScope {
+public:
+    TraceScope(const char *name, const char *arg_name = nullptr, int64_t arg = 0)
+        : name_(trace_enabled() ? name : nullptr) {
+        if (name_) trace_event('B', name_, arg_name, arg);
+    }
+
+    ~TraceScope() {
+        if (name_) trace_event('E', name_, nullptr, 0);
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name_;
+};
+
+#endif
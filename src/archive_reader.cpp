@@ -0,0 +1,91 @@
+#include "archive_reader.h"
+#include "container.h"
+#include "encryption.h"
+#include "file_io.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+
+bool ArchiveReader::decrypt_span(size_t chunk, size_t begin, size_t end, std::vector<uint8_t> &scratch,
+                                 uint8_t *out) const {
+    size_t chunk_len = chunk_length(chunk);
+    if (begin >= end || end > chunk_len) return begin == end;
+    if (compressed(chunk)) {
+        scratch.resize(stored_length(chunk));
+        if (!read_stored(chunk, 0, scratch.size(), scratch.data())) return false;
+        transform_chunk(scratch.data(), scratch.size(), *schedule_, (int)chunk, true);
+        if (begin == 0 && end == chunk_len) {
+            return decompress_chunk(codec_, scratch.data(), scratch.size(), out, chunk_len);
+        }
+        std::vector<uint8_t> plain(chunk_len);
+        if (!decompress_chunk(codec_, scratch.data(), scratch.size(), plain.data(), chunk_len)) return false;
+        memcpy(out, plain.data() + begin, end - begin);
+        return true;
+    }
+    if (begin == 0 && end == chunk_len) {
+        // The whole chunk: transform in place, no copy through scratch.
+        if (!read_stored(chunk, 0, chunk_len, out)) return false;
+        transform_chunk(out, chunk_len, *schedule_, (int)chunk, true);
+        return true;
+    }
+    // Widen to whole sub-chunks: those are the units the transform works on.
+    size_t first = begin - begin % SUB_CHUNK_SIZE;
+    size_t last = std::min(chunk_len, (end + SUB_CHUNK_SIZE - 1) / SUB_CHUNK_SIZE * SUB_CHUNK_SIZE);
+    scratch.resize(last - first);
+    if (!read_stored(chunk, first, scratch.size(), scratch.data())) return false;
+    // first is sub-chunk aligned, so the span's own 1KB steps line up with the
+    // chunk's sub-chunks and the last one may be the chunk's short tail.
+    transform_chunk(scratch.data(), scratch.size(), *schedule_, (int)chunk, true);
+    memcpy(out, scratch.data() + (begin - first), end - begin);
+    return true;
+}
+
+int open_archive_reader(const char *path, const char *password, std::unique_ptr<ArchiveReader> &reader) {
+    switch (detect_container(path)) {
+    case CONTAINER_NATIVE:
+        return open_native_reader(path, password, reader);
+    case CONTAINER_ZIP:
+        return open_zip_reader(path, password, reader);
+    case CONTAINER_STREAM:
+        break;
+    }
+    return -1;
+}
+
+int decrypt_file_range(const char *input_file, const char *output_file, const char *password,
+                       uint64_t offset, uint64_t length) {
+    std::unique_ptr<ArchiveReader> reader;
+    int rc = open_archive_reader(input_file, password, reader);
+    if (rc != 0) return rc;
+    if (offset > reader->size()) return -1;
+    length = std::min(length, reader->size() - offset);
+
+    OutputFile outfile;
+    if (!outfile.open(output_file, (size_t)length)) return -1;
+
+    // One task per chunk the range touches; every task decrypts just its
+    // part of the range and writes it at its place in the output.
+    std::atomic<bool> failed(false);
+    if (length > 0) {
+        size_t chunk_size = reader->chunk_size();
+        size_t first = (size_t)(offset / chunk_size);
+        size_t last = (size_t)((offset + length - 1) / chunk_size);
+        parallel_for(ThreadPool::shared(), last - first + 1, [&](size_t k) {
+            size_t chunk = first + k;
+            uint64_t chunk_begin = (uint64_t)chunk * chunk_size;
+            size_t begin = (size_t)(std::max(offset, chunk_begin) - chunk_begin);
+            size_t end = (size_t)(std::min(offset + length, chunk_begin + reader->chunk_length(chunk)) - chunk_begin);
+            std::vector<uint8_t> scratch, plain(end - begin);
+            if (!reader->decrypt_span(chunk, begin, end, scratch, plain.data()) ||
+                !outfile.write_at(plain.data(), plain.size(), (size_t)(chunk_begin + begin - offset))) {
+                failed = true;
+            }
+        });
+    }
+
+    bool ok = outfile.close() && !failed;
+    if (!ok) remove(output_file);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,493 @@
+#include "async_io.h"
+#include "file_io.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#define HAVE_IO_URING 1
+#endif
+
+// Number of blocking workers behind the thread fallback.
+static const unsigned IO_FALLBACK_THREADS = 4;
+
+#ifdef HAVE_IO_URING
+// Minimal io_uring driver over the raw system calls, so no liburing is needed.
+// Vectored opcodes (kernel 5.1) are used instead of plain READ/WRITE (5.6).
+struct IoQueue::Ring {
+    int fd;
+    uint8_t *sq_ptr;
+    uint8_t *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe *cqes;
+    std::vector<iovec> iovs;
+
+    Ring() : fd(-1), sq_ptr(nullptr), cq_ptr(nullptr), sq_len(0), cq_len(0), sqes(nullptr), sqes_len(0) {}
+
+    ~Ring() {
+        if (sqes) munmap(sqes, sqes_len);
+        if (cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+        if (sq_ptr) munmap(sq_ptr, sq_len);
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool setup(unsigned depth) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+        if (fd < 0) return false;
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) sq_len = cq_len = std::max(sq_len, cq_len);
+        void *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED) return false;
+        sq_ptr = (uint8_t*)sq;
+        if (single) {
+            cq_ptr = sq_ptr;
+        } else {
+            void *cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq == MAP_FAILED) return false;
+            cq_ptr = (uint8_t*)cq;
+        }
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        void *s = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (s == MAP_FAILED) return false;
+        sqes = (io_uring_sqe*)s;
+        sq_tail = (unsigned*)(sq_ptr + p.sq_off.tail);
+        sq_mask = *(unsigned*)(sq_ptr + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq_ptr + p.sq_off.array);
+        cq_head = (unsigned*)(cq_ptr + p.cq_off.head);
+        cq_tail = (unsigned*)(cq_ptr + p.cq_off.tail);
+        cq_mask = *(unsigned*)(cq_ptr + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq_ptr + p.cq_off.cqes);
+        iovs.resize(depth);
+        return true;
+    }
+
+    bool submit(size_t slot, const Request &r) {
+        iovs[slot].iov_base = r.buf + r.done;
+        iovs[slot].iov_len = r.len - r.done;
+        unsigned tail = *sq_tail;
+        unsigned index = tail & sq_mask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = r.write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = r.fd;
+        sqe->addr = (uint64_t)(uintptr_t)&iovs[slot];
+        sqe->len = 1;
+        sqe->off = r.offset + r.done;
+        sqe->user_data = slot;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        for (;;) {
+            int rc = (int)syscall(__NR_io_uring_enter, fd, 1, 0, 0, NULL, 0);
+            if (rc >= 0) return true;
+            if (errno != EINTR) return false;
+        }
+    }
+
+    bool reap(size_t *slot, long long *res) {
+        for (;;) {
+            unsigned head = *cq_head;
+            if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe &cqe = cqes[head & cq_mask];
+                *slot = (size_t)cqe.user_data;
+                *res = cqe.res;
+                __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            int rc = (int)syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (rc < 0 && errno != EINTR) return false;
+        }
+    }
+};
+#else
+struct IoQueue::Ring {
+    bool setup(unsigned) { return false; }
+    bool submit(size_t, const Request &) { return false; }
+    bool reap(size_t *, long long *) { return false; }
+};
+#endif
+
+IoQueue::IoQueue(unsigned depth, bool allow_uring)
+    : requests_(depth), outstanding_(0), stop_(false) {
+    for (Request &r : requests_) r.busy = false;
+    if (allow_uring) {
+        ring_.reset(new Ring());
+        if (!ring_->setup(depth)) ring_.reset();
+    }
+#ifndef _WIN32
+    if (!ring_) {
+        for (unsigned i = 0; i < std::min(depth, IO_FALLBACK_THREADS); i++) {
+            workers_.emplace_back(&IoQueue::worker_loop, this);
+        }
+    }
+#endif
+}
+
+IoQueue::~IoQueue() {
+    // Outstanding requests still point into their callers' buffers.
+    uint64_t tag;
+    long long result;
+    while (outstanding_ > 0 && wait(&tag, &result)) {}
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (std::thread &t : workers_) t.join();
+}
+
+bool IoQueue::submit_read(int fd, uint8_t *buf, size_t len, uint64_t offset, uint64_t tag) {
+    return submit(fd, false, buf, len, offset, tag);
+}
+
+bool IoQueue::submit_write(int fd, const uint8_t *buf, size_t len, uint64_t offset, uint64_t tag) {
+    return submit(fd, true, const_cast<uint8_t*>(buf), len, offset, tag);
+}
+
+bool IoQueue::submit(int fd, bool write, uint8_t *buf, size_t len, uint64_t offset, uint64_t tag) {
+    size_t slot = 0;
+    while (slot < requests_.size() && requests_[slot].busy) slot++;
+    if (slot == requests_.size()) return false;
+    Request &r = requests_[slot];
+    r.fd = fd;
+    r.write = write;
+    r.buf = buf;
+    r.len = len;
+    r.done = 0;
+    r.offset = offset;
+    r.tag = tag;
+    if (!issue(slot)) return false;
+    r.busy = true;
+    outstanding_++;
+    return true;
+}
+
+bool IoQueue::issue(size_t slot) {
+    if (ring_) return ring_->submit(slot, requests_[slot]);
+    if (workers_.empty()) return false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(slot);
+    }
+    work_cv_.notify_one();
+    return true;
+}
+
+bool IoQueue::reap(size_t *slot, long long *res) {
+    if (ring_) return ring_->reap(slot, res);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&] { return !completed_.empty(); });
+    *slot = completed_.front().first;
+    *res = completed_.front().second;
+    completed_.pop_front();
+    return true;
+}
+
+bool IoQueue::wait(uint64_t *tag, long long *result) {
+    while (outstanding_ > 0) {
+        size_t slot;
+        long long res;
+        if (!reap(&slot, &res)) return false;
+        Request &r = requests_[slot];
+        if (res > 0) r.done += (size_t)res;
+        // Short writes continue where they stopped; a short read is end of file.
+        if (res > 0 && r.write && r.done < r.len && issue(slot)) continue;
+        r.busy = false;
+        outstanding_--;
+        *tag = r.tag;
+        *result = res < 0 ? res : (long long)r.done;
+        return true;
+    }
+    return false;
+}
+
+void IoQueue::worker_loop() {
+#ifndef _WIN32
+    for (;;) {
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_cv_.wait(lock, [&] { return stop_ || !pending_.empty(); });
+            if (pending_.empty()) return;
+            slot = pending_.front();
+            pending_.pop_front();
+        }
+        const Request &r = requests_[slot];
+        ssize_t n;
+        do {
+            n = r.write ? pwrite(r.fd, r.buf + r.done, r.len - r.done, (off_t)(r.offset + r.done))
+                        : pread(r.fd, r.buf + r.done, r.len - r.done, (off_t)(r.offset + r.done));
+        } while (n < 0 && errno == EINTR);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            completed_.push_back(std::make_pair(slot, n < 0 ? -(long long)errno : (long long)n));
+        }
+        done_cv_.notify_one();
+    }
+#endif
+}
+
+AlignedBlock::AlignedBlock() : data(nullptr) {
+#ifdef _WIN32
+    data = (uint8_t*)_aligned_malloc(DIRECT_IO_BLOCK, DIRECT_IO_ALIGN);
+#else
+    void *p = nullptr;
+    if (posix_memalign(&p, DIRECT_IO_ALIGN, DIRECT_IO_BLOCK) == 0) data = (uint8_t*)p;
+#endif
+}
+
+AlignedBlock::~AlignedBlock() {
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+// Opens path with O_DIRECT when the filesystem supports it, else without.
+static int open_direct(const char *path, int flags, bool *direct) {
+#ifdef _WIN32
+    (void)path;
+    (void)flags;
+    *direct = false;
+    return -1;
+#else
+    int fd = -1;
+#ifdef O_DIRECT
+    fd = ::open(path, flags | O_DIRECT, 0644);
+#endif
+    *direct = fd >= 0;
+    if (fd < 0) fd = ::open(path, flags, 0644);
+    return fd;
+#endif
+}
+
+static void drop_range(int fd, uint64_t offset, uint64_t len, bool dirty) {
+#ifdef __linux__
+    if (dirty) {
+        sync_file_range(fd, (off_t)offset, (off_t)len,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+    posix_fadvise(fd, (off_t)offset, (off_t)len, POSIX_FADV_DONTNEED);
+#else
+    (void)fd;
+    (void)offset;
+    (void)len;
+    (void)dirty;
+#endif
+}
+
+DirectReadBuf::DirectReadBuf(bool allow_uring)
+    : queue_(DIRECT_IO_DEPTH, allow_uring), blocks_(DIRECT_IO_DEPTH), results_(DIRECT_IO_DEPTH, -1),
+      fd_(-1), direct_(false), failed_(false), size_(0), next_offset_(0), block_(0) {}
+
+DirectReadBuf::~DirectReadBuf() {
+    uint64_t tag;
+    long long result;
+    while (queue_.wait(&tag, &result)) {}
+#ifndef _WIN32
+    if (fd_ >= 0) ::close(fd_);
+#endif
+}
+
+bool DirectReadBuf::open(const char *path) {
+#ifdef _WIN32
+    (void)path;
+    return false;
+#else
+    for (const AlignedBlock &b : blocks_) {
+        if (!b.data) return false;
+    }
+    fd_ = open_direct(path, O_RDONLY, &direct_);
+    if (fd_ < 0) return false;
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    size_ = (uint64_t)st.st_size;
+#ifdef __linux__
+    if (!direct_) posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    for (unsigned i = 0; i < DIRECT_IO_DEPTH; i++) {
+        if (!submit_next()) return false;
+    }
+    return true;
+#endif
+}
+
+bool DirectReadBuf::submit_next() {
+    if (next_offset_ >= size_) return true;
+    size_t slot = (size_t)((next_offset_ / DIRECT_IO_BLOCK) % DIRECT_IO_DEPTH);
+    results_[slot] = -1;
+    if (!queue_.submit_read(fd_, blocks_[slot].data, DIRECT_IO_BLOCK, next_offset_, slot)) return false;
+    next_offset_ += DIRECT_IO_BLOCK;
+    return true;
+}
+
+DirectReadBuf::int_type DirectReadBuf::underflow() {
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    if (failed_) return traits_type::eof();
+    if (block_ > 0) {
+        // The previous block is consumed: its slot reads DIRECT_IO_DEPTH blocks ahead.
+        if (!direct_) drop_range(fd_, (block_ - 1) * DIRECT_IO_BLOCK, DIRECT_IO_BLOCK, false);
+        if (!submit_next()) {
+            failed_ = true;
+            return traits_type::eof();
+        }
+    }
+    uint64_t offset = block_ * DIRECT_IO_BLOCK;
+    if (offset >= size_) return traits_type::eof();
+    size_t slot = (size_t)(block_ % DIRECT_IO_DEPTH);
+    while (results_[slot] < 0) {
+        uint64_t tag;
+        long long result;
+        if (!queue_.wait(&tag, &result) || result < 0) {
+            failed_ = true;
+            return traits_type::eof();
+        }
+        results_[tag] = result;
+    }
+    size_t expected = (size_t)std::min<uint64_t>(DIRECT_IO_BLOCK, size_ - offset);
+    if ((size_t)results_[slot] < expected) {
+        failed_ = true;
+        return traits_type::eof();
+    }
+    char *base = (char*)blocks_[slot].data;
+    setg(base, base, base + expected);
+    block_++;
+    return traits_type::to_int_type(*gptr());
+}
+
+std::unique_ptr<DirectReadBuf> open_direct_input(const char *path) {
+    std::unique_ptr<DirectReadBuf> buf;
+    if (io_backend() != IO_DIRECT) return buf;
+    buf.reset(new DirectReadBuf());
+    if (!buf->open(path)) buf.reset();
+    return buf;
+}
+
+DirectWriter::DirectWriter(bool allow_uring)
+    : queue_(DIRECT_IO_DEPTH, allow_uring), blocks_(DIRECT_IO_DEPTH), busy_(DIRECT_IO_DEPTH, false),
+      fd_(-1), direct_(false), failed_(false), size_(0), block_(0), fill_(0) {}
+
+DirectWriter::~DirectWriter() {
+    close();
+}
+
+bool DirectWriter::open(const char *path) {
+#ifdef _WIN32
+    (void)path;
+    return false;
+#else
+    for (const AlignedBlock &b : blocks_) {
+        if (!b.data) return false;
+    }
+    fd_ = open_direct(path, O_WRONLY | O_CREAT | O_TRUNC, &direct_);
+    return fd_ >= 0;
+#endif
+}
+
+bool DirectWriter::wait_one() {
+    uint64_t tag;
+    long long result;
+    if (!queue_.wait(&tag, &result)) {
+        failed_ = true;
+        return false;
+    }
+    busy_[tag % DIRECT_IO_DEPTH] = false;
+#ifdef __linux__
+    // Start writeback now so the block is clean by the time its buffer is reused.
+    if (!direct_ && result > 0) {
+        sync_file_range(fd_, (off_t)(tag * DIRECT_IO_BLOCK), (off_t)result, SYNC_FILE_RANGE_WRITE);
+    }
+#endif
+    if (result < 0) failed_ = true;
+    return true;
+}
+
+void DirectWriter::drop(uint64_t block) {
+    if (!direct_) drop_range(fd_, block * DIRECT_IO_BLOCK, DIRECT_IO_BLOCK, true);
+}
+
+bool DirectWriter::flush_block(size_t len) {
+    size_t slot = (size_t)(block_ % DIRECT_IO_DEPTH);
+    if (!queue_.submit_write(fd_, blocks_[slot].data, len, block_ * DIRECT_IO_BLOCK, block_)) {
+        failed_ = true;
+        return false;
+    }
+    busy_[slot] = true;
+    block_++;
+    fill_ = 0;
+    return true;
+}
+
+bool DirectWriter::write(const uint8_t *data, size_t len) {
+    if (fd_ < 0 || failed_) return false;
+    while (len > 0) {
+        size_t slot = (size_t)(block_ % DIRECT_IO_DEPTH);
+        if (fill_ == 0) {
+            while (busy_[slot]) {
+                if (!wait_one()) return false;
+            }
+            if (failed_) return false;
+            if (block_ >= DIRECT_IO_DEPTH) drop(block_ - DIRECT_IO_DEPTH);
+        }
+        size_t n = std::min(DIRECT_IO_BLOCK - fill_, len);
+        memcpy(blocks_[slot].data + fill_, data, n);
+        fill_ += n;
+        size_ += n;
+        data += n;
+        len -= n;
+        if (fill_ == DIRECT_IO_BLOCK && !flush_block(DIRECT_IO_BLOCK)) return false;
+    }
+    return true;
+}
+
+bool DirectWriter::close() {
+#ifdef _WIN32
+    return false;
+#else
+    if (fd_ < 0) return false;
+    if (fill_ > 0 && !failed_) {
+        // O_DIRECT writes whole aligned blocks: pad the tail and trim it below.
+        size_t padded = (fill_ + DIRECT_IO_ALIGN - 1) / DIRECT_IO_ALIGN * DIRECT_IO_ALIGN;
+        memset(blocks_[block_ % DIRECT_IO_DEPTH].data + fill_, 0, padded - fill_);
+        flush_block(padded);
+    }
+    while (queue_.outstanding() > 0 && wait_one()) {}
+    bool ok = !failed_ && ftruncate(fd_, (off_t)size_) == 0;
+    if (!direct_) drop_range(fd_, 0, 0, true);
+    ok = ::close(fd_) == 0 && ok;
+    fd_ = -1;
+    return ok;
+#endif
+}
+
+std::unique_ptr<DirectWriter> open_direct_output(const char *path) {
+    std::unique_ptr<DirectWriter> writer;
+    if (io_backend() != IO_DIRECT) return writer;
+    writer.reset(new DirectWriter());
+    if (!writer->open(path)) writer.reset();
+    return writer;
+}
@@ -13,6 +13,47 @@ int parse_args(int argc, char *argv[], CliArgs *args) {
     return 0;
 }
 
+int parse_options(int argc, char *argv[], CliOptions *opts) {
+    memset(opts, 0, sizeof(*opts));
+    int out = 1;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--") == 0) {
+            // Everything after a bare "--" is positional, even if it looks
+            // like one of our options.
+            while (++i < argc) argv[out++] = argv[i];
+            break;
+        } else if (strncmp(arg, "--kernel=", 9) == 0) {
+            opts->kernel = arg + 9;
+        } else if (strncmp(arg, "--output-dir=", 13) == 0) {
+            opts->output_dir = arg + 13;
+        } else if (strncmp(arg, "--format=", 9) == 0) {
+            opts->format = arg + 9;
+        } else if (strncmp(arg, "--compress=", 11) == 0) {
+            opts->compress = arg + 11;
+        } else if (strncmp(arg, "--io=", 5) == 0) {
+            opts->io = arg + 5;
+        } else if (strcmp(arg, "--stats") == 0 || strcmp(arg, "--stats=text") == 0) {
+            opts->stats = CLI_STATS_TEXT;
+        } else if (strcmp(arg, "--stats=json") == 0) {
+            opts->stats = CLI_STATS_JSON;
+        } else if (strncmp(arg, "--trace=", 8) == 0) {
+            opts->trace = arg + 8;
+        } else if (strcmp(arg, "--trace") == 0 && i + 1 < argc) {
+            opts->trace = argv[++i];
+        } else if (strncmp(arg, "--offset=", 9) == 0) {
+            opts->offset = arg + 9;
+        } else if (strncmp(arg, "--length=", 9) == 0) {
+            opts->length = arg + 9;
+        } else {
+            // Not one of ours: passwords and paths may start with "--" too.
+            argv[out++] = argv[i];
+        }
+    }
+    argv[out] = NULL;
+    return out;
+}
+
 void free_args(CliArgs *args) {
     // No dynamic allocation in this simple version
     (void)args;
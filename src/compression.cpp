@@ -0,0 +1,151 @@
+#include "compression.h"
+#include <lzma.h>
+#include <math.h>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+static const char *codec_name(CompressionCodec codec) {
+    switch (codec) {
+    case COMPRESS_DEFLATE:
+        return "deflate";
+    case COMPRESS_LZMA:
+        return "lzma";
+    default:
+        return "store";
+    }
+}
+
+int parse_compression(const char *text, CompressionOptions *opts) {
+    if (!text) return -1;
+    const char *colon = strchr(text, ':');
+    size_t name_len = colon ? (size_t)(colon - text) : strlen(text);
+    CompressionOptions parsed = *opts;
+    if (name_len == 5 && strncmp(text, "store", 5) == 0) {
+        parsed.codec = COMPRESS_STORE;
+        parsed.level = 0;
+    } else if (name_len == 7 && strncmp(text, "deflate", 7) == 0) {
+        parsed.codec = COMPRESS_DEFLATE;
+        parsed.level = DEFLATE_DEFAULT_LEVEL;
+    } else if (name_len == 4 && strncmp(text, "lzma", 4) == 0) {
+        parsed.codec = COMPRESS_LZMA;
+        parsed.level = LZMA_DEFAULT_LEVEL;
+    } else {
+        return -1;
+    }
+    if (colon) {
+        // A single digit; store takes no level.
+        const char *level = colon + 1;
+        if (parsed.codec == COMPRESS_STORE || level[0] < '0' || level[0] > '9' || level[1] != '\0') return -1;
+        parsed.level = level[0] - '0';
+        if (parsed.codec == COMPRESS_DEFLATE && parsed.level == 0) return -1;
+    }
+    *opts = parsed;
+    return 0;
+}
+
+std::string format_compression(const CompressionOptions &opts) {
+    if (opts.codec == COMPRESS_STORE) return std::string();
+    return std::string(codec_name(opts.codec)) + ":" + std::to_string(opts.level);
+}
+
+double sample_entropy(const uint8_t *data, size_t len) {
+    // Eight 512-byte windows spread over the data: enough for a stable
+    // histogram, cheap next to compressing even a 512KB chunk.
+    static const size_t WINDOWS = 8;
+    static const size_t WINDOW = 512;
+    uint32_t counts[256] = {0};
+    size_t sampled = 0;
+    if (len <= WINDOWS * WINDOW) {
+        for (size_t i = 0; i < len; i++) counts[data[i]]++;
+        sampled = len;
+    } else {
+        size_t stride = (len - WINDOW) / (WINDOWS - 1);
+        for (size_t w = 0; w < WINDOWS; w++) {
+            const uint8_t *p = data + w * stride;
+            for (size_t i = 0; i < WINDOW; i++) counts[p[i]]++;
+        }
+        sampled = WINDOWS * WINDOW;
+    }
+    if (sampled == 0) return 0.0;
+    double entropy = 0.0;
+    for (int b = 0; b < 256; b++) {
+        if (!counts[b]) continue;
+        double p = (double)counts[b] / sampled;
+        entropy -= p * log2(p);
+    }
+    return entropy;
+}
+
+uint64_t estimated_skip_savings_ns(const CompressionStats &stats) {
+    if (stats.bytes_not_smaller) {
+        return (uint64_t)((double)stats.compress_ns_not_smaller / stats.bytes_not_smaller * stats.bytes_skipped);
+    }
+    uint64_t tried = stats.bytes_in - stats.bytes_skipped;
+    return tried ? (uint64_t)((double)stats.compress_ns / tried * stats.bytes_skipped) : 0;
+}
+
+bool compress_chunk(const CompressionOptions &opts, const uint8_t *data, size_t len,
+                    std::vector<uint8_t> &out) {
+    if (len == 0) return false;
+    switch (opts.codec) {
+    case COMPRESS_DEFLATE: {
+        uLongf out_len = compressBound((uLong)len);
+        out.resize(out_len);
+        if (compress2(out.data(), &out_len, data, (uLong)len, opts.level) != Z_OK) return false;
+        out.resize(out_len);
+        break;
+    }
+    case COMPRESS_LZMA: {
+        // No integrity check: the chunk is verified by its decompressed length,
+        // and the container's password check already guards the key.
+        out.resize(lzma_stream_buffer_bound(len));
+        size_t out_len = 0;
+        if (lzma_easy_buffer_encode((uint32_t)opts.level, LZMA_CHECK_NONE, NULL, data, len,
+                                    out.data(), &out_len, out.size()) != LZMA_OK) {
+            return false;
+        }
+        out.resize(out_len);
+        break;
+    }
+    default:
+        return false;
+    }
+    return out.size() < len;
+}
+
+bool decompress_chunk(CompressionCodec codec, const uint8_t *data, size_t len,
+                      uint8_t *out, size_t plain_len) {
+    switch (codec) {
+    case COMPRESS_DEFLATE: {
+        uLongf out_len = (uLongf)plain_len;
+        return uncompress(out, &out_len, data, (uLong)len) == Z_OK && out_len == plain_len;
+    }
+    case COMPRESS_LZMA: {
+        uint64_t memlimit = UINT64_MAX;
+        size_t in_pos = 0, out_pos = 0;
+        return lzma_stream_buffer_decode(&memlimit, 0, NULL, data, &in_pos, len, out, &out_pos,
+                                         plain_len) == LZMA_OK &&
+               in_pos == len && out_pos == plain_len;
+    }
+    default:
+        return false;
+    }
+}
+
+void merge_compression_stats(CompressionStats *dst, const CompressionStats &src) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    dst->chunks += src.chunks;
+    dst->chunks_compressed += src.chunks_compressed;
+    dst->chunks_skipped += src.chunks_skipped;
+    dst->chunks_not_smaller += src.chunks_not_smaller;
+    dst->bytes_in += src.bytes_in;
+    dst->bytes_out += src.bytes_out;
+    dst->bytes_skipped += src.bytes_skipped;
+    dst->bytes_not_smaller += src.bytes_not_smaller;
+    dst->compress_ns += src.compress_ns;
+    dst->compress_ns_not_smaller += src.compress_ns_not_smaller;
+    dst->sample_ns += src.sample_ns;
+}
@@ -0,0 +1,138 @@
+#include "container.h"
+#include "crypto.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+size_t get_chunk_size(size_t file_size) {
+    if (file_size < 5 * 1024 * 1024) {  // < 5MB
+        return file_size;  // No chunking
+    } else if (file_size < 50 * 1024 * 1024) {  // < 50MB
+        return 512 * 1024;  // 512KB
+    } else if (file_size < 200 * 1024 * 1024) {  // < 200MB
+        return 2 * 1024 * 1024;  // 2MB
+    } else {
+        return 8 * 1024 * 1024;  // 8MB for very large files
+    }
+}
+
+void transform_group(uint8_t *chunk, size_t chunk_len, size_t group,
+                     const KeySchedule &schedule, int index, bool reverse) {
+    size_t begin = group * TASK_GROUP_SIZE;
+    size_t end = std::min(chunk_len, begin + TASK_GROUP_SIZE);
+    for (size_t i = begin; i < end; i += SUB_CHUNK_SIZE) {
+        size_t sub_size = std::min(SUB_CHUNK_SIZE, end - i);
+        if (reverse) {
+            schedule.reverse(chunk + i, sub_size, index);
+        } else {
+            schedule.forward(chunk + i, sub_size, index);
+        }
+    }
+}
+
+void transform_chunk(uint8_t *chunk, size_t chunk_len, const KeySchedule &schedule,
+                     int index, bool reverse, RunRecorder *recorder) {
+    parallel_for(ThreadPool::shared(), task_group_count(chunk_len), [&](size_t group) {
+        PhaseTimer timer(recorder, PHASE_TRANSFORM,
+                         std::min(TASK_GROUP_SIZE, chunk_len - group * TASK_GROUP_SIZE), index);
+        transform_group(chunk, chunk_len, group, schedule, index, reverse);
+    });
+}
+
+std::string format_metadata(const ContainerMetadata &meta) {
+    std::ostringstream metadata;
+    metadata << "file : " << meta.filename << "\n"
+             << "salt : " << meta.salt << "\n"
+             << "cost : " << meta.cost << "\n"
+             << "hash_verify : " << meta.hash_verify << "\n";
+    if (!meta.compression.empty()) {
+        metadata << "compression : " << meta.compression << "\n"
+                 << "size : " << meta.size << "\n";
+    }
+    return metadata.str();
+}
+
+bool parse_metadata(const std::string &text, ContainerMetadata &meta) {
+    std::istringstream iss(text);
+    std::string line;
+    while (std::getline(iss, line)) {
+        if (line.find("file : ") == 0) meta.filename = line.substr(7);
+        else if (line.find("salt : ") == 0) meta.salt = line.substr(7);
+        else if (line.find("cost : ") == 0) meta.cost = atoi(line.c_str() + 7);
+        else if (line.find("hash_verify : ") == 0) meta.hash_verify = line.substr(14);
+        else if (line.find("compression : ") == 0) meta.compression = line.substr(14);
+        else if (line.find("size : ") == 0) meta.size = strtoull(line.c_str() + 7, NULL, 10);
+    }
+    return !meta.salt.empty() && !meta.hash_verify.empty();
+}
+
+bool metadata_codec(const ContainerMetadata &meta, CompressionCodec &codec) {
+    CompressionOptions opts = {};
+    if (meta.compression.empty()) {
+        codec = COMPRESS_STORE;
+        return true;
+    }
+    if (parse_compression(meta.compression.c_str(), &opts) != 0 || opts.codec == COMPRESS_STORE) return false;
+    codec = opts.codec;
+    return true;
+}
+
+// hash_password hands back malloc'd strings; copy and free them here.
+static bool hash_into(const char *password, int cost, const std::string &salt, std::string &out) {
+    char *hash = hash_password(password, cost, salt.c_str());
+    if (!hash) return false;
+    out = hash;
+    free(hash);
+    return true;
+}
+
+bool derive_new_key(const char *password, int cost, ContainerMetadata &meta, std::string &key) {
+    char salt[SALT_LENGTH + 1];
+    if (random_salt(salt) != 0) return false;
+    meta.salt = salt;
+    meta.cost = cost;
+    return hash_into(password, cost, meta.salt, key) &&
+           hash_into(key.c_str(), cost, meta.salt, meta.hash_verify);
+}
+
+int derive_key(const char *password, const ContainerMetadata &meta, std::string &key) {
+    std::string verify;
+    if (!hash_into(password, meta.cost, meta.salt, key)) return -1;
+    if (!hash_into(key.c_str(), meta.cost, meta.salt, verify)) return -2;
+    return verify == meta.hash_verify ? 0 : -2;
+}
+
+std::vector<uint8_t> encrypt_metadata(const KeySchedule &schedule, const std::string &metadata) {
+    std::vector<uint8_t> metadata_enc(metadata.begin(), metadata.end());
+    schedule.forward(metadata_enc.data(), metadata_enc.size(), 0);
+    return metadata_enc;
+}
+
+bool metadata_matches(const KeySchedule &schedule, std::vector<uint8_t> metadata_enc,
+                      const std::string &metadata) {
+    schedule.reverse(metadata_enc.data(), metadata_enc.size(), 0);
+    return metadata_enc.size() >= metadata.size() &&
+           std::equal(metadata.begin(), metadata.end(), metadata_enc.begin());
+}
+
+ContainerFormat detect_container(const char *path) {
+    char magic[8] = {0};
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        if (fread(magic, 1, sizeof(magic), f) != sizeof(magic)) memset(magic, 0, sizeof(magic));
+        fclose(f);
+    }
+    if (memcmp(magic, STREAM_MAGIC, sizeof(magic)) == 0) return CONTAINER_STREAM;
+    if (memcmp(magic, NATIVE_MAGIC, sizeof(magic)) == 0) return CONTAINER_NATIVE;
+    return CONTAINER_ZIP;
+}
+
+std::string base_name(const char *path) {
+    std::string filename = path;
+    size_t last_slash = filename.find_last_of("/\\");
+    if (last_slash != std::string::npos) filename = filename.substr(last_slash + 1);
+    return filename;
+}
@@ -1,64 +1,113 @@
 #include "crypto.h"
+#include "kernels.h"
+#include "random.h"
+#include "trace.h"
 #include <algorithm>
 #include <chrono>
 #include <cstring>
+#include <memory>
 #include <random>
 #include <string>
-#include <tuple>
 #include <vector>
 
-#ifdef _WIN32
-#include <windows.h>
-#include <wincrypt.h>
-#else
-#include <fcntl.h>
-#include <unistd.h>
-#endif
-
 using Byte = uint8_t;
 
-static void get_random_bytes(uint8_t *buffer, size_t len) {
-#ifdef _WIN32
-    HCRYPTPROV hProv;
-    CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT);
-    CryptGenRandom(hProv, (DWORD)len, buffer);
-    CryptReleaseContext(hProv, 0);
-#else
-    int fd = open("/dev/urandom", O_RDONLY);
-    if (fd >= 0) {
-        ssize_t result = read(fd, buffer, len);
-        (void)result;
-        close(fd);
+static bool generate_salt(std::string &salt) {
+    static const char ascii_letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    uint8_t random[SALT_LENGTH];
+    if (random_bytes(random, sizeof(random)) != 0) return false;
+    salt.assign(SALT_LENGTH, '\0');
+    salt[0] = ascii_letters[random[0] % 52];
+    for (int i = 1; i < SALT_LENGTH; i++) {
+        salt[i] = (random[i] % (126 - 37)) + 37;
     }
-#endif
+    return true;
 }
 
-static std::string generate_salt() {
-    static const char ascii_letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    std::string salt(16, '\0');
-    uint8_t random_bytes[16];
-    get_random_bytes(random_bytes, 16);
-    salt[0] = ascii_letters[random_bytes[0] % 52];
-    for (int i = 1; i < 16; i++) {
-        salt[i] = (random_bytes[i] % (126 - 37)) + 37;
+int random_salt(char *out) {
+    std::string salt;
+    if (!generate_salt(salt)) return -1;
+    memcpy(out, salt.c_str(), SALT_LENGTH + 1);
+    return 0;
+}
+
+// step mod r in [0, r), without a division while |step| < r (always, in
+// practice: hash_password only steps by -1..3).
+static inline size_t step_mod(long long step, size_t r) {
+    if (step >= 0 && static_cast<size_t>(step) < r) return static_cast<size_t>(step);
+    if (step < 0 && static_cast<size_t>(-step) < r) return r - static_cast<size_t>(-step);
+    long long m = step % static_cast<long long>(r);
+    return static_cast<size_t>(m < 0 ? m + static_cast<long long>(r) : m);
+}
+
+// Small steps: walk a circular doubly linked list over the positions. Each
+// pick costs at most |step| hops plus an O(1) unlink.
+static void select_by_walking(const uint8_t *data, size_t len, long long step, uint8_t *out) {
+    std::vector<uint32_t> next(len), prev(len);
+    for (size_t i = 0; i < len; i++) {
+        next[i] = static_cast<uint32_t>(i + 1);
+        prev[i] = static_cast<uint32_t>(i - 1);
+    }
+    next[len - 1] = 0;
+    prev[0] = static_cast<uint32_t>(len - 1);
+
+    // cur is the element at the current index; after an unlink its successor
+    // takes over that index (or index 0 when the last element was removed).
+    size_t cur = 0;
+    for (size_t i = 0, remaining = len; i < len; ++i, --remaining) {
+        size_t forward = step_mod(step, remaining);
+        if (forward <= remaining / 2) {
+            while (forward--) cur = next[cur];
+        } else {
+            for (size_t back = remaining - forward; back--;) cur = prev[cur];
+        }
+        out[i] = data[cur];
+        next[prev[cur]] = next[cur];
+        prev[next[cur]] = prev[cur];
+        cur = next[cur];
     }
-    return salt;
 }
 
-static std::vector<Byte> sort_by_nth_element(const std::vector<Byte>& data, size_t n) {
-    if (data.empty()) return {};
-    std::vector<Byte> arr_copy = data;
-    std::vector<Byte> result;
+// Any step: a Fenwick tree over "not yet taken" flags finds the k-th
+// remaining element by binary lifting, O(log len) per pick.
+static void select_by_rank(const uint8_t *data, size_t len, long long step, uint8_t *out) {
+    size_t top = 1;
+    while (top * 2 <= len) top *= 2;
+    // Every flag starts at 1, so node i holds its range length (i & -i).
+    // Nodes past len stay at UINT32_MAX so the descent never enters them.
+    std::vector<uint32_t> tree(2 * top, UINT32_MAX);
+    for (size_t i = 1; i <= len; i++) tree[i] = static_cast<uint32_t>(i & (~i + 1));
+
     size_t index = 0;
-    for (size_t i = 0; i < data.size(); ++i) {
-        long long idx = static_cast<long long>(index) + static_cast<long long>(n) - 1;
-        long long mod = idx % static_cast<long long>(arr_copy.size());
-        if (mod < 0) mod += static_cast<long long>(arr_copy.size());
-        index = static_cast<size_t>(mod);
-        result.push_back(arr_copy[index]);
-        arr_copy.erase(arr_copy.begin() + index);
+    for (size_t i = 0, remaining = len; i < len; ++i, --remaining) {
+        index += step_mod(step, remaining);
+        if (index >= remaining) index -= remaining;
+
+        size_t pos = 0;
+        uint32_t rank = static_cast<uint32_t>(index) + 1;
+        for (size_t bit = top; bit; bit >>= 1) {
+            uint32_t count = tree[pos + bit];
+            if (count < rank) {
+                pos += bit;
+                rank -= count;
+            }
+        }
+        out[i] = data[pos];
+        for (size_t j = pos + 1; j <= len; j += j & (~j + 1)) tree[j]--;
+    }
+}
+
+void sort_by_nth_element(const uint8_t *data, size_t len, size_t n, uint8_t *out) {
+    if (len == 0) return;
+    // n is reinterpreted as signed, as the original long long arithmetic did.
+    long long step = static_cast<long long>(n) - 1;
+    // The walk beats the tree until a pick needs more hops than the tree has
+    // levels; at hash sizes (~1KB) it is also ~2x faster than erase-in-place.
+    if (step >= -16 && step <= 16) {
+        select_by_walking(data, len, step, out);
+    } else {
+        select_by_rank(data, len, step, out);
     }
-    return result;
 }
 
 static std::vector<Byte> latin1_to_utf8_bytes(const std::string& s) {
@@ -78,29 +127,168 @@ static std::vector<Byte> latin1_to_utf8_bytes(const std::string& s) {
     return out;
 }
 
-static std::tuple<std::string, std::string, std::string, std::string, std::string, std::string>
-internal_hash_password(const std::string& password, const std::string* salt_ptr, const std::vector<std::string>* memo) {
-    std::string salt = salt_ptr ? *salt_ptr : "";
+// The four hashes of one round. hash4 starts with the previous round's memo
+// tail; hash4_shared is the length of that copied prefix.
+struct HashRound {
+    std::string hash1, hash2, hash3, hash4;
+    size_t hash4_shared;
+};
+
+// Every round adds 16 memo entries built from six strings: the next password
+// ("$salt$/$" + hash2, plus "$" + hash4 in the first rounds), hash1..hash3,
+// and hash3/hash4 in an order that flips once the memo has more than 47
+// entries. Ten entries are concatenations of two of those six.
+//
+// Storing each entry as its own std::string costs ~26KB per round, so the
+// memo grows to gigabytes at cost 16. Instead each distinct piece of text is
+// copied once into an arena of fixed blocks (never reallocated, so spans stay
+// valid) and entries are ropes of (pointer, length) spans. hash4 shares its
+// prefix with the previous tail and the password shares hash2 (and hash4), so
+// a round stores little more than its four hashes.
+class HashMemo {
+public:
+
+    size_t size() const { return parts_.size() / PARTS * SLOTS; }
+
+    size_t length(size_t entry) const {
+        const uint8_t *slot = SLOT_PARTS[entry % SLOTS];
+        size_t base = entry / SLOTS * PARTS;
+        size_t len = parts_[base + slot[0]].length;
+        if (slot[1] != NONE) len += parts_[base + slot[1]].length;
+        return len;
+    }
+
+    Byte at(size_t entry, size_t pos) const {
+        const uint8_t *slot = SLOT_PARTS[entry % SLOTS];
+        size_t base = entry / SLOTS * PARTS;
+        const Part *part = &parts_[base + slot[0]];
+        if (pos >= part->length) {
+            pos -= part->length;
+            part = &parts_[base + slot[1]];
+        }
+        for (size_t i = part->first; ; i++) {
+            if (pos < spans_[i].length) return static_cast<Byte>(spans_[i].data[pos]);
+            pos -= spans_[i].length;
+        }
+    }
+
+    // The last entry (the round's sixth part), which seeds the next hash4.
+    std::string last() const {
+        std::string out;
+        if (parts_.empty()) return out;
+        const Part &part = parts_[parts_.size() - 1];
+        out.reserve(part.length);
+        for (size_t i = part.first; i < part.first + part.count; i++) {
+            out.append(spans_[i].data, spans_[i].length);
+        }
+        return out;
+    }
+
+    void add_round(const HashRound &round, const std::string &salt, bool tail_is_hash3) {
+        std::string prefix = "$" + salt + "$/$";
+        if (prefix_.length != prefix.size() || memcmp(prefix_.data, prefix.data(), prefix.size()) != 0) {
+            prefix_ = append(prefix);
+        }
+        Span h1 = append(round.hash1), h2 = append(round.hash2), h3 = append(round.hash3);
+
+        // hash4 = previous tail + its own suffix
+        std::vector<Span> h4;
+        if (round.hash4_shared > 0) {
+            const Part &tail = parts_[parts_.size() - 1];
+            h4.assign(spans_.begin() + tail.first, spans_.begin() + tail.first + tail.count);
+        }
+        Span suffix = append(round.hash4.substr(round.hash4_shared));
+        if (suffix.length > 0) h4.push_back(suffix);
+
+        std::vector<Span> password = {prefix_, h2};
+        if (!tail_is_hash3) {
+            password.push_back(Span{"$", 1});
+            password.insert(password.end(), h4.begin(), h4.end());
+        }
+        add_part(password);
+        add_part({h1});
+        add_part({h2});
+        add_part({h3});
+        add_part(tail_is_hash3 ? h4 : std::vector<Span>{h3});
+        add_part(tail_is_hash3 ? std::vector<Span>{h3} : h4);
+    }
+
+private:
+    struct Span {
+        const char *data;
+        size_t length;
+    };
+    struct Part {
+        size_t first;
+        size_t count;
+        size_t length;
+    };
+
+    static const size_t SLOTS = 16;
+    static const size_t PARTS = 6;
+    static const uint8_t NONE = 0xFF;
+    static const size_t BLOCK_SIZE = 1 << 20;
+    // Entry 16 * round + slot is part[0] followed by part[1] (if any).
+    static const uint8_t SLOT_PARTS[SLOTS][2];
+
+    Span append(const std::string &s) {
+        if (s.size() > BLOCK_SIZE - block_used_) {
+            blocks_.emplace_back(new char[std::max(BLOCK_SIZE, s.size())]);
+            block_used_ = 0;
+        }
+        char *dst = blocks_.back().get() + block_used_;
+        memcpy(dst, s.data(), s.size());
+        block_used_ += s.size();
+        return Span{dst, s.size()};
+    }
+
+    void add_part(const std::vector<Span> &spans) {
+        Part part = {spans_.size(), spans.size(), 0};
+        for (const Span &span : spans) {
+            if (span.length == 0) {
+                part.count--;
+                continue;
+            }
+            spans_.push_back(span);
+            part.length += span.length;
+        }
+        parts_.push_back(part);
+    }
+
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    size_t block_used_ = BLOCK_SIZE;
+    std::vector<Span> spans_;
+    std::vector<Part> parts_;
+    Span prefix_ = {nullptr, 0};
+};
+
+const uint8_t HashMemo::SLOT_PARTS[HashMemo::SLOTS][2] = {
+    {0, NONE}, {1, NONE}, {2, NONE}, {3, NONE}, {4, NONE}, {0, 3}, {5, 2}, {5, 3},
+    {5, 4},    {5, 1},    {5, 0},    {5, 2},    {2, 3},    {2, 4}, {0, 1}, {5, NONE},
+};
+
+static HashRound internal_hash_password(const std::string& password, const std::string& salt, const HashMemo& memo) {
     std::string combined = salt + "$" + password;
     std::vector<Byte> combined_bytes(combined.begin(), combined.end());
 
-    std::string hash1, hash2, hash3, hash4;
+    HashRound round;
+    std::string &hash1 = round.hash1, &hash2 = round.hash2, &hash3 = round.hash3, &hash4 = round.hash4;
     int accumulator = static_cast<int>(combined_bytes[0]);
-    size_t memo_length = memo ? memo->size() : 0;
+    size_t memo_length = memo.size();
     
-    if (memo && memo_length > 0) {
-        hash4 = (*memo)[memo_length - 1];
+    if (memo_length > 0) {
+        hash4 = memo.last();
         int index = static_cast<int>(combined_bytes[combined_bytes.size() - 2]) * 97;
         index = index % static_cast<int>(memo_length);
-        const std::string* string_memo = &(*memo)[index];
-        size_t string_memo_length = string_memo->size();
-        index = static_cast<int>(combined_bytes[combined_bytes.size() - 7]) * 113;
-        index = index % static_cast<int>(string_memo_length);
-        accumulator = static_cast<unsigned char>((*string_memo)[index]);
+        size_t string_memo_length = memo.length(static_cast<size_t>(index));
+        int pos = static_cast<int>(combined_bytes[combined_bytes.size() - 7]) * 113;
+        pos = pos % static_cast<int>(string_memo_length);
+        accumulator = memo.at(static_cast<size_t>(index), static_cast<size_t>(pos));
     } else {
         int index = static_cast<int>(combined_bytes[0]) % 90;
         accumulator = static_cast<Byte>(index + 37);
     }
+    round.hash4_shared = hash4.size();
 
     if (accumulator > 96)
         accumulator -= 70;
@@ -121,7 +309,8 @@ internal_hash_password(const std::string& password, const std::string* salt_ptr,
     
     std::vector<Byte> hash1_bytes = latin1_to_utf8_bytes(hash1);
     int sort_index = accumulator % 5;
-    std::vector<Byte> sorted_hash_bytes = sort_by_nth_element(hash1_bytes, static_cast<size_t>(sort_index));
+    std::vector<Byte> sorted_hash_bytes(hash1_bytes.size());
+    sort_by_nth_element(hash1_bytes.data(), hash1_bytes.size(), static_cast<size_t>(sort_index), sorted_hash_bytes.data());
 
     int hash_value = 0;
     for (Byte byte_val : sorted_hash_bytes) {
@@ -165,56 +354,46 @@ internal_hash_password(const std::string& password, const std::string* salt_ptr,
         }
     }
     
-    if (memo_length > 47) {
-        return { "$" + salt + "$/$" + hash2, hash1, hash2, hash3, hash4, hash3 };
-    } else {
-        return { "$" + salt + "$/$" + hash2 + "$" + hash4, hash1, hash2, hash3, hash3, hash4 };
-    }
+    return round;
 }
 
 char* hash_password(const char *password, int cost, const char *salt) {
-    std::vector<std::string> memo;
-    std::vector<std::string> password_tuple;
+    HashMemo memo;
     std::string current_password = password;
 
     int iterations = 1 << cost;
+    // Traced in blocks of iterations, which keeps a cost-16 trace small.
+    bool traced = false;
     for (int i = 0; i < iterations; ++i) {
-        password_tuple.clear();
-        std::string local_salt = salt ? salt : generate_salt();
-        auto hash_result = internal_hash_password(current_password, &local_salt, &memo);
-        password_tuple.push_back(std::get<0>(hash_result));
-        password_tuple.push_back(std::get<1>(hash_result));
-        password_tuple.push_back(std::get<2>(hash_result));
-        password_tuple.push_back(std::get<3>(hash_result));
-        password_tuple.push_back(std::get<4>(hash_result));
-        password_tuple.push_back(std::get<5>(hash_result));
-
-        if (memo.size() < static_cast<size_t>(16 * (i + 1))) memo.resize(16 * (i + 1));
-        memo[16 * i + 0] = password_tuple[0];
-        memo[16 * i + 1] = password_tuple[1];
-        memo[16 * i + 2] = password_tuple[2];
-        memo[16 * i + 3] = password_tuple[3];
-        memo[16 * i + 4] = password_tuple[4];
-        memo[16 * i + 15] = password_tuple[5];
-        memo[16 * i + 6] = password_tuple[5] + password_tuple[2];
-        memo[16 * i + 7] = password_tuple[5] + password_tuple[3];
-        memo[16 * i + 8] = password_tuple[5] + password_tuple[4];
-        memo[16 * i + 9] = password_tuple[5] + password_tuple[1];
-        memo[16 * i + 10] = password_tuple[5] + password_tuple[0];
-        memo[16 * i + 11] = password_tuple[5] + password_tuple[2];
-        memo[16 * i + 12] = password_tuple[2] + password_tuple[3];
-        memo[16 * i + 13] = password_tuple[2] + password_tuple[4];
-        memo[16 * i + 14] = password_tuple[0] + password_tuple[1];
-        memo[16 * i + 5] = password_tuple[0] + password_tuple[3];
-
-        current_password = password_tuple[0];
+        if (i % KDF_TRACE_BLOCK == 0) {
+            if (traced) trace_event('E', "kdf iterations", nullptr, 0);
+            traced = trace_enabled();
+            if (traced) trace_event('B', "kdf iterations", "first", i);
+        }
+        std::string local_salt;
+        if (salt) {
+            local_salt = salt;
+        } else if (!generate_salt(local_salt)) {
+            if (traced) trace_event('E', "kdf iterations", nullptr, 0);
+            return nullptr;
+        }
+        bool tail_is_hash3 = memo.size() > 47;
+        HashRound round = internal_hash_password(current_password, local_salt, memo);
+        memo.add_round(round, local_salt, tail_is_hash3);
+
+        current_password = "$" + local_salt + "$/$" + round.hash2;
+        if (!tail_is_hash3) current_password += "$" + round.hash4;
     }
+    if (traced) trace_event('E', "kdf iterations", nullptr, 0);
     char* result = (char*)malloc(current_password.size() + 1);
     strcpy(result, current_password.c_str());
     return result;
 }
 
-int encrypt_file(const char *input_file, const char *output_file, const unsigned char *key, size_t key_len) {
+// Repeating-key XOR of a whole file, streamed through a fixed buffer.
+static int xor_file(const char *input_file, const char *output_file, const unsigned char *key, size_t key_len) {
+    if (key_len == 0) return -1;
+    
     FILE *in = fopen(input_file, "rb");
     if (!in) return -1;
     
@@ -224,38 +403,30 @@ int encrypt_file(const char *input_file, const char *output_file, const unsigned
         return -1;
     }
     
-    int c;
-    size_t key_idx = 0;
-    while ((c = fgetc(in)) != EOF) {
-        unsigned char encrypted = c ^ key[key_idx % key_len];
-        fputc(encrypted, out);
-        key_idx++;
+    KeyStream stream(key, key_len);
+    std::vector<uint8_t> buffer(64 * 1024);
+    size_t offset = 0;
+    size_t n;
+    int rc = 0;
+    while ((n = fread(buffer.data(), 1, buffer.size(), in)) > 0) {
+        stream.apply(buffer.data(), n, offset);
+        if (fwrite(buffer.data(), 1, n, out) != n) {
+            rc = -1;
+            break;
+        }
+        offset += n;
     }
+    if (ferror(in)) rc = -1;
     
     fclose(in);
-    fclose(out);
-    return 0;
+    if (fclose(out) != 0) rc = -1;
+    return rc;
+}
+
+int encrypt_file(const char *input_file, const char *output_file, const unsigned char *key, size_t key_len) {
+    return xor_file(input_file, output_file, key, key_len);
 }
 
 int decrypt_file(const char *input_file, const char *output_file, const unsigned char *key, size_t key_len) {
-    FILE *in = fopen(input_file, "rb");
-    if (!in) return -1;
-    
-    FILE *out = fopen(output_file, "wb");
-    if (!out) {
-        fclose(in);
-        return -1;
-    }
-    
-    int c;
-    size_t key_idx = 0;
-    while ((c = fgetc(in)) != EOF) {
-        unsigned char decrypted = c ^ key[key_idx % key_len];
-        fputc(decrypted, out);
-        key_idx++;
-    }
-    
-    fclose(in);
-    fclose(out);
-    return 0;
+    return xor_file(input_file, output_file, key, key_len);
 }
@@ -0,0 +1,127 @@
+#include "encrypted_file_reader.h"
+#include <algorithm>
+#include <string.h>
+
+EncryptedFileReader::EncryptedFileReader(size_t cache_bytes)
+    : cache_capacity_(cache_bytes), cached_bytes_(0), reads_(0), bytes_returned_(0),
+      cache_hits_(0), cache_misses_(0), bytes_decrypted_(0) {}
+
+EncryptedFileReader::~EncryptedFileReader() { close(); }
+
+int EncryptedFileReader::open(const char *path, const char *password) {
+    close();
+    return open_archive_reader(path, password, reader_);
+}
+
+void EncryptedFileReader::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reader_.reset();
+    lru_.clear();
+    cached_.clear();
+    cached_bytes_ = 0;
+}
+
+long long EncryptedFileReader::pread(uint8_t *out, size_t len, uint64_t offset) {
+    if (!reader_ || offset > reader_->size()) return -1;
+    reads_.fetch_add(1, std::memory_order_relaxed);
+    len = (size_t)std::min<uint64_t>(len, reader_->size() - offset);
+
+    size_t chunk_size = reader_->chunk_size();
+    size_t copied = 0;
+    while (copied < len) {
+        uint64_t pos = offset + copied;
+        size_t index = (size_t)(pos / chunk_size);
+        size_t in_chunk = (size_t)(pos - (uint64_t)index * chunk_size);
+        size_t n = std::min<size_t>(len - copied, reader_->chunk_length(index) - in_chunk);
+        if (reader_->chunk_length(index) > cache_capacity_) {
+            // The chunk could never be cached: decrypt only the sub-chunks read.
+            std::vector<uint8_t> scratch;
+            if (!reader_->decrypt_span(index, in_chunk, in_chunk + n, scratch, out + copied)) return -1;
+            cache_misses_.fetch_add(1, std::memory_order_relaxed);
+            bytes_decrypted_.fetch_add(n, std::memory_order_relaxed);
+        } else {
+            ChunkPtr chunk = get_chunk(index);
+            if (!chunk) return -1;
+            memcpy(out + copied, chunk->data() + in_chunk, n);
+        }
+        copied += n;
+    }
+    bytes_returned_.fetch_add(copied, std::memory_order_relaxed);
+    return (long long)copied;
+}
+
+EncryptedReaderStats EncryptedFileReader::stats() const {
+    EncryptedReaderStats s;
+    s.reads = reads_.load(std::memory_order_relaxed);
+    s.bytes_returned = bytes_returned_.load(std::memory_order_relaxed);
+    s.cache_hits = cache_hits_.load(std::memory_order_relaxed);
+    s.cache_misses = cache_misses_.load(std::memory_order_relaxed);
+    s.bytes_decrypted = bytes_decrypted_.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mutex_);
+    s.cached_bytes = cached_bytes_;
+    return s;
+}
+
+EncryptedFileReader::ChunkPtr EncryptedFileReader::get_chunk(size_t index) {
+    std::shared_ptr<Pending> pending;
+    bool owner = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto hit = cached_.find(index);
+        if (hit != cached_.end()) {
+            lru_.splice(lru_.begin(), lru_, hit->second);
+            cache_hits_.fetch_add(1, std::memory_order_relaxed);
+            return hit->second->chunk;
+        }
+        cache_misses_.fetch_add(1, std::memory_order_relaxed);
+        auto &slot = pending_[index];
+        if (!slot) {
+            slot = std::make_shared<Pending>();
+            owner = true;
+        }
+        pending = slot;
+    }
+
+    if (!owner) {
+        std::unique_lock<std::mutex> lock(pending->mutex);
+        pending->done_cv.wait(lock, [&] { return pending->done; });
+        return pending->chunk;
+    }
+
+    // The transform runs outside the cache lock, so hits on other chunks and
+    // misses on other chunks proceed while this one decrypts.
+    ChunkPtr chunk = decrypt_chunk(index);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (chunk) insert_locked(index, chunk);
+        pending_.erase(index);
+    }
+    {
+        std::lock_guard<std::mutex> lock(pending->mutex);
+        pending->chunk = chunk;
+        pending->done = true;
+    }
+    pending->done_cv.notify_all();
+    return chunk;
+}
+
+EncryptedFileReader::ChunkPtr EncryptedFileReader::decrypt_chunk(size_t index) {
+    size_t len = reader_->chunk_length(index);
+    std::shared_ptr<std::vector<uint8_t>> plain = std::make_shared<std::vector<uint8_t>>(len);
+    std::vector<uint8_t> scratch;
+    if (!reader_->decrypt_span(index, 0, len, scratch, plain->data())) return nullptr;
+    bytes_decrypted_.fetch_add(len, std::memory_order_relaxed);
+    return plain;
+}
+
+void EncryptedFileReader::insert_locked(size_t index, const ChunkPtr &chunk) {
+    if (cached_.count(index)) return;
+    while (cached_bytes_ + chunk->size() > cache_capacity_ && !lru_.empty()) {
+        cached_bytes_ -= lru_.back().chunk->size();
+        cached_.erase(lru_.back().index);
+        lru_.pop_back();
+    }
+    lru_.push_front(CacheEntry{index, chunk});
+    cached_[index] = lru_.begin();
+    cached_bytes_ += chunk->size();
+}
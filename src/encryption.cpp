@@ -1,5 +1,13 @@
 #include "encryption.h"
+#include "archive_reader.h"
+#include "async_io.h"
+#include "chunk_pipeline.h"
+#include "container.h"
 #include "crypto.h"
+#include "file_io.h"
+#include "kernels.h"
+#include "key_schedule.h"
+#include "thread_pool.h"
 #include <algorithm>
 #include <cstring>
 #include <fstream>
@@ -7,394 +15,628 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <sstream>
 #include <iomanip>
-#include <zip.h> 
+#include <zip.h>
 
-void rotate_left(uint8_t *data, size_t len, int k) {
-    if (len == 0 || k == 0) return;
-    k = k % (len * 8);
-    if (k < 0) k += len * 8;
-    
+// Buffers of up to 8 bytes are rotated as a single big-endian integer of len * 8 bits.
+static void rotate_small(uint8_t *data, size_t len, size_t k, bool left) {
     size_t n = len * 8;
-    std::vector<uint8_t> temp(data, data + len);
+    uint64_t mask = (n == 64) ? ~0ULL : ((1ULL << n) - 1);
     uint64_t int_val = 0;
-    
-    for (size_t i = 0; i < len && i < 8; i++) {
-        int_val = (int_val << 8) | temp[i];
+    for (size_t i = 0; i < len; i++) {
+        int_val = (int_val << 8) | data[i];
+    }
+    uint64_t rotated = left ? ((int_val << k) | (int_val >> (n - k)))
+                            : ((int_val >> k) | (int_val << (n - k)));
+    rotated &= mask;
+    for (size_t i = len; i-- > 0;) {
+        data[i] = rotated & 0xFF;
+        rotated >>= 8;
     }
+}
+
+void rotate_left(uint8_t *data, size_t len, int k) {
+    if (len == 0 || k == 0) return;
+    size_t n = len * 8;
+    size_t shift = (size_t)k % n;
+    if (shift == 0) return;
     
     if (len <= 8) {
-        uint64_t rotated = ((int_val << k) | (int_val >> (n - k))) & ((1ULL << n) - 1);
-        for (int i = len - 1; i >= 0; i--) {
-            data[i] = rotated & 0xFF;
-            rotated >>= 8;
-        }
-    } else {
-        // For larger data, use byte-level rotation
-        std::vector<uint8_t> result(len);
-        size_t byte_shift = k / 8;
-        int bit_shift = k % 8;
-        
-        for (size_t i = 0; i < len; i++) {
-            size_t src_idx = (i + len - byte_shift) % len;
-            result[i] = temp[src_idx];
-        }
-        
-        if (bit_shift > 0) {
-            uint8_t carry = 0;
-            for (size_t i = 0; i < len; i++) {
-                uint8_t new_carry = result[i] >> (8 - bit_shift);
-                result[i] = (result[i] << bit_shift) | carry;
-                carry = new_carry;
-            }
-            result[0] |= carry;
-        }
-        
-        memcpy(data, result.data(), len);
+        rotate_small(data, len, shift, true);
+        return;
     }
+    
+    // Whole-byte part: byte i moves to i + byte_shift (mod len).
+    size_t byte_shift = shift / 8;
+    unsigned bit_shift = shift % 8;
+    if (byte_shift) rotate_bytes_up(data, len, byte_shift);
+    if (bit_shift == 0) return;
+    
+    active_kernels().rotl(data, len, bit_shift);
 }
 
 void rotate_right(uint8_t *data, size_t len, int k) {
     if (len == 0 || k == 0) return;
-    k = k % (len * 8);
-    if (k < 0) k += len * 8;
-    
     size_t n = len * 8;
-    std::vector<uint8_t> temp(data, data + len);
-    uint64_t int_val = 0;
+    size_t shift = (size_t)k % n;
+    if (shift == 0) return;
     
-    for (size_t i = 0; i < len && i < 8; i++) {
-        int_val = (int_val << 8) | temp[i];
+    if (len <= 8) {
+        rotate_small(data, len, shift, false);
+        return;
     }
     
-    if (len <= 8) {
-        uint64_t rotated = ((int_val >> k) | (int_val << (n - k))) & ((1ULL << n) - 1);
-        for (int i = len - 1; i >= 0; i--) {
-            data[i] = rotated & 0xFF;
-            rotated >>= 8;
-        }
-    } else {
-        std::vector<uint8_t> result(len);
-        size_t byte_shift = k / 8;
-        int bit_shift = k % 8;
-        
-        for (size_t i = 0; i < len; i++) {
-            size_t src_idx = (i + byte_shift) % len;
-            result[i] = temp[src_idx];
-        }
-        
-        if (bit_shift > 0) {
-            uint8_t carry = 0;
-            for (int i = len - 1; i >= 0; i--) {
-                uint8_t new_carry = result[i] << (8 - bit_shift);
-                result[i] = (result[i] >> bit_shift) | carry;
-                carry = new_carry;
-            }
-            result[len - 1] |= carry;
-        }
-        
-        memcpy(data, result.data(), len);
+    // Whole-byte part: byte i moves to i - byte_shift (mod len).
+    size_t byte_shift = shift / 8;
+    unsigned bit_shift = shift % 8;
+    if (byte_shift) rotate_bytes_down(data, len, byte_shift);
+    if (bit_shift == 0) return;
+    
+    active_kernels().rotr(data, len, bit_shift);
+}
+
+// Expanding a key costs about as much as XORing one sub-chunk with it, so each
+// thread keeps the stream of the last key it used.
+static const KeyStream &cached_key_stream(const uint8_t *key, size_t key_len) {
+    thread_local std::unique_ptr<KeyStream> cached;
+    if (!cached || !cached->matches(key, key_len)) {
+        cached.reset(new KeyStream(key, key_len));
     }
+    return *cached;
 }
 
 void xor_bytes(uint8_t *data, size_t data_len, const uint8_t *key, size_t key_len) {
-    for (size_t i = 0; i < data_len; i++) {
-        data[i] ^= key[i % key_len];
+    if (key_len == 0) return;
+    if (data_len <= key_len) {
+        xor_stream(data, key, data_len);
+        return;
+    }
+    cached_key_stream(key, key_len).apply(data, data_len);
+}
+
+// Callers of the raw-key API get the same per-thread caching for the schedule.
+static const KeySchedule &cached_schedule(const uint8_t *key, size_t key_len) {
+    thread_local std::unique_ptr<KeySchedule> cached;
+    if (!cached || !cached->matches(key, key_len)) {
+        cached.reset(new KeySchedule(key, key_len));
     }
+    return *cached;
 }
 
 void byte_manipulations(uint8_t *data, size_t data_len, const uint8_t *key, size_t key_len, int iterat) {
     if (key_len < 6) return;
-    iterat = 10 + (iterat % 6);
-    int n = key[(key[1] + key[2]) % (key_len - 5)] % 7;
-    
-    for (int i = 0; i < iterat; i++) {
-        rotate_left(data, data_len, 1 + ((n + i) % 7));
-        xor_bytes(data, data_len, key, key_len);
-    }
+    cached_schedule(key, key_len).forward(data, data_len, iterat);
 }
 
 void byte_manipulations_reverse(uint8_t *data, size_t data_len, const uint8_t *key, size_t key_len, int iterat) {
     if (key_len < 6) return;
-    iterat = 10 + (iterat % 6);
-    int n = key[(key[1] + key[2]) % (key_len - 5)] % 7;
-    
-    for (int i = iterat - 1; i >= 0; i--) {
-        xor_bytes(data, data_len, key, key_len);
-        rotate_right(data, data_len, 1 + ((n + i) % 7));
-    }
+    cached_schedule(key, key_len).reverse(data, data_len, iterat);
 }
 
-// Helper to determine chunk size based on file size
-static size_t get_chunk_size(size_t file_size) {
-    if (file_size < 5 * 1024 * 1024) {  // < 5MB
-        return file_size;  // No chunking
-    } else if (file_size < 50 * 1024 * 1024) {  // < 50MB
-        return 512 * 1024;  // 512KB
-    } else if (file_size < 200 * 1024 * 1024) {  // < 200MB
-        return 2 * 1024 * 1024;  // 2MB
-    } else {
-        return 8 * 1024 * 1024;  // 8MB for very large files
+// libzip source that streams one chunk straight out of the pipeline while zip_close
+// writes the archive, so encrypted chunks never pile up in memory.
+struct ChunkSource {
+    ChunkPipeline *pipeline;
+    size_t index;
+    size_t size;        // stored bytes; known up front only without compression
+    bool size_known;
+    size_t offset;
+    ChunkData *chunk;
+    RunRecorder *recorder;
+    bool traced;        // a trace "write" event is open for this chunk
+    zip_error_t error;
+};
+
+static zip_int64_t chunk_source_callback(void *userdata, void *data, zip_uint64_t len, zip_source_cmd_t cmd) {
+    ChunkSource *src = (ChunkSource*)userdata;
+    switch (cmd) {
+        case ZIP_SOURCE_OPEN: {
+            // zip_close is timed as the write phase; waiting here for the
+            // pipeline is not writing.
+            uint64_t wait_start = src->recorder ? src->recorder->now_ns() : 0;
+            uint64_t wait_cpu = src->recorder ? thread_cpu_ns() : 0;
+            src->chunk = src->pipeline->acquire(src->index);
+            if (src->recorder) {
+                src->recorder->discount(PHASE_WRITE, src->recorder->now_ns() - wait_start,
+                                        thread_cpu_ns() - wait_cpu);
+            }
+            if (!src->chunk || (src->size_known && src->chunk->data.size() != src->size)) {
+                zip_error_set(&src->error, ZIP_ER_READ, 0);
+                return -1;
+            }
+            src->size = src->chunk->data.size();
+            src->offset = 0;
+            if (src->recorder) src->recorder->add_bytes(PHASE_WRITE, src->size);
+            // libzip copies the chunk into the archive between open and close.
+            src->traced = trace_enabled();
+            if (src->traced) trace_event('B', "write", "chunk", (int64_t)src->index);
+            return 0;
+        }
+        case ZIP_SOURCE_READ: {
+            size_t n = std::min((size_t)len, src->size - src->offset);
+            memcpy(data, src->chunk->data.data() + src->offset, n);
+            src->offset += n;
+            return (zip_int64_t)n;
+        }
+        case ZIP_SOURCE_CLOSE:
+            if (src->traced) trace_event('E', "write", nullptr, 0);
+            src->traced = false;
+            if (src->chunk) src->pipeline->release(src->index);
+            src->chunk = nullptr;
+            return 0;
+        case ZIP_SOURCE_STAT: {
+            zip_stat_t *st = (zip_stat_t*)data;
+            zip_stat_init(st);
+            if (src->size_known) {
+                st->size = src->size;
+                st->valid |= ZIP_STAT_SIZE;
+            }
+            return sizeof(*st);
+        }
+        case ZIP_SOURCE_ERROR:
+            return zip_error_to_data(&src->error, data, len);
+        case ZIP_SOURCE_FREE:
+            zip_error_fini(&src->error);
+            delete src;
+            return 0;
+        case ZIP_SOURCE_SUPPORTS:
+            return zip_source_make_command_bitmap(ZIP_SOURCE_OPEN, ZIP_SOURCE_READ, ZIP_SOURCE_CLOSE,
+                                                  ZIP_SOURCE_STAT, ZIP_SOURCE_ERROR, ZIP_SOURCE_FREE, -1);
+        default:
+            zip_error_set(&src->error, ZIP_ER_INVAL, 0);
+            return -1;
     }
 }
 
-static const size_t SUB_CHUNK_SIZE = 1024;  // 1KB sub-chunks
-
-struct ChunkData {
-    std::vector<uint8_t> data;
-    int index;
-};
-
 int encrypt_file_advanced(const char *input_file, const char *output_file, const char *password, int cost) {
+    return encrypt_file_compressed(input_file, output_file, password, cost, NULL, NULL);
+}
+
+int encrypt_file_compressed(const char *input_file, const char *output_file, const char *password, int cost,
+                            const CompressionOptions *compression, RunStats *stats) {
+    RunRecorder recorder(stats);
+    RunRecorder *timing = stats ? &recorder : nullptr;
+    CompressionOptions opts = compression ? *compression : CompressionOptions{COMPRESS_STORE, 0, NULL};
     std::ifstream infile(input_file, std::ios::binary | std::ios::ate);
     if (!infile) return -1;
     
     size_t file_size = infile.tellg();
     infile.seekg(0);
     
-    char *salt_ptr = hash_password("", 8, nullptr);
-    if (!salt_ptr) return -1;
-    
-    std::string salt_str(salt_ptr);
-    size_t salt_start = salt_str.find('$') + 1;
-    size_t salt_end = salt_str.find('$', salt_start);
-    std::string salt = salt_str.substr(salt_start, salt_end - salt_start);
-    free(salt_ptr);
-    
-    char *hashed_password = hash_password(password, cost, salt.c_str());
-    if (!hashed_password) return -1;
-    
-    char *hash_of_hash = hash_password(hashed_password, cost, salt.c_str());
-    if (!hash_of_hash) {
-        free(hashed_password);
-        return -1;
+    ContainerMetadata meta;
+    meta.filename = base_name(input_file);
+    meta.compression = format_compression(opts);
+    meta.size = meta.compression.empty() ? 0 : file_size;
+    std::string hashed_password;
+    {
+        PhaseTimer kdf(timing, PHASE_KDF);
+        if (!derive_new_key(password, cost, meta, hashed_password)) return -1;
     }
     
     int err = 0;
     zip_t *za = zip_open(output_file, ZIP_CREATE | ZIP_TRUNCATE, &err);
-    if (!za) {
-        free(hashed_password);
-        free(hash_of_hash);
-        return -1;
-    }
-    
-    std::string filename = input_file;
-    size_t last_slash = filename.find_last_of("/\\");
-    if (last_slash != std::string::npos) {
-        filename = filename.substr(last_slash + 1);
-    }
+    if (!za) return -1;
     
-    std::ostringstream metadata;
-    metadata << "file : " << filename << "\n"
-             << "salt : " << salt << "\n"
-             << "cost : " << cost << "\n"
-             << "hash_verify : " << hash_of_hash << "\n";
+    KeySchedule schedule((const uint8_t*)hashed_password.data(), hashed_password.size());
     
-    std::string metadata_str = metadata.str();
-    std::vector<uint8_t> metadata_enc(metadata_str.begin(), metadata_str.end());
-    byte_manipulations(metadata_enc.data(), metadata_enc.size(), 
-                      (uint8_t*)hashed_password, strlen(hashed_password), 0);
+    std::string metadata_str = format_metadata(meta);
+    std::vector<uint8_t> metadata_enc = encrypt_metadata(schedule, metadata_str);
     
-    char *metadata_copy = (char*)malloc(metadata_str.size());
-    memcpy(metadata_copy, metadata_str.c_str(), metadata_str.size());
-    zip_source_t *s = zip_source_buffer(za, metadata_copy, metadata_str.size(), 1);
+    // Both metadata buffers outlive zip_close, so libzip can read them in place.
+    zip_source_t *s = zip_source_buffer(za, metadata_str.data(), metadata_str.size(), 0);
     if (s && zip_file_add(za, "filedata.crypt", s, ZIP_FL_OVERWRITE) < 0) {
         zip_source_free(s);
     }
     
-    uint8_t *metadata_enc_copy = (uint8_t*)malloc(metadata_enc.size());
-    memcpy(metadata_enc_copy, metadata_enc.data(), metadata_enc.size());
-    s = zip_source_buffer(za, metadata_enc_copy, metadata_enc.size(), 1);
+    s = zip_source_buffer(za, metadata_enc.data(), metadata_enc.size(), 0);
     if (s && zip_file_add(za, "filedata_enc.crypt", s, ZIP_FL_OVERWRITE) < 0) {
         zip_source_free(s);
     }
     
     size_t chunk_size = get_chunk_size(file_size);
-    size_t num_threads = std::thread::hardware_concurrency();
-    if (num_threads == 0) num_threads = 2;
-    
-    std::vector<ChunkData> all_chunks;
-    int chunk_index = 0;
-    
-    while (infile) {
-        std::vector<uint8_t> chunk(chunk_size);
-        infile.read((char*)chunk.data(), chunk_size);
-        size_t bytes_read = infile.gcount();
-        if (bytes_read == 0) break;
-        chunk.resize(bytes_read);
-        all_chunks.push_back({chunk, chunk_index++});
-    }
-    infile.close();
-    
-    std::mutex chunks_mutex;
-    std::vector<std::pair<int, std::vector<uint8_t>>> encrypted_chunks(all_chunks.size());
-    
-    auto process_chunk = [&](size_t start, size_t end) {
-        for (size_t idx = start; idx < end && idx < all_chunks.size(); idx++) {
-            std::vector<uint8_t> encrypted_chunk;
-            for (size_t i = 0; i < all_chunks[idx].data.size(); i += SUB_CHUNK_SIZE) {
-                size_t sub_size = std::min(SUB_CHUNK_SIZE, all_chunks[idx].data.size() - i);
-                std::vector<uint8_t> sub_chunk(all_chunks[idx].data.begin() + i, 
-                                               all_chunks[idx].data.begin() + i + sub_size);
-                byte_manipulations(sub_chunk.data(), sub_chunk.size(),
-                                 (uint8_t*)hashed_password, strlen(hashed_password),
-                                 all_chunks[idx].index);
-                encrypted_chunk.insert(encrypted_chunk.end(), sub_chunk.begin(), sub_chunk.end());
-            }
-            encrypted_chunks[idx] = {all_chunks[idx].index, encrypted_chunk};
-        }
+    ThreadPool &pool = ThreadPool::shared();
+    
+    auto transform = [&](ChunkData &chunk, size_t group) {
+        transform_group(chunk.data.data(), chunk.data.size(), group, schedule, chunk.index, false);
     };
     
-    std::vector<std::thread> threads;
-    size_t chunks_per_thread = (all_chunks.size() + num_threads - 1) / num_threads;
-    for (size_t i = 0; i < num_threads; i++) {
-        size_t start = i * chunks_per_thread;
-        size_t end = std::min(start + chunks_per_thread, all_chunks.size());
-        if (start < all_chunks.size()) {
-            threads.emplace_back(process_chunk, start, end);
+    // Map the input when possible so chunks are copied once, by the worker
+    // that transforms them, instead of through the stream buffer first.
+    // The direct backend streams it through a queue of O_DIRECT reads instead.
+    InputFile mapped;
+    const uint8_t *plain = mapped.open(input_file) && mapped.map() ? mapped.data() : nullptr;
+    std::unique_ptr<DirectReadBuf> direct = open_direct_input(input_file);
+    std::istream direct_in(direct.get());
+    
+    size_t depth = pool.size() * PIPELINE_DEPTH_PER_THREAD;
+    ChunkPipeline pipeline(direct ? direct_in : infile, plain, file_size, chunk_size, depth, pool, transform,
+                           compress_stage(opts), timing);
+    
+    // Chunks are compressed (or not) by the pipeline and already scrambled, so
+    // libzip stores them as they are instead of deflating on one thread.
+    bool ok = true;
+    for (size_t idx = 0; idx < pipeline.num_chunks() && ok; idx++) {
+        std::string chunk_name = "filedata_chunk_" + std::to_string(idx) + ".crypt";
+        ChunkSource *src = new ChunkSource();
+        src->pipeline = &pipeline;
+        src->index = idx;
+        src->size = pipeline.chunk_length(idx);
+        src->size_known = opts.codec == COMPRESS_STORE;
+        src->offset = 0;
+        src->chunk = nullptr;
+        src->recorder = timing;
+        src->traced = false;
+        zip_error_init(&src->error);
+        zip_source_t *cs = zip_source_function(za, chunk_source_callback, src);
+        zip_int64_t entry = -1;
+        if (!cs) {
+            delete src;
+            ok = false;
+        } else if ((entry = zip_file_add(za, chunk_name.c_str(), cs, ZIP_FL_OVERWRITE)) < 0) {
+            zip_source_free(cs);
+            ok = false;
+        } else {
+            ok = zip_set_file_compression(za, (zip_uint64_t)entry, ZIP_CM_STORE, 0) == 0;
         }
     }
     
-    for (auto &t : threads) {
-        if (t.joinable()) t.join();
-    }
-    
-    for (const auto &ec : encrypted_chunks) {
-        std::string chunk_name = "filedata_chunk_" + std::to_string(ec.first) + ".crypt";
-        uint8_t *chunk_copy = (uint8_t*)malloc(ec.second.size());
-        memcpy(chunk_copy, ec.second.data(), ec.second.size());
-        zip_source_t *s = zip_source_buffer(za, chunk_copy, ec.second.size(), 1);
-        if (s) zip_file_add(za, chunk_name.c_str(), s, ZIP_FL_OVERWRITE);
+    if (ok) {
+        PhaseTimer write(timing, PHASE_WRITE);
+        ok = zip_close(za) == 0 && !pipeline.failed();
+        write.stop();
+        // libzip writes the archive itself, so the direct backend can only
+        // evict it once it is complete.
+        if (ok && io_backend() == IO_DIRECT) drop_file_cache(output_file);
+    } else {
+        zip_discard(za);
     }
-    
-    zip_close(za);
-    free(hashed_password);
-    free(hash_of_hash);
-    return 0;
+    if (ok && opts.stats) merge_compression_stats(opts.stats, pipeline.compression_stats());
+    if (ok) recorder.finish(file_size, file_size_of(output_file), pipeline.num_chunks(), chunk_size);
+    return ok ? 0 : -1;
 }
 
-int decrypt_file_advanced(const char *input_file, const char *output_file, const char *password) {
-    int err = 0;
-    zip_t *za = zip_open(input_file, ZIP_RDONLY, &err);
-    if (!za) return -1;
-    
+struct ArchiveChunk {
+    int index;
+    zip_uint64_t entry;
+    size_t size;        // stored bytes
+    size_t plain_size;  // plaintext bytes; larger than size when compressed
+    size_t offset;      // of the plaintext in the decrypted file
+};
+
+static bool read_entry(zip_t *za, const char *name, std::vector<uint8_t> &data) {
     zip_stat_t st;
-    if (zip_stat(za, "filedata.crypt", 0, &st) != 0) {
-        zip_close(za);
-        return -1;
-    }
+    if (zip_stat(za, name, 0, &st) != 0) return false;
+    zip_file_t *zf = zip_fopen(za, name, 0);
+    if (!zf) return false;
+    data.resize(st.size);
+    zip_int64_t n = zip_fread(zf, data.data(), st.size);
+    zip_fclose(zf);
+    return n >= 0 && (zip_uint64_t)n == st.size;
+}
+
+// Index of a "filedata_chunk_<n>.crypt" entry, or -1 for any other name.
+static int chunk_entry_index(const char *name) {
+    static const char prefix[] = "filedata_chunk_";
+    if (strncmp(name, prefix, sizeof(prefix) - 1) != 0) return -1;
+    const char *p = name + sizeof(prefix) - 1;
+    long index = 0;
+    for (; *p >= '0' && *p <= '9' && index <= INT32_MAX; p++) index = index * 10 + (*p - '0');
+    if (p == name + sizeof(prefix) - 1 || index > INT32_MAX || strcmp(p, ".crypt") != 0) return -1;
+    return (int)index;
+}
+
+// Reads the metadata and checks the password (0, -1, or -2 for a wrong one),
+// then lists the chunk entries in index order with their plaintext offsets.
+static int open_zip_archive(zip_t *za, const char *password, ContainerMetadata &meta,
+                            std::string &hashed_password, std::vector<ArchiveChunk> &chunks,
+                            RunRecorder *recorder = nullptr) {
+    std::vector<uint8_t> metadata_buf, metadata_enc;
+    if (!read_entry(za, "filedata.crypt", metadata_buf)) return -1;
+    std::string metadata_str(metadata_buf.begin(), metadata_buf.end());
+    parse_metadata(metadata_str, meta);
     
-    zip_file_t *zf = zip_fopen(za, "filedata.crypt", 0);
-    if (!zf) {
-        zip_close(za);
-        return -1;
-    }
+    PhaseTimer kdf(recorder, PHASE_KDF);
+    int rc = derive_key(password, meta, hashed_password);
+    kdf.stop();
+    if (rc != 0) return rc;
     
-    std::vector<char> metadata_buf(st.size);
-    zip_fread(zf, metadata_buf.data(), st.size);
-    zip_fclose(zf);
+    if (!read_entry(za, "filedata_enc.crypt", metadata_enc)) return -1;
+    KeySchedule schedule((const uint8_t*)hashed_password.data(), hashed_password.size());
+    if (!metadata_matches(schedule, metadata_enc, metadata_str)) return -2;
     
-    std::string metadata_str(metadata_buf.begin(), metadata_buf.end());
-    std::istringstream iss(metadata_str);
-    std::string line, filename, salt, hash_verify;
-    int cost = 10;
-    
-    while (std::getline(iss, line)) {
-        if (line.find("file : ") == 0) filename = line.substr(7);
-        else if (line.find("salt : ") == 0) salt = line.substr(7);
-        else if (line.find("cost : ") == 0) cost = std::stoi(line.substr(7));
-        else if (line.find("hash_verify : ") == 0) hash_verify = line.substr(14);
+    zip_int64_t num_entries = zip_get_num_entries(za, 0);
+    for (zip_int64_t i = 0; i < num_entries; i++) {
+        const char *name = zip_get_name(za, i, 0);
+        int index = name ? chunk_entry_index(name) : -1;
+        zip_stat_t st;
+        if (index < 0 || zip_stat_index(za, i, 0, &st) != 0) continue;
+        ArchiveChunk chunk;
+        chunk.index = index;
+        chunk.entry = (zip_uint64_t)i;
+        chunk.size = st.size;
+        chunk.plain_size = st.size;
+        chunks.push_back(chunk);
     }
     
-    char *hashed_password = hash_password(password, cost, salt.c_str());
-    if (!hashed_password) {
-        zip_close(za);
-        return -1;
-    }
+    std::sort(chunks.begin(), chunks.end(),
+              [](const ArchiveChunk &a, const ArchiveChunk &b) { return a.index < b.index; });
     
-    char *hash_of_hash = hash_password(hashed_password, cost, salt.c_str());
-    if (!hash_of_hash || hash_verify != hash_of_hash) {
-        free(hashed_password);
-        if (hash_of_hash) free(hash_of_hash);
-        zip_close(za);
-        return -2;
+    if (meta.compression.empty()) {
+        size_t total_size = 0;
+        for (auto &chunk : chunks) {
+            chunk.offset = total_size;
+            total_size += chunk.size;
+        }
+        return 0;
     }
-    free(hash_of_hash);
     
-    if (zip_stat(za, "filedata_enc.crypt", 0, &st) != 0) {
-        free(hashed_password);
-        zip_close(za);
-        return -1;
+    // Compressed chunks are laid out from the recorded size: chunk i holds
+    // plaintext [i * chunk_size, ...), and is stored compressed exactly when
+    // its entry is smaller than that (chunks that did not shrink are raw).
+    CompressionCodec codec;
+    size_t chunk_size = get_chunk_size((size_t)meta.size);
+    size_t expected = chunk_size ? (size_t)((meta.size + chunk_size - 1) / chunk_size) : 0;
+    if (!metadata_codec(meta, codec) || chunks.size() != expected) return -1;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        ArchiveChunk &chunk = chunks[i];
+        chunk.offset = i * chunk_size;
+        chunk.plain_size = std::min(chunk_size, (size_t)meta.size - chunk.offset);
+        if (chunk.index != (int)i || chunk.size > chunk.plain_size) return -1;
     }
-    
-    zf = zip_fopen(za, "filedata_enc.crypt", 0);
-    if (!zf) {
-        free(hashed_password);
-        zip_close(za);
-        return -1;
+    return 0;
+}
+
+int decrypt_file_advanced(const char *input_file, const char *output_file, const char *password) {
+    return decrypt_file_stats(input_file, output_file, password, NULL);
+}
+
+int decrypt_file_stats(const char *input_file, const char *output_file, const char *password, RunStats *stats) {
+    RunRecorder recorder(stats);
+    RunRecorder *timing = stats ? &recorder : nullptr;
+    int rc;
+    switch (detect_container(input_file)) {
+    case CONTAINER_STREAM:
+        return decrypt_stream_file(input_file, output_file, password, timing);
+    case CONTAINER_NATIVE:
+        return decrypt_native_file(input_file, output_file, password, timing);
+    case CONTAINER_ZIP:
+        break;
     }
     
-    std::vector<uint8_t> metadata_enc(st.size);
-    zip_fread(zf, metadata_enc.data(), st.size);
-    zip_fclose(zf);
+    int err = 0;
+    zip_t *za = zip_open(input_file, ZIP_RDONLY, &err);
+    if (!za) return -1;
     
-    byte_manipulations_reverse(metadata_enc.data(), metadata_enc.size(),
-                               (uint8_t*)hashed_password, strlen(hashed_password), 0);
+    ContainerMetadata meta;
+    std::string hashed_password;
+    std::vector<ArchiveChunk> chunks;
+    rc = open_zip_archive(za, password, meta, hashed_password, chunks, timing);
+    zip_close(za);
+    if (rc != 0) return rc;
     
-    std::string decrypted_metadata(metadata_enc.begin(), metadata_enc.end());
-    if (decrypted_metadata.find(metadata_str) != 0) {
-        free(hashed_password);
-        zip_close(za);
-        return -2;
-    }
+    CompressionCodec codec = COMPRESS_STORE;
+    metadata_codec(meta, codec);
+    KeySchedule schedule((const uint8_t*)hashed_password.data(), hashed_password.size());
+    size_t total_size = chunks.empty() ? 0 : chunks.back().offset + chunks.back().plain_size;
     
-    std::ofstream outfile(output_file, std::ios::binary);
-    if (!outfile) {
-        free(hashed_password);
-        zip_close(za);
+    OutputFile outfile;
+    if (!outfile.open(output_file, total_size, true)) {
+        outfile.close();
+        remove(output_file);
         return -1;
     }
+    uint8_t *out = outfile.data();
+    
+    // libzip handles are not thread-safe, so each worker opens its own and pulls
+    // chunk indices from a shared counter; plaintext goes straight to its final offset.
+    ThreadPool &pool = ThreadPool::shared();
+    size_t num_workers = std::min(pool.size(), chunks.size());
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<bool> failed(false);
+    
+    parallel_for(pool, num_workers, [&](size_t) {
+        int worker_err = 0;
+        zip_t *worker_za = zip_open(input_file, ZIP_RDONLY, &worker_err);
+        if (!worker_za) {
+            failed = true;
+            return;
+        }
+        std::vector<uint8_t> buffer, plain;
+        for (size_t c = next_chunk++; c < chunks.size() && !failed; c = next_chunk++) {
+            const ArchiveChunk &chunk = chunks[c];
+            // With a mapped output a raw chunk is read straight into its place
+            // in the file and decrypted there; write_at then has nothing to copy.
+            bool compressed = chunk.size < chunk.plain_size;
+            bool in_place = out && !compressed && chunk.offset <= total_size && chunk.size <= total_size - chunk.offset;
+            uint8_t *data = in_place ? out + chunk.offset : nullptr;
+            if (!data) {
+                buffer.resize(chunk.size);
+                data = buffer.data();
+            }
+            PhaseTimer read(timing, PHASE_READ, chunk.size, chunk.index);
+            zip_file_t *chunk_file = zip_fopen_index(worker_za, chunk.entry, 0);
+            if (!chunk_file) {
+                failed = true;
+                break;
+            }
+            zip_int64_t n = zip_fread(chunk_file, data, chunk.size);
+            zip_fclose(chunk_file);
+            read.stop();
+            if (n < 0 || (size_t)n != chunk.size) {
+                failed = true;
+                break;
+            }
+            
+            transform_chunk(data, chunk.size, schedule, chunk.index, true, timing);
+            size_t length = chunk.size;
+            if (compressed) {
+                length = chunk.plain_size;
+                if (out && chunk.offset <= total_size && length <= total_size - chunk.offset) {
+                    data = out + chunk.offset;
+                } else {
+                    plain.resize(length);
+                    data = plain.data();
+                }
+                PhaseTimer decompress(timing, PHASE_COMPRESS, chunk.size, chunk.index);
+                if (!decompress_chunk(codec, buffer.data(), buffer.size(), data, length)) {
+                    failed = true;
+                    break;
+                }
+            }
+            
+            PhaseTimer write(timing, PHASE_WRITE, length, chunk.index);
+            if (!outfile.write_at(data, length, chunk.offset)) {
+                failed = true;
+            }
+        }
+        zip_close(worker_za);
+    });
+    
+    if (io_backend() == IO_DIRECT) drop_file_cache(input_file);
+    PhaseTimer close(timing, PHASE_WRITE);
+    bool ok = outfile.close() && !failed;
+    close.stop();
+    // The output was created at full size, so a failed chunk would otherwise
+    // leave plaintext mixed with ciphertext and holes behind.
+    if (!ok) remove(output_file);
+    if (ok) {
+        recorder.finish(file_size_of(input_file), total_size, chunks.size(), chunks.empty() ? 0 : chunks[0].plain_size);
+    }
+    return ok ? 0 : -1;
+}
+
+// Random access into a ZIP archive. Handles are not thread-safe, so readers
+// borrow one from a free list and open another when every handle is busy.
+// Entries are read sequentially: bytes before the requested offset are read
+// and dropped, which for a stored entry costs no more than the seek would.
+class ZipArchiveReader : public ArchiveReader {
+public:
+    ZipArchiveReader(const char *path, std::vector<ArchiveChunk> chunks, const std::string &key,
+                     uint64_t size, size_t chunk_size, CompressionCodec codec)
+        : path_(path), chunks_(std::move(chunks)) {
+        size_ = size;
+        chunk_size_ = chunk_size;
+        codec_ = codec;
+        schedule_.reset(new KeySchedule((const uint8_t*)key.data(), key.size()));
+    }
     
-    zip_int64_t num_entries = zip_get_num_entries(za, 0);
-    std::vector<std::pair<int, std::string>> chunks;
+    ~ZipArchiveReader() {
+        for (zip_t *za : handles_) zip_close(za);
+    }
     
-    for (zip_int64_t i = 0; i < num_entries; i++) {
-        const char *name = zip_get_name(za, i, 0);
-        if (!name) continue;
-        std::string fname(name);
-        if (fname.find("filedata_chunk_") == 0) {
-            size_t pos = fname.find_last_of('_');
-            size_t dot = fname.find('.');
-            int idx = std::stoi(fname.substr(pos + 1, dot - pos - 1));
-            chunks.push_back({idx, fname});
+    size_t stored_length(size_t chunk) const override { return chunks_[chunk].size; }
+    
+    bool compressed(size_t chunk) const override { return chunks_[chunk].size < chunks_[chunk].plain_size; }
+    
+    bool read_stored(size_t chunk, size_t offset, size_t len, uint8_t *out) const override {
+        if (chunk >= chunks_.size() || offset + len > chunks_[chunk].size) return false;
+        zip_t *za = borrow();
+        if (!za) return false;
+        bool ok = false;
+        zip_file_t *zf = zip_fopen_index(za, chunks_[chunk].entry, 0);
+        if (zf) {
+            uint8_t skip[4096];
+            size_t skipped = 0;
+            ok = true;
+            while (ok && skipped < offset) {
+                size_t n = std::min(sizeof(skip), offset - skipped);
+                ok = zip_fread(zf, skip, n) == (zip_int64_t)n;
+                skipped += n;
+            }
+            ok = ok && zip_fread(zf, out, len) == (zip_int64_t)len;
+            zip_fclose(zf);
         }
+        give_back(za);
+        return ok;
     }
     
-    std::sort(chunks.begin(), chunks.end());
-    
-    for (const auto &chunk_info : chunks) {
-        if (zip_stat(za, chunk_info.second.c_str(), 0, &st) != 0) continue;
-        
-        zf = zip_fopen(za, chunk_info.second.c_str(), 0);
-        if (!zf) continue;
-        
-        std::vector<uint8_t> encrypted_chunk(st.size);
-        zip_fread(zf, encrypted_chunk.data(), st.size);
-        zip_fclose(zf);
-        
-        for (size_t i = 0; i < encrypted_chunk.size(); i += SUB_CHUNK_SIZE) {
-            size_t sub_size = std::min(SUB_CHUNK_SIZE, encrypted_chunk.size() - i);
-            byte_manipulations_reverse(encrypted_chunk.data() + i, sub_size,
-                                      (uint8_t*)hashed_password, strlen(hashed_password),
-                                      chunk_info.first);
+private:
+    zip_t *borrow() const {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!handles_.empty()) {
+                zip_t *za = handles_.back();
+                handles_.pop_back();
+                return za;
+            }
         }
-        
-        outfile.write((char*)encrypted_chunk.data(), encrypted_chunk.size());
+        int err = 0;
+        return zip_open(path_.c_str(), ZIP_RDONLY, &err);
     }
     
-    outfile.close();
+    void give_back(zip_t *za) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        handles_.push_back(za);
+    }
+    
+    std::string path_;
+    std::vector<ArchiveChunk> chunks_;
+    mutable std::mutex mutex_;
+    mutable std::vector<zip_t*> handles_;
+};
+
+int open_zip_reader(const char *path, const char *password, std::unique_ptr<ArchiveReader> &reader) {
+    int err = 0;
+    zip_t *za = zip_open(path, ZIP_RDONLY, &err);
+    if (!za) return -1;
+    
+    ContainerMetadata meta;
+    std::string hashed_password;
+    std::vector<ArchiveChunk> chunks;
+    int rc = open_zip_archive(za, password, meta, hashed_password, chunks);
     zip_close(za);
-    free(hashed_password);
+    if (rc != 0) return rc;
+    
+    // Offsets map to chunks by division only if the entries are chunks
+    // 0..n-1 and all but the last have the same size (open_zip_archive has
+    // already laid compressed archives out that way).
+    CompressionCodec codec = COMPRESS_STORE;
+    metadata_codec(meta, codec);
+    size_t chunk_size = chunks.empty() ? 0 : chunks[0].plain_size;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        bool last = i + 1 == chunks.size();
+        size_t plain = chunks[i].plain_size;
+        if (chunks[i].index != (int)i || (last ? plain > chunk_size : plain != chunk_size)) return -1;
+    }
+    uint64_t size = chunks.empty() ? 0 : chunks.back().offset + chunks.back().plain_size;
+    reader.reset(new ZipArchiveReader(path, std::move(chunks), hashed_password, size, chunk_size, codec));
     return 0;
 }
+
+// Drivers claim files from a shared counter, one driver per pool worker at
+// most, so the number of open archives stays bounded. Each file's KDF runs on
+// its driver and its chunk tasks go to the same shared pool, where workers not
+// busy with their own file steal them: small files keep cores busy that a
+// large file's serial stages would leave idle.
+template <class Fn>
+static int run_batch(BatchEntry *entries, size_t count, Fn process) {
+    ThreadPool &pool = ThreadPool::shared();
+    std::atomic<size_t> next_entry(0);
+    std::atomic<int> failures(0);
+    parallel_for(pool, std::min(pool.size(), count), [&](size_t) {
+        for (size_t i = next_entry++; i < count; i = next_entry++) {
+            entries[i].status = process(entries[i]);
+            if (entries[i].status != 0) failures++;
+        }
+    });
+    return failures;
+}
+
+int encrypt_files_batch(BatchEntry *entries, size_t count, const char *password, int cost,
+                        const CompressionOptions *compression) {
+    return run_batch(entries, count, [&](const BatchEntry &entry) {
+        return encrypt_file_compressed(entry.input_file, entry.output_file, password, cost, compression, NULL);
+    });
+}
+
+int decrypt_files_batch(BatchEntry *entries, size_t count, const char *password) {
+    return run_batch(entries, count, [&](const BatchEntry &entry) {
+        return decrypt_file_advanced(entry.input_file, entry.output_file, password);
+    });
+}
@@ -0,0 +1,303 @@
+#include "file_io.h"
+#include <algorithm>
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char *const IO_BACKEND_NAMES[] = {"mmap", "buffered", "direct"};
+
+static std::atomic<int> &backend_setting() {
+    static std::atomic<int> backend([] {
+        IoBackend initial = IO_MMAP;
+        const char *io = getenv("MYCRYPT_IO");
+        if (io) parse_io_backend(io, &initial);
+        return (int)initial;
+    }());
+    return backend;
+}
+
+IoBackend io_backend() {
+    return (IoBackend)backend_setting().load(std::memory_order_relaxed);
+}
+
+void set_io_backend(IoBackend backend) {
+    backend_setting().store((int)backend, std::memory_order_relaxed);
+}
+
+const char *io_backend_name(IoBackend backend) {
+    return IO_BACKEND_NAMES[backend];
+}
+
+int parse_io_backend(const char *name, IoBackend *backend) {
+    for (int i = IO_MMAP; i <= IO_DIRECT; i++) {
+        if (strcmp(name, IO_BACKEND_NAMES[i]) == 0) {
+            *backend = (IoBackend)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void drop_file_cache(const char *path) {
+#ifdef __linux__
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return;
+    // Only clean pages can be dropped, so write the file back first.
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+#else
+    (void)path;
+#endif
+}
+
+uint64_t file_size_of(const char *path) {
+    InputFile file;
+    return file.open(path) ? file.size() : 0;
+}
+
+InputFile::InputFile() :
+#ifdef _WIN32
+    handle_(INVALID_HANDLE_VALUE),
+    mapping_(NULL),
+#else
+    fd_(-1),
+#endif
+    size_(0),
+    map_(nullptr)
+{}
+
+InputFile::~InputFile() { close(); }
+
+bool InputFile::open(const char *path) {
+    close();
+#ifdef _WIN32
+    handle_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle_ == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle_, &size)) return false;
+    size_ = (uint64_t)size.QuadPart;
+#else
+    fd_ = ::open(path, O_RDONLY);
+    if (fd_ < 0) return false;
+    struct stat st;
+    if (fstat(fd_, &st) != 0) return false;
+    size_ = (uint64_t)st.st_size;
+#ifdef __linux__
+    if (io_backend() == IO_DIRECT) posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#endif
+    return true;
+}
+
+bool InputFile::map() {
+    if (map_) return true;
+    if (io_backend() != IO_MMAP || size_ == 0 || size_ != (uint64_t)(size_t)size_) return false;
+#ifdef _WIN32
+    if (handle_ == INVALID_HANDLE_VALUE || GetFileType(handle_) != FILE_TYPE_DISK) return false;
+    mapping_ = CreateFileMappingA(handle_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping_) return false;
+    map_ = (uint8_t*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    if (!map_) {
+        CloseHandle(mapping_);
+        mapping_ = NULL;
+        return false;
+    }
+#else
+    struct stat st;
+    if (fd_ < 0 || fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    void *p = mmap(NULL, (size_t)size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) return false;
+    // Chunks are consumed front to back: let the kernel read ahead.
+    madvise(p, (size_t)size_, MADV_SEQUENTIAL);
+    map_ = (uint8_t*)p;
+#endif
+    return true;
+}
+
+bool InputFile::read_at(uint8_t *data, size_t len, uint64_t offset) const {
+    if (map_) {
+        if (offset > size_ || len > size_ - offset) return false;
+        memcpy(data, map_ + offset, len);
+        return true;
+    }
+#ifdef __linux__
+    uint64_t start = offset;
+    size_t total = len;
+#endif
+    while (len > 0) {
+#ifdef _WIN32
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD got = 0;
+        DWORD request = (DWORD)std::min(len, (size_t)0x40000000);
+        if (!ReadFile(handle_, data, request, &got, &ov) || got == 0) return false;
+#else
+        ssize_t got = pread(fd_, data, len, (off_t)offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+#endif
+        data += got;
+        len -= got;
+        offset += got;
+    }
+#ifdef __linux__
+    if (io_backend() == IO_DIRECT) posix_fadvise(fd_, (off_t)start, (off_t)total, POSIX_FADV_DONTNEED);
+#endif
+    return true;
+}
+
+void InputFile::close() {
+#ifdef _WIN32
+    if (map_) UnmapViewOfFile(map_);
+    if (mapping_) CloseHandle(mapping_);
+    mapping_ = NULL;
+    if (handle_ != INVALID_HANDLE_VALUE) CloseHandle(handle_);
+    handle_ = INVALID_HANDLE_VALUE;
+#else
+    if (map_) munmap(map_, (size_t)size_);
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+#endif
+    map_ = nullptr;
+    size_ = 0;
+}
+
+OutputFile::OutputFile() :
+#ifdef _WIN32
+    handle_(INVALID_HANDLE_VALUE),
+    mapping_(NULL),
+#else
+    fd_(-1),
+#endif
+    map_(nullptr),
+    size_(0),
+    pending_offset_(0),
+    pending_len_(0)
+{}
+
+bool OutputFile::open(const char *path, size_t size, bool map) {
+    size_ = size;
+    map = map && size > 0 && io_backend() == IO_MMAP;
+#ifdef _WIN32
+    // A read-write view needs a handle opened for reading as well.
+    DWORD access = map ? GENERIC_READ | GENERIC_WRITE : GENERIC_WRITE;
+    handle_ = CreateFileA(path, access, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle_ == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)size;
+    if (!SetFilePointerEx(handle_, end, NULL, FILE_BEGIN) || !SetEndOfFile(handle_)) return false;
+    if (map) {
+        mapping_ = CreateFileMappingA(handle_, NULL, PAGE_READWRITE, 0, 0, NULL);
+        if (mapping_) map_ = (uint8_t*)MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, 0);
+    }
+    return true;
+#else
+    // Mapped output is read as well as written by the page cache.
+    fd_ = ::open(path, (map ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) return false;
+    if (size == 0) return true;
+    // posix_fallocate reserves the blocks up front, so stores into a mapping
+    // cannot fail for want of space; fall back to a sparse ftruncate on
+    // filesystems that do not support it, and then write instead of mapping.
+    bool reserved = posix_fallocate(fd_, 0, (off_t)size) == 0;
+    if (!reserved && ftruncate(fd_, (off_t)size) != 0) return false;
+    if (map && reserved) {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p != MAP_FAILED) map_ = (uint8_t*)p;
+    }
+    return true;
+#endif
+}
+
+bool OutputFile::write_at(const uint8_t *data, size_t len, size_t offset) {
+    if (map_) {
+        if (offset > size_ || len > size_ - offset) return false;
+        // Workers that decrypt in place hand back the mapping itself.
+        if (data != map_ + offset) memcpy(map_ + offset, data, len);
+        return true;
+    }
+#ifdef __linux__
+    size_t start = offset;
+    size_t total = len;
+#endif
+    while (len > 0) {
+#ifdef _WIN32
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD)((uint64_t)offset >> 32);
+        DWORD written = 0;
+        DWORD request = (DWORD)std::min(len, (size_t)0x40000000);
+        if (!WriteFile(handle_, data, request, &written, &ov) || written == 0) return false;
+#else
+        ssize_t written = pwrite(fd_, data, len, (off_t)offset);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+#endif
+        data += written;
+        len -= written;
+        offset += written;
+    }
+#ifdef __linux__
+    if (io_backend() == IO_DIRECT) {
+        sync_file_range(fd_, (off_t)start, (off_t)total, SYNC_FILE_RANGE_WRITE);
+        drop_previous(start, total);
+    }
+#endif
+    return true;
+}
+
+void OutputFile::drop_previous(size_t offset, size_t len) {
+#ifdef __linux__
+    size_t prev_offset, prev_len;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        prev_offset = pending_offset_;
+        prev_len = pending_len_;
+        pending_offset_ = offset;
+        pending_len_ = len;
+    }
+    // Dirty pages cannot be dropped. The previous range has been writing back
+    // for a whole chunk, so waiting for it rarely blocks, and never on the
+    // writeback this caller just started.
+    if (prev_len == 0) return;
+    sync_file_range(fd_, (off_t)prev_offset, (off_t)prev_len,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd_, (off_t)prev_offset, (off_t)prev_len, POSIX_FADV_DONTNEED);
+#else
+    (void)offset;
+    (void)len;
+#endif
+}
+
+bool OutputFile::close() {
+    bool ok = true;
+#ifdef _WIN32
+    if (map_) ok = UnmapViewOfFile(map_) != 0;
+    if (mapping_) CloseHandle(mapping_);
+    mapping_ = NULL;
+    map_ = nullptr;
+    if (handle_ == INVALID_HANDLE_VALUE) return ok;
+    ok = CloseHandle(handle_) != 0 && ok;
+    handle_ = INVALID_HANDLE_VALUE;
+#else
+    if (map_) ok = munmap(map_, size_) == 0;
+    map_ = nullptr;
+    if (fd_ < 0) return ok;
+#ifdef __linux__
+    if (pending_len_ > 0) drop_previous(0, 0);
+#endif
+    ok = ::close(fd_) == 0 && ok;
+    fd_ = -1;
+#endif
+    return ok;
+}
@@ -0,0 +1,165 @@
+#include "kernels.h"
+#include "kernel_impl.h"
+#include <algorithm>
+#include <atomic>
+#include <stdlib.h>
+
+void expand_key_stream(uint8_t *out, size_t out_len, const uint8_t *key, size_t key_len) {
+    size_t filled = std::min(key_len, out_len);
+    memcpy(out, key, filled);
+    // Doubling copies keep the stream periodic in key_len without a modulo per byte.
+    while (filled < out_len) {
+        size_t n = std::min(filled, out_len - filled);
+        memcpy(out + filled, out, n);
+        filled += n;
+    }
+}
+
+void xor_stream(uint8_t *data, const uint8_t *stream, size_t len) {
+    active_kernels().xor_stream(data, stream, len);
+}
+
+void rotate_bytes_up(uint8_t *data, size_t len, size_t k) {
+    if (len == 0) return;
+    k %= len;
+    if (k == 0) return;
+    uint8_t tmp[256];
+    if (k <= sizeof(tmp)) {
+        memcpy(tmp, data + len - k, k);
+        memmove(data + k, data, len - k);
+        memcpy(data, tmp, k);
+    } else if (len - k <= sizeof(tmp)) {
+        memcpy(tmp, data, len - k);
+        memmove(data, data + len - k, k);
+        memcpy(data + k, tmp, len - k);
+    } else {
+        std::rotate(data, data + len - k, data + len);
+    }
+}
+
+void rotate_bytes_down(uint8_t *data, size_t len, size_t k) {
+    if (len == 0) return;
+    rotate_bytes_up(data, len, len - k % len);
+}
+
+KeyStream::KeyStream(const uint8_t *key, size_t key_len) : key_len_(key_len) {
+    period_ = key_len ? ((SUB_CHUNK_SIZE + key_len - 1) / key_len) * key_len : 0;
+    storage_.resize(period_ + 63);
+    stream_ = storage_.data() + ((64 - ((uintptr_t)storage_.data() & 63)) & 63);
+    expand_key_stream(stream_, period_, key, key_len);
+}
+
+bool KeyStream::matches(const uint8_t *key, size_t key_len) const {
+    return key_len == key_len_ && memcmp(stream_, key, key_len) == 0;
+}
+
+void KeyStream::apply(uint8_t *data, size_t len, size_t offset) const {
+    if (period_ == 0) return;
+    size_t pos = offset % period_;
+    while (len > 0) {
+        size_t n = std::min(len, period_ - pos);
+        xor_stream(data, stream_ + pos, n);
+        data += n;
+        len -= n;
+        pos = 0;
+    }
+}
+
+// Portable variant: the shared kernel bodies over plain 64-bit words.
+namespace {
+
+struct ScalarVec {
+    typedef uint64_t T;
+    static const size_t BYTES = 8;
+    static T load(const uint8_t *p) { return load_le64(p); }
+    static void store(uint8_t *p, T v) { store_le64(p, v); }
+    static T sll(T v, unsigned n) { return v << n; }
+    static T srl(T v, unsigned n) { return v >> n; }
+    static T bit_or(T a, T b) { return a | b; }
+    static T bit_xor(T a, T b) { return a ^ b; }
+};
+
+}  // namespace
+
+static const KernelSet kernels_scalar = make_kernel_set<ScalarVec>("scalar");
+
+// The SIMD variants live in their own translation units, each built with the
+// matching -m flags, and are only ever called after the CPU check below.
+#if KERNELS_X86
+extern const KernelSet kernels_sse2;
+extern const KernelSet kernels_avx2;
+extern const KernelSet kernels_avx512;
+#endif
+
+static bool cpu_supports(KernelIsa isa) {
+    switch (isa) {
+    case KERNEL_SCALAR:
+        return true;
+#if KERNELS_X86 && defined(__GNUC__)
+    // __builtin_cpu_supports also checks that the OS saves the wider registers.
+    case KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case KERNEL_AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+const KernelSet *kernel_set(KernelIsa isa) {
+    if (!cpu_supports(isa)) return nullptr;
+    switch (isa) {
+    case KERNEL_SCALAR:
+        return &kernels_scalar;
+#if KERNELS_X86
+    case KERNEL_SSE2:
+        return &kernels_sse2;
+    case KERNEL_AVX2:
+        return &kernels_avx2;
+    case KERNEL_AVX512:
+        return &kernels_avx512;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+static const KernelSet *best_kernels() {
+    for (int isa = KERNEL_ISA_COUNT - 1; isa > KERNEL_SCALAR; isa--) {
+        const KernelSet *set = kernel_set((KernelIsa)isa);
+        if (set) return set;
+    }
+    return &kernels_scalar;
+}
+
+static const KernelSet *find_kernels(const char *name) {
+    if (strcmp(name, "auto") == 0) return best_kernels();
+    for (int isa = 0; isa < KERNEL_ISA_COUNT; isa++) {
+        const KernelSet *set = kernel_set((KernelIsa)isa);
+        if (set && strcmp(set->name, name) == 0) return set;
+    }
+    return nullptr;
+}
+
+static std::atomic<const KernelSet*> &selected_kernels() {
+    static std::atomic<const KernelSet*> selected([] {
+        const char *forced = getenv("MYCRYPT_KERNEL");
+        const KernelSet *set = (forced && *forced) ? find_kernels(forced) : nullptr;
+        return set ? set : best_kernels();
+    }());
+    return selected;
+}
+
+const KernelSet &active_kernels() {
+    return *selected_kernels().load(std::memory_order_relaxed);
+}
+
+bool select_kernels(const char *name) {
+    const KernelSet *set = name ? find_kernels(name) : nullptr;
+    if (!set) return false;
+    selected_kernels().store(set, std::memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,23 @@
+// AVX2 kernel variant; built with -mavx2 and only called when the CPU has it.
+#include "kernel_impl.h"
+
+#if KERNELS_X86
+#include <immintrin.h>
+
+namespace {
+
+struct Avx2Vec {
+    typedef __m256i T;
+    static const size_t BYTES = 32;
+    static T load(const uint8_t *p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void store(uint8_t *p, T v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static T sll(T v, unsigned n) { return _mm256_sll_epi64(v, _mm_cvtsi32_si128((int)n)); }
+    static T srl(T v, unsigned n) { return _mm256_srl_epi64(v, _mm_cvtsi32_si128((int)n)); }
+    static T bit_or(T a, T b) { return _mm256_or_si256(a, b); }
+    static T bit_xor(T a, T b) { return _mm256_xor_si256(a, b); }
+};
+
+}  // namespace
+
+extern const KernelSet kernels_avx2 = make_kernel_set<Avx2Vec>("avx2");
+#endif
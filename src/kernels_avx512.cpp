@@ -0,0 +1,29 @@
+// AVX-512 kernel variant; built with -mavx512f and only called when the CPU has it.
+#include "kernel_impl.h"
+
+#if KERNELS_X86
+// GCC 12 warns about the deliberately undefined pass-through operand that
+// <immintrin.h> gives the AVX-512 shifts.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+
+namespace {
+
+struct Avx512Vec {
+    typedef __m512i T;
+    static const size_t BYTES = 64;
+    static T load(const uint8_t *p) { return _mm512_loadu_si512((const void*)p); }
+    static void store(uint8_t *p, T v) { _mm512_storeu_si512((void*)p, v); }
+    static T sll(T v, unsigned n) { return _mm512_sll_epi64(v, _mm_cvtsi32_si128((int)n)); }
+    static T srl(T v, unsigned n) { return _mm512_srl_epi64(v, _mm_cvtsi32_si128((int)n)); }
+    static T bit_or(T a, T b) { return _mm512_or_si512(a, b); }
+    static T bit_xor(T a, T b) { return _mm512_xor_si512(a, b); }
+};
+
+}  // namespace
+
+extern const KernelSet kernels_avx512 = make_kernel_set<Avx512Vec>("avx512");
+#endif
@@ -0,0 +1,23 @@
+// SSE2 kernel variant; built with -msse2.
+#include "kernel_impl.h"
+
+#if KERNELS_X86
+#include <immintrin.h>
+
+namespace {
+
+struct Sse2Vec {
+    typedef __m128i T;
+    static const size_t BYTES = 16;
+    static T load(const uint8_t *p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void store(uint8_t *p, T v) { _mm_storeu_si128((__m128i*)p, v); }
+    static T sll(T v, unsigned n) { return _mm_sll_epi64(v, _mm_cvtsi32_si128((int)n)); }
+    static T srl(T v, unsigned n) { return _mm_srl_epi64(v, _mm_cvtsi32_si128((int)n)); }
+    static T bit_or(T a, T b) { return _mm_or_si128(a, b); }
+    static T bit_xor(T a, T b) { return _mm_xor_si128(a, b); }
+};
+
+}  // namespace
+
+extern const KernelSet kernels_sse2 = make_kernel_set<Sse2Vec>("sse2");
+#endif
@@ -0,0 +1,127 @@
+#include "key_schedule.h"
+#include "encryption.h"
+
+KeySchedule::KeySchedule(const uint8_t *key, size_t key_len)
+    : key_(key, key + key_len), stream_(key, key_len) {
+    int n = active() ? key[(key[1] + key[2]) % (key_len - 5)] % 7 : 0;
+    for (int r = 0; r < MAX_ROUNDS; r++) shifts_[r] = (uint8_t)(1 + ((n + r) % 7));
+    if (!active()) return;
+    for (int count = rounds(0); count <= MAX_ROUNDS; count++) derive(full_[count], SUB_CHUNK_SIZE, count);
+}
+
+bool KeySchedule::matches(const uint8_t *key, size_t key_len) const {
+    return key_len == key_.size() && memcmp(key_.data(), key, key_len) == 0;
+}
+
+// Full sub-chunks take the fixed-size round kernels and other lengths the
+// fused variable-length ones; only buffers the key stream cannot cover (or too
+// short for the word kernels) go through the generic rotate and XOR.
+void KeySchedule::run_forward(uint8_t *data, size_t len, int count) const {
+    const KernelSet &kernels = active_kernels();
+    const uint8_t *ks = stream_.data();
+    if (len == SUB_CHUNK_SIZE) {
+        for (int r = 0; r < count; r++) kernels.round_forward[shifts_[r]](data, ks);
+    } else if (len > 8 && len <= stream_.period()) {
+        for (int r = 0; r < count; r++) kernels.rotl_xor(data, len, shifts_[r], ks);
+    } else {
+        for (int r = 0; r < count; r++) {
+            rotate_left(data, len, shifts_[r]);
+            stream_.apply(data, len);
+        }
+    }
+}
+
+void KeySchedule::run_reverse(uint8_t *data, size_t len, int count) const {
+    const KernelSet &kernels = active_kernels();
+    const uint8_t *ks = stream_.data();
+    if (len == SUB_CHUNK_SIZE) {
+        for (int r = count - 1; r >= 0; r--) kernels.round_reverse[shifts_[r]](data, ks);
+    } else if (len > 8 && len <= stream_.period()) {
+        for (int r = count - 1; r >= 0; r--) kernels.xor_rotr(data, len, shifts_[r], ks);
+    } else {
+        for (int r = count - 1; r >= 0; r--) {
+            stream_.apply(data, len);
+            rotate_right(data, len, shifts_[r]);
+        }
+    }
+}
+
+void KeySchedule::forward_rounds(uint8_t *data, size_t len, int iterat) const {
+    if (active()) run_forward(data, len, rounds(iterat));
+}
+
+void KeySchedule::reverse_rounds(uint8_t *data, size_t len, int iterat) const {
+    if (active()) run_reverse(data, len, rounds(iterat));
+}
+
+void KeySchedule::derive(ClosedForm &form, size_t len, int count) const {
+    size_t shift = 0;
+    for (int r = 0; r < count; r++) shift += shifts_[r];
+    form.len = len;
+    form.rounds = count;
+    form.shift = shift % (8 * len);
+    form.mask.assign(len, 0);
+    run_forward(form.mask.data(), len, count);
+}
+
+const KeySchedule::ClosedForm *KeySchedule::closed_form(size_t len, int count) const {
+    if (len == SUB_CHUNK_SIZE && !full_[count].mask.empty()) return &full_[count];
+    if (len > MAX_CACHED_LEN) return nullptr;
+    // Entries are never evicted, so a returned pointer stays valid for the
+    // schedule's lifetime and only the lookup needs the lock.
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    for (const std::unique_ptr<ClosedForm> &form : cache_) {
+        if (form->len == len && form->rounds == count) return form.get();
+    }
+    if (cache_.size() >= MAX_CACHED_FORMS) return nullptr;
+    std::unique_ptr<ClosedForm> form(new ClosedForm);
+    derive(*form, len, count);
+    cache_.push_back(std::move(form));
+    return cache_.back().get();
+}
+
+void KeySchedule::forward(uint8_t *data, size_t len, int iterat) const {
+    if (!active() || len == 0) return;
+    const ClosedForm *form = closed_form(len, rounds(iterat));
+    if (!form) {
+        run_forward(data, len, rounds(iterat));
+        return;
+    }
+    const uint8_t *mask = form->mask.data();
+    if (len <= 8) {
+        rotate_left(data, len, (int)form->shift);
+        for (size_t i = 0; i < len; i++) data[i] ^= mask[i];
+        return;
+    }
+    const KernelSet &kernels = active_kernels();
+    unsigned bits = form->shift % 8;
+    rotate_bytes_up(data, len, form->shift / 8);
+    if (bits) {
+        kernels.rotl_xor(data, len, bits, mask);
+    } else {
+        kernels.xor_stream(data, mask, len);
+    }
+}
+
+void KeySchedule::reverse(uint8_t *data, size_t len, int iterat) const {
+    if (!active() || len == 0) return;
+    const ClosedForm *form = closed_form(len, rounds(iterat));
+    if (!form) {
+        run_reverse(data, len, rounds(iterat));
+        return;
+    }
+    const uint8_t *mask = form->mask.data();
+    if (len <= 8) {
+        for (size_t i = 0; i < len; i++) data[i] ^= mask[i];
+        rotate_right(data, len, (int)form->shift);
+        return;
+    }
+    const KernelSet &kernels = active_kernels();
+    unsigned bits = form->shift % 8;
+    if (bits) {
+        kernels.xor_rotr(data, len, bits, mask);
+    } else {
+        kernels.xor_stream(data, mask, len);
+    }
+    rotate_bytes_down(data, len, form->shift / 8);
+}
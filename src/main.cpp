@@ -1,16 +1,260 @@
 #include "cli.h"
 #include "crypto.h"
 #include "encryption.h"
+#include "file_io.h"
+#include "kernels.h"
+#include "trace.h"
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+static void print_kernel_variants(void) {
+    printf("Available kernels: auto");
+    for (int isa = 0; isa < KERNEL_ISA_COUNT; isa++) {
+        const KernelSet *set = kernel_set((KernelIsa)isa);
+        if (set) printf(" %s", set->name);
+    }
+    printf(" (active: %s)\n", active_kernels().name);
+}
+
+static bool has_enc_suffix(const std::string &path) {
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".enc") == 0;
+}
+
+// Expands batch arguments into input paths. A directory contributes its
+// regular files in name order (only *.enc for decrypt, everything else for
+// encrypt), "@file" reads one path per line, and anything else is a path.
+static bool collect_batch_inputs(int argc, char *argv[], bool decrypt, std::vector<std::string> &inputs) {
+    namespace fs = std::filesystem;
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        std::error_code ec;
+        if (arg[0] == '@') {
+            std::ifstream list(arg.substr(1));
+            if (!list) {
+                printf("Cannot read file list: %s\n", arg.c_str() + 1);
+                return false;
+            }
+            std::string line;
+            while (std::getline(list, line)) {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (!line.empty()) inputs.push_back(line);
+            }
+        } else if (fs::is_directory(arg, ec)) {
+            std::vector<std::string> found;
+            for (const fs::directory_entry &entry : fs::directory_iterator(arg, ec)) {
+                if (!entry.is_regular_file(ec)) continue;
+                std::string path = entry.path().string();
+                if (has_enc_suffix(path) == decrypt) found.push_back(path);
+            }
+            if (ec) {
+                printf("Cannot read directory: %s\n", arg.c_str());
+                return false;
+            }
+            std::sort(found.begin(), found.end());
+            inputs.insert(inputs.end(), found.begin(), found.end());
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    return true;
+}
+
+// Parses a non-negative decimal byte count.
+static bool parse_byte_count(const char *text, uint64_t *value) {
+    if (!text || *text < '0' || *text > '9') return false;
+    char *end = NULL;
+    errno = 0;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (errno != 0 || *end != '\0') return false;
+    *value = n;
+    return true;
+}
+
+static void print_compression_stats(FILE *out, const CompressionOptions &compression) {
+    if (compression.codec == COMPRESS_STORE) {
+        fprintf(out, "Compression: off (store)\n");
+        return;
+    }
+    const CompressionStats &s = *compression.stats;
+    fprintf(out, "Compression: %llu chunks: %llu compressed, %llu skipped as incompressible, %llu not smaller\n",
+            (unsigned long long)s.chunks, (unsigned long long)s.chunks_compressed,
+            (unsigned long long)s.chunks_skipped, (unsigned long long)s.chunks_not_smaller);
+    fprintf(out, "  bytes: %llu in, %llu out (%.1f%%), %llu skipped\n", (unsigned long long)s.bytes_in,
+            (unsigned long long)s.bytes_out, s.bytes_in ? 100.0 * s.bytes_out / s.bytes_in : 100.0,
+            (unsigned long long)s.bytes_skipped);
+    fprintf(out, "  codec time %.1f ms, sampling %.1f ms, skipping saved ~%.1f ms\n", s.compress_ns / 1e6,
+            s.sample_ns / 1e6, estimated_skip_savings_ns(s) / 1e6);
+}
+
+static void print_compression_stats_json(FILE *out, const CompressionOptions &compression) {
+    std::string codec = format_compression(compression);
+    const CompressionStats &s = *compression.stats;
+    fprintf(out, "{\"codec\": \"%s\", \"chunks\": %llu, \"chunks_compressed\": %llu, \"chunks_skipped\": %llu, "
+                 "\"chunks_not_smaller\": %llu, \"bytes_in\": %llu, \"bytes_out\": %llu, \"bytes_skipped\": %llu, "
+                 "\"codec_ms\": %.3f, \"sample_ms\": %.3f}",
+            codec.empty() ? "store" : codec.c_str(), (unsigned long long)s.chunks,
+            (unsigned long long)s.chunks_compressed, (unsigned long long)s.chunks_skipped,
+            (unsigned long long)s.chunks_not_smaller, (unsigned long long)s.bytes_in,
+            (unsigned long long)s.bytes_out, (unsigned long long)s.bytes_skipped, s.compress_ns / 1e6,
+            s.sample_ns / 1e6);
+}
+
+// --stats report: the run's timings when the command measured them (run may
+// be NULL) and the compression stage of encrypts (compression NULL for decrypt).
+static void print_stats(FILE *out, int mode, const RunStats *run, const CompressionOptions *compression) {
+    if (mode == CLI_STATS_JSON) {
+        fprintf(out, "{\"run\": ");
+        if (run) {
+            print_run_stats_json(out, run);
+        } else {
+            fprintf(out, "null");
+        }
+        fprintf(out, ", \"compression\": ");
+        if (compression) {
+            print_compression_stats_json(out, *compression);
+        } else {
+            fprintf(out, "null");
+        }
+        fprintf(out, "}\n");
+        return;
+    }
+    if (run) print_run_stats(out, run);
+    if (compression) print_compression_stats(out, *compression);
+}
+
+// Writes the --trace file of a command that ran with tracing on.
+static void finish_trace(const CliOptions &opts) {
+    if (opts.trace && trace_stop(opts.trace) != 0) fprintf(stderr, "Cannot write trace: %s\n", opts.trace);
+}
+
+static const char *batch_status_text(int status) {
+    switch (status) {
+    case 0:
+        return "ok";
+    case -2:
+        return "wrong password";
+    default:
+        return "failed";
+    }
+}
+
+// encrypt-batch / decrypt-batch <password> <file|directory|@list>...
+static int run_batch_command(int argc, char *argv[], const CliOptions &opts, const CompressionOptions &compression) {
+    bool decrypt = strcmp(argv[1], "decrypt-batch") == 0;
+    if (argc < 4) {
+        printf("Usage: %s %s <password> <file|directory|@list>... [--output-dir=DIR]\n", argv[0], argv[1]);
+        return 1;
+    }
+    std::vector<std::string> inputs;
+    if (!collect_batch_inputs(argc - 3, argv + 3, decrypt, inputs)) return 1;
+    // A file named twice (say, in a directory and a list) is processed once,
+    // so no two tasks write the same output.
+    std::vector<std::string> unique;
+    for (const std::string &input : inputs) {
+        if (std::find(unique.begin(), unique.end(), input) == unique.end()) unique.push_back(input);
+    }
+    inputs.swap(unique);
+    if (inputs.empty()) {
+        printf("No input files\n");
+        return 1;
+    }
+
+    std::vector<std::string> outputs;
+    for (const std::string &input : inputs) {
+        std::string output = input;
+        if (opts.output_dir) {
+            output = (std::filesystem::path(opts.output_dir) / std::filesystem::path(input).filename()).string();
+        }
+        output += decrypt ? ".dec" : ".enc";
+        // Same-named files from different directories would race on one output.
+        std::vector<std::string>::iterator clash = std::find(outputs.begin(), outputs.end(), output);
+        if (clash != outputs.end()) {
+            printf("Output %s would be written for both %s and %s\n", output.c_str(),
+                   inputs[clash - outputs.begin()].c_str(), input.c_str());
+            return 1;
+        }
+        outputs.push_back(output);
+    }
+    std::vector<BatchEntry> entries(inputs.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        entries[i].input_file = inputs[i].c_str();
+        entries[i].output_file = outputs[i].c_str();
+        entries[i].status = 0;
+    }
+
+    const char *password = argv[2];
+    int failures = decrypt ? decrypt_files_batch(entries.data(), entries.size(), password)
+                           : encrypt_files_batch(entries.data(), entries.size(), password, 10, &compression);
+
+    for (const BatchEntry &entry : entries) {
+        printf("%-15s %s -> %s\n", batch_status_text(entry.status), entry.input_file, entry.output_file);
+    }
+    printf("%s: %zu files, %zu succeeded, %d failed\n", decrypt ? "Decrypted" : "Encrypted",
+           entries.size(), entries.size() - failures, failures);
+    if (opts.stats) print_stats(stdout, opts.stats, NULL, decrypt ? NULL : &compression);
+    return failures ? 1 : 0;
+}
 
 int main(int argc, char *argv[]) {
+    CliOptions opts;
+    argc = parse_options(argc, argv, &opts);
+    if (opts.kernel) {
+        if (strcmp(opts.kernel, "list") == 0) {
+            print_kernel_variants();
+            return 0;
+        }
+        if (!select_kernels(opts.kernel)) {
+            printf("Unsupported kernel: %s\n", opts.kernel);
+            print_kernel_variants();
+            return 1;
+        }
+    }
+    
+    if (opts.io) {
+        IoBackend backend;
+        if (parse_io_backend(opts.io, &backend) != 0) {
+            printf("Unsupported I/O backend: %s (mmap, buffered or direct)\n", opts.io);
+            return 1;
+        }
+        set_io_backend(backend);
+    }
+    
+    CompressionStats compression_stats = {};
+    CompressionOptions compression = {COMPRESS_STORE, 0, &compression_stats};
+    if (opts.compress && parse_compression(opts.compress, &compression) != 0) {
+        printf("Unsupported compression: %s (store, deflate[:1-9] or lzma[:0-9])\n", opts.compress);
+        return 1;
+    }
+    
     if (argc < 3) {
-        printf("Usage: %s <hash|encrypt|decrypt> <password|filepath> [password] [output_file]\n", argv[0]);
+        printf("Usage: %s [--kernel=NAME|list] <hash|encrypt|decrypt> <password|filepath> [password] [output_file]\n", argv[0]);
+        printf("       %s [--output-dir=DIR] [--compress=CODEC] <encrypt-batch|decrypt-batch> <password> <file|directory|@list>...\n", argv[0]);
         return 1;
     }
     
+    if (opts.trace) {
+        trace_set_thread_name("main");
+        trace_start();
+    }
+    
+    if (strcmp(argv[1], "encrypt-batch") == 0 || strcmp(argv[1], "decrypt-batch") == 0) {
+        int rc = run_batch_command(argc, argv, opts, compression);
+        finish_trace(opts);
+        return rc;
+    }
+    
     // Handle hash command
     if (strcmp(argv[1], "hash") == 0) {
         if (argc < 3) {
@@ -26,11 +270,13 @@ int main(int argc, char *argv[]) {
         }
         printf("Hash: %s\n", hash);
         free(hash);
+        finish_trace(opts);
         return 0;
     }
     
     if (argc < 4) {
-        printf("Usage: %s <encrypt|decrypt> <filepath> <password> [output_file]\n", argv[0]);
+        printf("Usage: %s [--format=zip|v2|stream] [--compress=store|deflate[:N]|lzma[:N]] [--io=mmap|buffered|direct] [--stats[=json]] [--trace FILE] <encrypt|decrypt> <filepath|-> <password> [output_file|-]\n", argv[0]);
+        printf("       %s [--offset=N] [--length=N] decrypt <filepath> <password> [output_file]\n", argv[0]);
         return 1;
     }
     
@@ -45,39 +291,119 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
-    char output_file[256];
+    // "-" reads stdin or writes stdout; piped data always uses the stream container.
+    bool encrypt = strcmp(args.command, "encrypt") == 0;
+    bool in_pipe = strcmp(args.filepath, "-") == 0;
+    std::string output_file;
     if (args.output_file) {
-        strcpy(output_file, args.output_file);
+        output_file = args.output_file;
+    } else if (in_pipe) {
+        output_file = "-";
     } else {
-        if (strcmp(args.command, "encrypt") == 0) {
-            snprintf(output_file, sizeof(output_file), "%s.enc", args.filepath);
-        } else {
-            snprintf(output_file, sizeof(output_file), "%s.dec", args.filepath);
+        output_file = std::string(args.filepath) + (encrypt ? ".enc" : ".dec");
+    }
+    bool out_pipe = output_file == "-";
+    // Status messages must not end up inside piped output.
+    FILE *msg = out_pipe ? stderr : stdout;
+    const char *shown_output = out_pipe ? "stdout" : output_file.c_str();
+    
+    // --offset/--length decrypt part of a file, reading only the chunks it spans.
+    bool range = opts.offset || opts.length;
+    uint64_t range_offset = 0, range_length = UINT64_MAX;
+    if (range) {
+        if ((opts.offset && !parse_byte_count(opts.offset, &range_offset)) ||
+            (opts.length && !parse_byte_count(opts.length, &range_length))) {
+            fprintf(msg, "Invalid --offset or --length: expected a byte count\n");
+            return 1;
+        }
+        if (encrypt || in_pipe || out_pipe || opts.format) {
+            fprintf(msg, "--offset and --length only apply to decrypting a ZIP or v2 file to a file\n");
+            return 1;
         }
     }
     
+    bool stream_format = in_pipe || out_pipe;
+    bool native_format = false;
+    if (opts.format) {
+        bool zip = strcmp(opts.format, "zip") == 0;
+        native_format = strcmp(opts.format, "v2") == 0;
+        if (strcmp(opts.format, "stream") == 0) {
+            stream_format = true;
+        } else if ((!zip && !native_format) || !encrypt) {
+            fprintf(msg, "Unsupported format: %s (encrypt takes zip, v2 or stream; decrypt detects it)\n", opts.format);
+            return 1;
+        } else if (stream_format) {
+            fprintf(msg, "%s archives need seekable files; use --format=stream with pipes\n", zip ? "ZIP" : "v2");
+            return 1;
+        }
+    }
+    
+    // Stream frames carry plaintext lengths only, so compressed chunks would
+    // not fit them; compression needs a ZIP or v2 archive.
+    if (compression.codec != COMPRESS_STORE && (stream_format || !encrypt)) {
+        fprintf(msg, "--compress applies to encrypting ZIP or v2 archives (decrypt detects the codec)\n");
+        return 1;
+    }
+    
+#ifdef _WIN32
+    if (in_pipe) _setmode(_fileno(stdin), _O_BINARY);
+    if (out_pipe) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    
+    // Only whole files are timed: pipes and --offset ranges report no run.
+    RunStats run_stats = {};
+    RunStats *run = NULL;
     int rc;
-    if (strcmp(args.command, "encrypt") == 0) {
-        rc = encrypt_file_advanced(args.filepath, output_file, args.password, 10);
+    if (encrypt) {
+        if (stream_format) {
+            rc = -1;
+            FILE *in = in_pipe ? stdin : fopen(args.filepath, "rb");
+            FILE *out = out_pipe ? stdout : (in ? fopen(output_file.c_str(), "wb") : NULL);
+            if (in && out) {
+                rc = encrypt_stream(in, out, in_pipe ? NULL : args.filepath, args.password, 10);
+            }
+            if (in && !in_pipe) fclose(in);
+            if (out && !out_pipe && fclose(out) != 0) rc = -1;
+        } else if (native_format) {
+            run = &run_stats;
+            rc = encrypt_file_v2(args.filepath, output_file.c_str(), args.password, 10, &compression, run);
+        } else {
+            run = &run_stats;
+            rc = encrypt_file_compressed(args.filepath, output_file.c_str(), args.password, 10, &compression, run);
+        }
         if (rc == 0) {
-            printf("File encrypted: %s\n", output_file);
+            fprintf(msg, "File encrypted: %s\n", shown_output);
+            if (opts.stats) print_stats(msg, opts.stats, run, &compression);
         } else {
-            printf("Encryption failed\n");
+            fprintf(msg, "Encryption failed\n");
+        }
+    } else {
+        if (stream_format) {
+            // A ZIP archive cannot be read from a pipe or decrypted to one;
+            // decrypt_stream rejects anything without the stream header.
+            rc = -1;
+            FILE *in = in_pipe ? stdin : fopen(args.filepath, "rb");
+            FILE *out = out_pipe ? stdout : (in ? fopen(output_file.c_str(), "wb") : NULL);
+            if (in && out) rc = decrypt_stream(in, out, args.password);
+            if (in && !in_pipe) fclose(in);
+            if (out && !out_pipe && fclose(out) != 0) rc = -1;
+        } else if (range) {
+            rc = decrypt_file_range(args.filepath, output_file.c_str(), args.password, range_offset, range_length);
+        } else {
+            run = &run_stats;
+            rc = decrypt_file_stats(args.filepath, output_file.c_str(), args.password, run);
         }
-    } else if (strcmp(args.command, "decrypt") == 0) {
-        rc = decrypt_file_advanced(args.filepath, output_file, args.password);
         if (rc == 0) {
-            printf("File decrypted: %s\n", output_file);
+            fprintf(msg, "File decrypted: %s\n", shown_output);
+            if (opts.stats) print_stats(msg, opts.stats, run, NULL);
         } else if (rc == -2) {
-            printf("Decryption failed: Wrong password\n");
+            fprintf(msg, "Decryption failed: Wrong password\n");
         } else {
-            printf("Decryption failed\n");
+            fprintf(msg, "Decryption failed\n");
         }
-    } else {
-        printf("Unknown command: %s\n", args.command);
-        return 1;
     }
     
+    finish_trace(opts);
     free_args(&args);
     return rc;
 }
@@ -0,0 +1,387 @@
+#include "native_container.h"
+#include "archive_reader.h"
+#include "async_io.h"
+#include "chunk_pipeline.h"
+#include "encryption.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+
+static const char NATIVE_INDEX_MAGIC[8] = {'M', 'C', 'R', 'Y', 'P', 'T', 'I', 'X'};
+
+// Fixed part of the header: magic, size, flags, chunk size, cost, plaintext size.
+static const size_t NATIVE_FIXED_HEADER_SIZE = 32;
+
+// Bounds on header fields, so a corrupt file cannot trigger huge allocations.
+static const size_t MAX_NATIVE_HEADER_SIZE = 256 * 1024;
+static const size_t MAX_NATIVE_CHUNK_SIZE = 64 * 1024 * 1024;
+
+static void put_le(std::vector<uint8_t> &out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+static void put_field(std::vector<uint8_t> &out, const std::string &value) {
+    put_le(out, value.size(), 2);
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+// Bounds-checked walk over the variable part of the header.
+struct FieldReader {
+    const uint8_t *p;
+    size_t left;
+
+    bool take(size_t len, const uint8_t *&out) {
+        if (len > left) return false;
+        out = p;
+        p += len;
+        left -= len;
+        return true;
+    }
+
+    bool field(std::string &value, int len_bytes) {
+        const uint8_t *len_ptr, *data;
+        if (!take(len_bytes, len_ptr)) return false;
+        size_t len = (size_t)get_le(len_ptr, len_bytes);
+        if (!take(len, data)) return false;
+        value.assign((const char*)data, len);
+        return true;
+    }
+};
+
+static std::vector<uint8_t> build_header(const NativeArchive &archive) {
+    std::vector<uint8_t> header(NATIVE_MAGIC, NATIVE_MAGIC + sizeof(NATIVE_MAGIC));
+    put_le(header, 0, 4);  // header size, patched below
+    put_le(header, (uint32_t)archive.compression.codec | (uint32_t)archive.compression.level << 8, 4);
+    put_le(header, archive.chunk_size, 4);
+    put_le(header, (uint32_t)archive.meta.cost, 4);
+    put_le(header, archive.plaintext_size, 8);
+    put_field(header, archive.meta.salt);
+    put_field(header, archive.meta.hash_verify);
+    put_field(header, archive.meta.filename);
+    put_le(header, archive.check.size(), 4);
+    header.insert(header.end(), archive.check.begin(), archive.check.end());
+    for (int i = 0; i < 4; i++) header[8 + i] = (uint8_t)(header.size() >> (8 * i));
+    return header;
+}
+
+static std::vector<uint8_t> build_index(const NativeArchive &archive, uint64_t index_offset) {
+    std::vector<uint8_t> index;
+    index.reserve(archive.chunks.size() * NATIVE_INDEX_ENTRY_SIZE + NATIVE_FOOTER_SIZE);
+    for (size_t i = 0; i < archive.chunks.size(); i++) {
+        put_le(index, archive.chunks[i].offset, 8);
+        put_le(index, archive.chunks[i].length, 8);
+        put_le(index, i, 8);
+        put_le(index, archive.chunks[i].flags, 4);
+        put_le(index, 0, 4);
+    }
+    put_le(index, index_offset, 8);
+    put_le(index, archive.chunks.size(), 8);
+    put_le(index, archive.plaintext_size, 8);
+    index.insert(index.end(), NATIVE_INDEX_MAGIC, NATIVE_INDEX_MAGIC + sizeof(NATIVE_INDEX_MAGIC));
+    return index;
+}
+
+bool open_native_archive(const InputFile &file, NativeArchive &archive) {
+    uint64_t file_size = file.size();
+    uint8_t fixed[NATIVE_FIXED_HEADER_SIZE];
+    if (file_size < NATIVE_FIXED_HEADER_SIZE + NATIVE_FOOTER_SIZE ||
+        !file.read_at(fixed, sizeof(fixed), 0) || memcmp(fixed, NATIVE_MAGIC, sizeof(NATIVE_MAGIC)) != 0) {
+        return false;
+    }
+    size_t header_size = (size_t)get_le(fixed + 8, 4);
+    uint32_t flags = (uint32_t)get_le(fixed + 12, 4);
+    archive.compression.codec = (CompressionCodec)(flags & 0xFF);
+    archive.compression.level = (int)(flags >> 8);
+    archive.chunk_size = (uint32_t)get_le(fixed + 16, 4);
+    archive.meta.cost = (int)get_le(fixed + 20, 4);
+    archive.plaintext_size = get_le(fixed + 24, 8);
+    if (header_size < NATIVE_FIXED_HEADER_SIZE || header_size > MAX_NATIVE_HEADER_SIZE ||
+        header_size + NATIVE_FOOTER_SIZE > file_size || archive.chunk_size > MAX_NATIVE_CHUNK_SIZE ||
+        (archive.chunk_size == 0 && archive.plaintext_size != 0) ||
+        archive.compression.codec > COMPRESS_LZMA || archive.compression.level > 9) {
+        return false;
+    }
+    // The metadata check covers the compression lines, as in a ZIP archive.
+    archive.meta.compression = format_compression(archive.compression);
+    archive.meta.size = archive.meta.compression.empty() ? 0 : archive.plaintext_size;
+
+    std::vector<uint8_t> header(header_size);
+    if (!file.read_at(header.data(), header_size, 0)) return false;
+    FieldReader fields = {header.data() + NATIVE_FIXED_HEADER_SIZE, header_size - NATIVE_FIXED_HEADER_SIZE};
+    std::string check;
+    if (!fields.field(archive.meta.salt, 2) || !fields.field(archive.meta.hash_verify, 2) ||
+        !fields.field(archive.meta.filename, 2) || !fields.field(check, 4)) {
+        return false;
+    }
+    archive.check.assign(check.begin(), check.end());
+
+    uint8_t footer[NATIVE_FOOTER_SIZE];
+    if (!file.read_at(footer, sizeof(footer), file_size - NATIVE_FOOTER_SIZE) ||
+        memcmp(footer + 24, NATIVE_INDEX_MAGIC, sizeof(NATIVE_INDEX_MAGIC)) != 0) {
+        return false;
+    }
+    uint64_t index_offset = get_le(footer, 8);
+    uint64_t count = get_le(footer + 8, 8);
+    uint64_t expected_count = archive.chunk_size
+        ? (archive.plaintext_size + archive.chunk_size - 1) / archive.chunk_size : 0;
+    if (get_le(footer + 16, 8) != archive.plaintext_size || count != expected_count ||
+        index_offset < header_size || index_offset > file_size - NATIVE_FOOTER_SIZE ||
+        (file_size - NATIVE_FOOTER_SIZE - index_offset) / NATIVE_INDEX_ENTRY_SIZE != count ||
+        (file_size - NATIVE_FOOTER_SIZE - index_offset) % NATIVE_INDEX_ENTRY_SIZE != 0) {
+        return false;
+    }
+
+    std::vector<uint8_t> index((size_t)count * NATIVE_INDEX_ENTRY_SIZE);
+    if (count && !file.read_at(index.data(), index.size(), index_offset)) return false;
+    archive.chunks.resize((size_t)count);
+    for (size_t i = 0; i < archive.chunks.size(); i++) {
+        const uint8_t *entry = index.data() + i * NATIVE_INDEX_ENTRY_SIZE;
+        NativeChunk &chunk = archive.chunks[i];
+        chunk.offset = get_le(entry, 8);
+        chunk.length = get_le(entry + 8, 8);
+        chunk.flags = (uint32_t)get_le(entry + 24, 4);
+        if (get_le(entry + 16, 8) != i || chunk.offset < header_size || chunk.length > index_offset ||
+            chunk.offset > index_offset - chunk.length) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int encrypt_file_v2(const char *input_file, const char *output_file, const char *password, int cost,
+                    const CompressionOptions *compression, RunStats *stats) {
+    RunRecorder recorder(stats);
+    RunRecorder *timing = stats ? &recorder : nullptr;
+    std::ifstream infile(input_file, std::ios::binary | std::ios::ate);
+    if (!infile) return -1;
+    uint64_t file_size = (uint64_t)infile.tellg();
+    infile.seekg(0);
+
+    NativeArchive archive;
+    if (compression) archive.compression = *compression;
+    archive.meta.filename = base_name(input_file);
+    archive.meta.compression = format_compression(archive.compression);
+    archive.meta.size = archive.meta.compression.empty() ? 0 : file_size;
+    std::string hashed_password;
+    {
+        PhaseTimer kdf(timing, PHASE_KDF);
+        if (!derive_new_key(password, cost, archive.meta, hashed_password)) return -1;
+    }
+    KeySchedule schedule((const uint8_t*)hashed_password.data(), hashed_password.size());
+    archive.check = encrypt_metadata(schedule, format_metadata(archive.meta));
+    archive.chunk_size = (uint32_t)get_chunk_size((size_t)file_size);
+    archive.plaintext_size = file_size;
+
+    // Chunks are stored unpadded in order. Without compression every offset
+    // is known up front and the whole archive can be preallocated; compressed
+    // chunks get theirs as they arrive and the file grows with the writes.
+    std::vector<uint8_t> header = build_header(archive);
+    size_t num_chunks = archive.chunk_size ? (size_t)((file_size + archive.chunk_size - 1) / archive.chunk_size) : 0;
+    archive.chunks.resize(num_chunks);
+    bool compress = archive.compression.codec != COMPRESS_STORE;
+    uint64_t preallocate = compress ? 0 : header.size() + file_size + num_chunks * NATIVE_INDEX_ENTRY_SIZE + NATIVE_FOOTER_SIZE;
+
+    // Everything is written front to back, so the direct backend can gather
+    // the archive into aligned blocks and keep several writes in flight.
+    OutputFile outfile;
+    std::unique_ptr<DirectWriter> direct = open_direct_output(output_file);
+    auto write = [&](const uint8_t *data, size_t len, uint64_t at, int64_t chunk) {
+        PhaseTimer timer(timing, PHASE_WRITE, len, chunk);
+        return direct ? direct->write(data, len) : outfile.write_at(data, len, (size_t)at);
+    };
+    bool ok = (direct || outfile.open(output_file, (size_t)preallocate)) &&
+              write(header.data(), header.size(), 0, -1);
+
+    uint64_t offset = header.size();
+    if (ok && num_chunks) {
+        ThreadPool &pool = ThreadPool::shared();
+        auto transform = [&](ChunkData &chunk, size_t group) {
+            transform_group(chunk.data.data(), chunk.data.size(), group, schedule, chunk.index, false);
+        };
+        InputFile mapped;
+        const uint8_t *plain = mapped.open(input_file) && mapped.map() ? mapped.data() : nullptr;
+        std::unique_ptr<DirectReadBuf> direct_buf = open_direct_input(input_file);
+        std::istream direct_in(direct_buf.get());
+        ChunkPipeline pipeline(direct_buf ? direct_in : infile, plain, (size_t)file_size, archive.chunk_size,
+                               pool.size() * PIPELINE_DEPTH_PER_THREAD, pool, transform,
+                               compress_stage(archive.compression), timing);
+        for (size_t i = 0; i < num_chunks && ok; i++) {
+            ChunkData *chunk = pipeline.acquire(i);
+            ok = chunk && write(chunk->data.data(), chunk->data.size(), offset, (int64_t)i);
+            if (chunk) {
+                archive.chunks[i].offset = offset;
+                archive.chunks[i].length = chunk->data.size();
+                archive.chunks[i].flags = chunk->flags;
+                offset += chunk->data.size();
+                pipeline.release(i);
+            }
+        }
+        if (ok && compression && compression->stats) {
+            merge_compression_stats(compression->stats, pipeline.compression_stats());
+        }
+    }
+
+    std::vector<uint8_t> index = build_index(archive, offset);
+    ok = ok && write(index.data(), index.size(), offset, -1);
+    PhaseTimer close(timing, PHASE_WRITE);
+    ok = (direct ? direct->close() : outfile.close()) && ok;
+    close.stop();
+    if (!ok) remove(output_file);
+    if (ok) recorder.finish(file_size, offset + index.size(), num_chunks, archive.chunk_size);
+    return ok ? 0 : -1;
+}
+
+// Checks a chunk's stored length against its flags: raw chunks hold exactly
+// their plaintext, compressed ones (only with a codec) something shorter.
+static bool native_chunk_valid(const NativeArchive &archive, size_t c) {
+    const NativeChunk &chunk = archive.chunks[c];
+    size_t plain = archive.chunk_plain_length(c);
+    if (chunk.flags == 0) return chunk.length == plain;
+    if (chunk.flags == CHUNK_INCOMPRESSIBLE) return archive.compression.codec != COMPRESS_STORE && chunk.length == plain;
+    return chunk.flags == CHUNK_COMPRESSED && archive.compression.codec != COMPRESS_STORE && chunk.length < plain;
+}
+
+int decrypt_native_file(const char *input_file, const char *output_file, const char *password,
+                        RunRecorder *recorder) {
+    InputFile infile;
+    NativeArchive archive;
+    if (!infile.open(input_file) || !open_native_archive(infile, archive)) return -1;
+
+    std::string hashed_password;
+    PhaseTimer kdf(recorder, PHASE_KDF);
+    int rc = derive_key(password, archive.meta, hashed_password);
+    kdf.stop();
+    if (rc != 0) return rc;
+    KeySchedule schedule((const uint8_t*)hashed_password.data(), hashed_password.size());
+    if (!metadata_matches(schedule, archive.check, format_metadata(archive.meta))) return -2;
+
+    OutputFile outfile;
+    if (!outfile.open(output_file, (size_t)archive.plaintext_size, true)) {
+        outfile.close();
+        remove(output_file);
+        return -1;
+    }
+    infile.map();
+    uint8_t *out = outfile.data();
+
+    // Workers claim chunks from a shared counter; each chunk is one positional
+    // read, one transform (and decompression) and one positional write.
+    ThreadPool &pool = ThreadPool::shared();
+    size_t num_chunks = archive.chunks.size();
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<bool> failed(false);
+    parallel_for(pool, std::min(pool.size(), num_chunks), [&](size_t) {
+        std::vector<uint8_t> buffer, plain;
+        for (size_t c = next_chunk++; c < num_chunks && !failed; c = next_chunk++) {
+            const NativeChunk &chunk = archive.chunks[c];
+            if (!native_chunk_valid(archive, c)) {
+                failed = true;
+                break;
+            }
+            // With a mapped output a raw chunk is read straight into its place
+            // in the file and decrypted there; write_at then has nothing to copy.
+            size_t plain_offset = c * archive.chunk_size;
+            bool compressed = (chunk.flags & CHUNK_COMPRESSED) != 0;
+            uint8_t *data = out && !compressed ? out + plain_offset : nullptr;
+            if (!data) {
+                buffer.resize((size_t)chunk.length);
+                data = buffer.data();
+            }
+            PhaseTimer read(recorder, PHASE_READ, chunk.length, (int64_t)c);
+            if (!infile.read_at(data, (size_t)chunk.length, chunk.offset)) {
+                failed = true;
+                break;
+            }
+            read.stop();
+            transform_chunk(data, (size_t)chunk.length, schedule, (int)c, true, recorder);
+            size_t length = (size_t)chunk.length;
+            if (compressed) {
+                length = archive.chunk_plain_length(c);
+                if (out) {
+                    data = out + plain_offset;
+                } else {
+                    plain.resize(length);
+                    data = plain.data();
+                }
+                PhaseTimer decompress(recorder, PHASE_COMPRESS, chunk.length, (int64_t)c);
+                if (!decompress_chunk(archive.compression.codec, buffer.data(), buffer.size(), data, length)) {
+                    failed = true;
+                    break;
+                }
+            }
+            PhaseTimer write(recorder, PHASE_WRITE, length, (int64_t)c);
+            if (!outfile.write_at(data, length, plain_offset)) {
+                failed = true;
+            }
+        }
+    });
+
+    PhaseTimer close(recorder, PHASE_WRITE);
+    bool ok = outfile.close() && !failed;
+    close.stop();
+    // As with ZIP, the output was created at full size before any chunk was
+    // checked, so a failed one would leave plaintext mixed with holes behind.
+    if (!ok) remove(output_file);
+    if (ok && recorder) {
+        recorder->finish(infile.size(), archive.plaintext_size, num_chunks, archive.chunk_size);
+    }
+    return ok ? 0 : -1;
+}
+
+// The transform keeps lengths, so in a raw chunk a stored offset is a
+// plaintext offset and every read is one pread.
+class NativeArchiveReader : public ArchiveReader {
+public:
+    NativeArchiveReader(NativeArchive archive, const std::string &key) : archive_(std::move(archive)) {
+        size_ = archive_.plaintext_size;
+        chunk_size_ = archive_.chunk_size;
+        codec_ = archive_.compression.codec;
+        schedule_.reset(new KeySchedule((const uint8_t*)key.data(), key.size()));
+    }
+
+    bool open(const char *path) { return file_.open(path); }
+
+    size_t stored_length(size_t chunk) const override { return (size_t)archive_.chunks[chunk].length; }
+
+    bool compressed(size_t chunk) const override { return (archive_.chunks[chunk].flags & CHUNK_COMPRESSED) != 0; }
+
+    bool read_stored(size_t chunk, size_t offset, size_t len, uint8_t *out) const override {
+        if (chunk >= archive_.chunks.size()) return false;
+        const NativeChunk &stored = archive_.chunks[chunk];
+        if (offset + len > stored.length) return false;
+        return file_.read_at(out, len, stored.offset + offset);
+    }
+
+private:
+    NativeArchive archive_;
+    InputFile file_;
+};
+
+int open_native_reader(const char *path, const char *password, std::unique_ptr<ArchiveReader> &reader) {
+    InputFile infile;
+    NativeArchive archive;
+    if (!infile.open(path) || !open_native_archive(infile, archive)) return -1;
+    infile.close();
+
+    std::string hashed_password;
+    int rc = derive_key(password, archive.meta, hashed_password);
+    if (rc != 0) return rc;
+    KeySchedule schedule((const uint8_t*)hashed_password.data(), hashed_password.size());
+    if (!metadata_matches(schedule, archive.check, format_metadata(archive.meta))) return -2;
+
+    for (size_t c = 0; c < archive.chunks.size(); c++) {
+        if (!native_chunk_valid(archive, c)) return -1;
+    }
+    std::unique_ptr<NativeArchiveReader> native(new NativeArchiveReader(std::move(archive), hashed_password));
+    if (!native->open(path)) return -1;
+    reader = std::move(native);
+    return 0;
+}
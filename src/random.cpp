@@ -0,0 +1,132 @@
+#include "random.h"
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <wincrypt.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+#endif
+
+static const size_t POOL_SIZE = 4096;
+// Requests this large gain nothing from the pool and would drain it.
+static const size_t DIRECT_THRESHOLD = POOL_SIZE / 4;
+
+#ifndef _WIN32
+static int read_urandom(uint8_t *buffer, size_t len) {
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0) return -1;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, buffer + done, len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    close(fd);
+    return done == len ? 0 : -1;
+}
+#endif
+
+// Straight from the OS, looping over short reads and interrupts.
+static int os_random(uint8_t *buffer, size_t len) {
+#ifdef _WIN32
+    static HCRYPTPROV provider = [] {
+        HCRYPTPROV p = 0;
+        if (!CryptAcquireContext(&p, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT)) p = 0;
+        return p;
+    }();
+    while (len > 0) {
+        DWORD n = len > 0x40000000 ? 0x40000000 : (DWORD)len;
+        if (!provider || !CryptGenRandom(provider, n, buffer)) return -1;
+        buffer += n;
+        len -= n;
+    }
+    return 0;
+#elif defined(__linux__)
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = getrandom(buffer + done, len - done, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Kernels before 3.17 have no getrandom.
+            if (errno == ENOSYS && done == 0) return read_urandom(buffer, len);
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+#else
+    return read_urandom(buffer, len);
+#endif
+}
+
+namespace {
+
+// Unused bytes sit at the end of bytes[]; handed-out bytes are wiped.
+struct RandomPool {
+    std::mutex mutex;
+    uint8_t bytes[POOL_SIZE];
+    size_t available = 0;
+
+    void discard() {
+        memset(bytes, 0, sizeof(bytes));
+        available = 0;
+    }
+};
+
+// Never destroyed, so threads still running during exit can use it.
+RandomPool &pool() {
+    static RandomPool *instance = [] {
+        RandomPool *p = new RandomPool();
+#ifndef _WIN32
+        // Hold the lock across fork() so the child never sees a half-updated
+        // pool, then drop the child's copy of the unused bytes.
+        pthread_atfork([] { pool().mutex.lock(); },
+                       [] { pool().mutex.unlock(); },
+                       [] {
+                           pool().discard();
+                           pool().mutex.unlock();
+                       });
+#endif
+        return p;
+    }();
+    return *instance;
+}
+
+}  // namespace
+
+int random_bytes(uint8_t *buffer, size_t len) {
+    if (len == 0) return 0;
+    int rc = 0;
+    if (len >= DIRECT_THRESHOLD) {
+        rc = os_random(buffer, len);
+    } else {
+        RandomPool &p = pool();
+        std::lock_guard<std::mutex> lock(p.mutex);
+        size_t done = 0;
+        while (done < len && rc == 0) {
+            if (p.available == 0) {
+                rc = os_random(p.bytes, POOL_SIZE);
+                if (rc != 0) break;
+                p.available = POOL_SIZE;
+            }
+            size_t n = std::min(len - done, p.available);
+            uint8_t *src = p.bytes + POOL_SIZE - p.available;
+            memcpy(buffer + done, src, n);
+            memset(src, 0, n);
+            p.available -= n;
+            done += n;
+        }
+    }
+    if (rc != 0) memset(buffer, 0, len);
+    return rc;
+}
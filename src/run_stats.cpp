@@ -0,0 +1,169 @@
+#include "run_stats.h"
+#include "thread_pool.h"
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+static const char *const PHASE_NAMES[PHASE_COUNT] = {"kdf", "read", "compress", "transform", "write"};
+
+#ifdef _WIN32
+static uint64_t filetime_ns(const FILETIME &t) {
+    return (((uint64_t)t.dwHighDateTime << 32) | t.dwLowDateTime) * 100;
+}
+#endif
+
+uint64_t thread_cpu_ns() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0;
+    return filetime_ns(kernel) + filetime_ns(user);
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static uint64_t process_cpu_ns() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0;
+    return filetime_ns(kernel) + filetime_ns(user);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return ((uint64_t)usage.ru_utime.tv_sec + (uint64_t)usage.ru_stime.tv_sec) * 1000000000ULL +
+           ((uint64_t)usage.ru_utime.tv_usec + (uint64_t)usage.ru_stime.tv_usec) * 1000ULL;
+#endif
+}
+
+static uint64_t peak_rss_bytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return (uint64_t)counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;          // bytes
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;   // kilobytes
+#endif
+#endif
+}
+
+static uint64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+RunRecorder::RunRecorder(RunStats *out)
+    : out_(out), start_ns_(steady_ns()), start_cpu_ns_(out ? process_cpu_ns() : 0) {
+    for (Phase &phase : phases_) {
+        phase.first_start = UINT64_MAX;
+        phase.last_end = 0;
+        phase.busy_ns = 0;
+        phase.cpu_ns = 0;
+        phase.bytes = 0;
+    }
+}
+
+uint64_t RunRecorder::now_ns() const {
+    return steady_ns() - start_ns_;
+}
+
+void RunRecorder::record(RunPhase phase, uint64_t start_ns, uint64_t end_ns, uint64_t cpu_ns, uint64_t bytes) {
+    if (!out_) return;
+    Phase &p = phases_[phase];
+    uint64_t first = p.first_start.load(std::memory_order_relaxed);
+    while (start_ns < first && !p.first_start.compare_exchange_weak(first, start_ns, std::memory_order_relaxed)) {}
+    uint64_t last = p.last_end.load(std::memory_order_relaxed);
+    while (end_ns > last && !p.last_end.compare_exchange_weak(last, end_ns, std::memory_order_relaxed)) {}
+    p.busy_ns.fetch_add(end_ns - start_ns, std::memory_order_relaxed);
+    p.cpu_ns.fetch_add(cpu_ns, std::memory_order_relaxed);
+    p.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void RunRecorder::discount(RunPhase phase, uint64_t busy_ns, uint64_t cpu_ns) {
+    if (!out_) return;
+    phases_[phase].busy_ns.fetch_sub(busy_ns, std::memory_order_relaxed);
+    phases_[phase].cpu_ns.fetch_sub(cpu_ns, std::memory_order_relaxed);
+}
+
+void RunRecorder::add_bytes(RunPhase phase, uint64_t bytes) {
+    if (out_) phases_[phase].bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void RunRecorder::finish(uint64_t bytes_in, uint64_t bytes_out, uint64_t chunks, uint64_t chunk_size) {
+    if (!out_) return;
+    *out_ = RunStats();
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const Phase &p = phases_[i];
+        PhaseStats &s = out_->phases[i];
+        uint64_t first = p.first_start.load(), last = p.last_end.load();
+        s.wall_ns = last > first ? last - first : 0;
+        // Discounts are nested inside spans of their phase, so the sums end up
+        // non-negative; clamp in case clock granularity says otherwise.
+        uint64_t busy = p.busy_ns.load(), cpu = p.cpu_ns.load();
+        s.busy_ns = (int64_t)busy < 0 ? 0 : busy;
+        s.cpu_ns = (int64_t)cpu < 0 ? 0 : cpu;
+        s.bytes = p.bytes.load();
+    }
+    out_->wall_ns = now_ns();
+    out_->cpu_ns = process_cpu_ns() - start_cpu_ns_;
+    out_->bytes_in = bytes_in;
+    out_->bytes_out = bytes_out;
+    out_->chunks = chunks;
+    out_->chunk_size = chunk_size;
+    out_->threads = (uint32_t)ThreadPool::shared().size();
+    out_->peak_rss_bytes = peak_rss_bytes();
+}
+
+const char *run_phase_name(RunPhase phase) {
+    return phase >= 0 && phase < PHASE_COUNT ? PHASE_NAMES[phase] : "unknown";
+}
+
+double phase_mbps(const PhaseStats *phase) {
+    if (!phase->bytes || !phase->busy_ns) return 0;
+    return phase->bytes / (1024.0 * 1024.0) / (phase->busy_ns / 1e9);
+}
+
+static double mbps(uint64_t bytes, uint64_t ns) {
+    return ns ? bytes / (1024.0 * 1024.0) / (ns / 1e9) : 0;
+}
+
+void print_run_stats(FILE *out, const RunStats *s) {
+    fprintf(out, "Run: %.1f ms wall, %.1f ms CPU, %u threads, peak RSS %.1f MB\n", s->wall_ns / 1e6,
+            s->cpu_ns / 1e6, s->threads, s->peak_rss_bytes / (1024.0 * 1024.0));
+    fprintf(out, "  bytes: %llu in, %llu out (%.1f MB/s in), %llu chunks of %llu bytes\n",
+            (unsigned long long)s->bytes_in, (unsigned long long)s->bytes_out, mbps(s->bytes_in, s->wall_ns),
+            (unsigned long long)s->chunks, (unsigned long long)s->chunk_size);
+    fprintf(out, "  %-10s %10s %10s %10s %14s %10s\n", "phase", "wall ms", "busy ms", "cpu ms", "bytes", "MB/s");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const PhaseStats &p = s->phases[i];
+        fprintf(out, "  %-10s %10.1f %10.1f %10.1f %14llu %10.1f\n", run_phase_name((RunPhase)i), p.wall_ns / 1e6,
+                p.busy_ns / 1e6, p.cpu_ns / 1e6, (unsigned long long)p.bytes, phase_mbps(&p));
+    }
+}
+
+void print_run_stats_json(FILE *out, const RunStats *s) {
+    fprintf(out, "{\"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"bytes_in\": %llu, \"bytes_out\": %llu, "
+                 "\"chunks\": %llu, \"chunk_size\": %llu, \"threads\": %u, \"peak_rss_bytes\": %llu, \"phases\": {",
+            s->wall_ns / 1e6, s->cpu_ns / 1e6, (unsigned long long)s->bytes_in, (unsigned long long)s->bytes_out,
+            (unsigned long long)s->chunks, (unsigned long long)s->chunk_size, s->threads,
+            (unsigned long long)s->peak_rss_bytes);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const PhaseStats &p = s->phases[i];
+        fprintf(out, "%s\"%s\": {\"wall_ms\": %.3f, \"busy_ms\": %.3f, \"cpu_ms\": %.3f, \"bytes\": %llu, \"mbps\": %.3f}",
+                i ? ", " : "", run_phase_name((RunPhase)i), p.wall_ns / 1e6, p.busy_ns / 1e6, p.cpu_ns / 1e6,
+                (unsigned long long)p.bytes, phase_mbps(&p));
+    }
+    fprintf(out, "}}");
+}
@@ -0,0 +1,223 @@
+#include "container.h"
+#include "encryption.h"
+#include "file_io.h"
+#include "thread_pool.h"
+#include <string.h>
+
+// Stream container layout, all integers little-endian:
+//
+//   header   "MCRYPTS1" | u32 chunk_size
+//            | u32 len | metadata text (as in filedata.crypt)
+//            | u32 len | encrypted metadata (as in filedata_enc.crypt)
+//   frames   u32 len (1..chunk_size) | chunk data, transformed with iterat =
+//            frame number; every frame but the last holds chunk_size bytes
+//   trailer  u32 0 | u64 frame count | u64 plaintext bytes | "MCRYPTSE"
+//
+// The trailer lets decrypt tell a complete stream from a truncated one.
+
+static const char STREAM_END_MAGIC[8] = {'M', 'C', 'R', 'Y', 'P', 'T', 'S', 'E'};
+
+// Input is read in chunks of this size, since its total length is unknown.
+static const size_t STREAM_CHUNK_SIZE = 512 * 1024;
+
+// Bounds on header fields, so a corrupt header cannot trigger huge allocations.
+static const size_t MAX_STREAM_CHUNK_SIZE = 64 * 1024 * 1024;
+static const size_t MAX_METADATA_SIZE = 64 * 1024;
+
+static bool write_bytes(FILE *out, const void *data, size_t len) {
+    return fwrite(data, 1, len, out) == len;
+}
+
+static bool write_u32(FILE *out, uint32_t v) {
+    uint8_t b[4];
+    for (int i = 0; i < 4; i++) b[i] = (uint8_t)(v >> (8 * i));
+    return write_bytes(out, b, 4);
+}
+
+static bool write_u64(FILE *out, uint64_t v) {
+    uint8_t b[8];
+    for (int i = 0; i < 8; i++) b[i] = (uint8_t)(v >> (8 * i));
+    return write_bytes(out, b, 8);
+}
+
+static bool read_bytes(FILE *in, void *data, size_t len) {
+    return fread(data, 1, len, in) == len;
+}
+
+static bool read_u32(FILE *in, uint32_t &v) {
+    uint8_t b[4];
+    if (!read_bytes(in, b, 4)) return false;
+    v = 0;
+    for (int i = 0; i < 4; i++) v |= (uint32_t)b[i] << (8 * i);
+    return true;
+}
+
+static bool read_u64(FILE *in, uint64_t &v) {
+    uint8_t b[8];
+    if (!read_bytes(in, b, 8)) return false;
+    v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)b[i] << (8 * i);
+    return true;
+}
+
+// Reads a u32 length and that many bytes, at most max_len.
+static bool read_block(FILE *in, std::vector<uint8_t> &data, size_t max_len) {
+    uint32_t len;
+    if (!read_u32(in, len) || len > max_len) return false;
+    data.resize(len);
+    return read_bytes(in, data.data(), len);
+}
+
+// One chunk per pool worker is read, transformed in parallel and written in
+// order before the next batch is read, so memory stays at
+// workers * chunk_size however long the stream is.
+static size_t stream_batch_size() {
+    return ThreadPool::shared().size();
+}
+
+int encrypt_stream(FILE *in, FILE *out, const char *name, const char *password, int cost) {
+    ContainerMetadata meta;
+    meta.filename = name ? name : "-";
+    std::string hashed_password;
+    if (!derive_new_key(password, cost, meta, hashed_password)) return -1;
+    
+    KeySchedule schedule((const uint8_t*)hashed_password.data(), hashed_password.size());
+    std::string metadata_str = format_metadata(meta);
+    std::vector<uint8_t> metadata_enc = encrypt_metadata(schedule, metadata_str);
+    
+    bool ok = write_bytes(out, STREAM_MAGIC, sizeof(STREAM_MAGIC)) &&
+              write_u32(out, (uint32_t)STREAM_CHUNK_SIZE) &&
+              write_u32(out, (uint32_t)metadata_str.size()) &&
+              write_bytes(out, metadata_str.data(), metadata_str.size()) &&
+              write_u32(out, (uint32_t)metadata_enc.size()) &&
+              write_bytes(out, metadata_enc.data(), metadata_enc.size());
+    
+    std::vector<std::vector<uint8_t>> chunks(stream_batch_size());
+    uint64_t frames = 0, total = 0;
+    bool eof = false;
+    while (ok && !eof) {
+        size_t filled = 0;
+        while (filled < chunks.size() && !eof) {
+            std::vector<uint8_t> &chunk = chunks[filled];
+            chunk.resize(STREAM_CHUNK_SIZE);
+            size_t n = fread(chunk.data(), 1, chunk.size(), in);
+            if (n < chunk.size()) {
+                if (ferror(in)) return -1;
+                eof = true;
+            }
+            if (n == 0) break;
+            chunk.resize(n);
+            filled++;
+        }
+        parallel_for(ThreadPool::shared(), filled, [&](size_t c) {
+            transform_chunk(chunks[c].data(), chunks[c].size(), schedule, (int)(frames + c), false);
+        });
+        for (size_t c = 0; c < filled && ok; c++) {
+            ok = write_u32(out, (uint32_t)chunks[c].size()) && write_bytes(out, chunks[c].data(), chunks[c].size());
+            total += chunks[c].size();
+        }
+        frames += filled;
+    }
+    
+    ok = ok && write_u32(out, 0) && write_u64(out, frames) && write_u64(out, total) &&
+         write_bytes(out, STREAM_END_MAGIC, sizeof(STREAM_END_MAGIC));
+    ok = fflush(out) == 0 && ok;
+    return ok ? 0 : -1;
+}
+
+// decrypt_stream, timing its phases into recorder when there is one and
+// counting the frames it decrypted.
+static int decrypt_stream_timed(FILE *in, FILE *out, const char *password, RunRecorder *recorder,
+                                uint64_t *frame_count, uint32_t *frame_size) {
+    char magic[sizeof(STREAM_MAGIC)];
+    uint32_t chunk_size;
+    std::vector<uint8_t> metadata_buf, metadata_enc;
+    if (!read_bytes(in, magic, sizeof(magic)) || memcmp(magic, STREAM_MAGIC, sizeof(magic)) != 0) return -1;
+    if (!read_u32(in, chunk_size) || chunk_size == 0 || chunk_size > MAX_STREAM_CHUNK_SIZE) return -1;
+    if (!read_block(in, metadata_buf, MAX_METADATA_SIZE) || !read_block(in, metadata_enc, MAX_METADATA_SIZE)) {
+        return -1;
+    }
+    
+    std::string metadata_str(metadata_buf.begin(), metadata_buf.end());
+    ContainerMetadata meta;
+    if (!parse_metadata(metadata_str, meta)) return -1;
+    
+    std::string hashed_password;
+    PhaseTimer kdf(recorder, PHASE_KDF);
+    int rc = derive_key(password, meta, hashed_password);
+    kdf.stop();
+    if (rc != 0) return rc;
+    
+    KeySchedule schedule((const uint8_t*)hashed_password.data(), hashed_password.size());
+    if (!metadata_matches(schedule, metadata_enc, metadata_str)) return -2;
+    
+    std::vector<std::vector<uint8_t>> chunks(stream_batch_size());
+    uint64_t frames = 0, total = 0;
+    bool end = false;
+    while (!end) {
+        size_t filled = 0;
+        while (filled < chunks.size()) {
+            uint32_t len;
+            if (!read_u32(in, len) || len > chunk_size) return -1;
+            if (len == 0) {
+                end = true;
+                break;
+            }
+            chunks[filled].resize(len);
+            PhaseTimer read(recorder, PHASE_READ, len, (int64_t)(frames + filled));
+            if (!read_bytes(in, chunks[filled].data(), len)) return -1;
+            filled++;
+        }
+        parallel_for(ThreadPool::shared(), filled, [&](size_t c) {
+            transform_chunk(chunks[c].data(), chunks[c].size(), schedule, (int)(frames + c), true, recorder);
+        });
+        for (size_t c = 0; c < filled; c++) {
+            PhaseTimer write(recorder, PHASE_WRITE, chunks[c].size(), (int64_t)(frames + c));
+            if (!write_bytes(out, chunks[c].data(), chunks[c].size())) return -1;
+            total += chunks[c].size();
+        }
+        frames += filled;
+    }
+    if (frame_count) *frame_count = frames;
+    if (frame_size) *frame_size = chunk_size;
+    
+    uint64_t expected_frames, expected_total;
+    char end_magic[sizeof(STREAM_END_MAGIC)];
+    if (!read_u64(in, expected_frames) || !read_u64(in, expected_total) ||
+        !read_bytes(in, end_magic, sizeof(end_magic)) ||
+        memcmp(end_magic, STREAM_END_MAGIC, sizeof(end_magic)) != 0 ||
+        expected_frames != frames || expected_total != total) {
+        return -1;
+    }
+    PhaseTimer flush(recorder, PHASE_WRITE);
+    return fflush(out) == 0 ? 0 : -1;
+}
+
+int decrypt_stream(FILE *in, FILE *out, const char *password) {
+    return decrypt_stream_timed(in, out, password, nullptr, NULL, NULL);
+}
+
+int decrypt_stream_file(const char *input_file, const char *output_file, const char *password,
+                        RunRecorder *recorder) {
+    FILE *in = fopen(input_file, "rb");
+    if (!in) return -1;
+    FILE *out = fopen(output_file, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+    uint64_t frames = 0;
+    uint32_t frame_size = 0;
+    int rc = decrypt_stream_timed(in, out, password, recorder, &frames, &frame_size);
+    fclose(in);
+    PhaseTimer close(recorder, PHASE_WRITE);
+    if (fclose(out) != 0 && rc == 0) rc = -1;
+    close.stop();
+    // As with ZIP and v2 archives, a wrong password or a broken stream leaves
+    // no output behind.
+    if (rc != 0) remove(output_file);
+    if (rc == 0 && recorder) {
+        recorder->finish(file_size_of(input_file), file_size_of(output_file), frames, frame_size);
+    }
+    return rc;
+}
@@ -0,0 +1,146 @@
+#include "thread_pool.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+
+// Index of the pool worker running on this thread, or -1 for outside threads.
+static thread_local const ThreadPool *current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+ThreadPool::ThreadPool(size_t num_threads) : pending_(0), next_queue_(0), stop_(false) {
+    if (num_threads == 0) num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0) num_threads = 2;
+    for (size_t i = 0; i < num_threads; i++) {
+        queues_.emplace_back(new Queue());
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        workers_.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+    sleep_cv_.notify_all();
+    for (auto &t : workers_) {
+        if (t.joinable()) t.join();
+    }
+}
+
+ThreadPool &ThreadPool::shared() {
+    static ThreadPool pool([] {
+        const char *threads = getenv("MYCRYPT_THREADS");
+        return threads ? (size_t)strtoul(threads, NULL, 10) : 0;
+    }());
+    return pool;
+}
+
+void ThreadPool::submit(Task task) {
+    // Workers keep their own spawned tasks local; outside threads spread round-robin.
+    size_t target = (current_pool == this) ? current_worker
+                                           : next_queue_.fetch_add(1) % queues_.size();
+    {
+        std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+        queues_[target]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        pending_++;
+    }
+    sleep_cv_.notify_one();
+}
+
+bool ThreadPool::pop_task(size_t id, Task &task) {
+    {
+        Queue &own = *queues_[id];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            pending_--;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues_.size(); i++) {
+        Queue &victim = *queues_[(id + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            pending_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::run_pending() {
+    Task task;
+    size_t id = (current_pool == this) ? current_worker
+                                       : next_queue_.load() % queues_.size();
+    if (!pop_task(id, task)) return false;
+    task();
+    return true;
+}
+
+void ThreadPool::worker_loop(size_t id) {
+    current_pool = this;
+    current_worker = id;
+    trace_set_thread_name(("pool worker " + std::to_string(id)).c_str());
+    for (;;) {
+        Task task;
+        if (pop_task(id, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        sleep_cv_.wait(lock, [&] { return stop_ || pending_ > 0; });
+        if (stop_ && pending_ <= 0) return;
+    }
+}
+
+TaskGroup::TaskGroup(ThreadPool &pool) : pool_(pool), remaining_(0) {}
+
+TaskGroup::~TaskGroup() {
+    wait();
+}
+
+void TaskGroup::run(ThreadPool::Task task) {
+    remaining_++;
+    pool_.submit([this, task = std::move(task)]() {
+        task();
+        // Decrement under the lock so wait() cannot return, and the group be
+        // destroyed, while this task still touches it.
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--remaining_ == 0) cv_.notify_all();
+    });
+}
+
+void TaskGroup::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (remaining_ > 0) {
+        lock.unlock();
+        bool ran = pool_.run_pending();
+        lock.lock();
+        // Short timed wait: a task this group depends on may be queued behind
+        // another waiter, so keep polling the pool instead of sleeping forever.
+        if (!ran) cv_.wait_for(lock, std::chrono::milliseconds(1), [&] { return remaining_ == 0; });
+    }
+}
+
+void parallel_for(ThreadPool &pool, size_t count, const std::function<void(size_t)> &fn) {
+    if (count == 0) return;
+    if (count == 1) {
+        fn(0);
+        return;
+    }
+    TaskGroup group(pool);
+    for (size_t i = 1; i < count; i++) {
+        group.run([&fn, i]() { fn(i); });
+    }
+    fn(0);
+    group.wait();
+}
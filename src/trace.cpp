@@ -0,0 +1,121 @@
+#include "trace.h"
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+std::atomic<bool> trace_on(false);
+
+struct TraceEvent {
+    uint64_t ts_ns;
+    const char *name;
+    const char *arg_name;
+    int64_t arg;
+    char phase;
+};
+
+// One per thread that has recorded an event. Only its own thread appends to
+// it; the registry lock is taken once per thread, to add the buffer.
+struct ThreadBuffer {
+    uint32_t tid;
+    std::string name;
+    std::vector<TraceEvent> events;
+};
+
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    uint64_t start_ns = 0;
+};
+
+// Never destroyed, so threads still running at exit can use their buffers.
+static TraceRegistry &registry() {
+    static TraceRegistry *instance = new TraceRegistry();
+    return *instance;
+}
+
+static thread_local ThreadBuffer *local_buffer = nullptr;
+static thread_local std::string local_name;
+
+static uint64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ThreadBuffer *thread_buffer() {
+    if (!local_buffer) {
+        TraceRegistry &reg = registry();
+        std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+        buffer->name = local_name;
+        buffer->events.reserve(4096);
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        buffer->tid = (uint32_t)reg.buffers.size() + 1;
+        local_buffer = buffer.get();
+        reg.buffers.push_back(std::move(buffer));
+    }
+    return local_buffer;
+}
+
+void trace_event(char phase, const char *name, const char *arg_name, int64_t arg) {
+    TraceEvent event;
+    event.ts_ns = steady_ns();
+    event.name = name;
+    event.arg_name = arg_name;
+    event.arg = arg;
+    event.phase = phase;
+    thread_buffer()->events.push_back(event);
+}
+
+void trace_set_thread_name(const char *name) {
+    local_name = name;
+    if (local_buffer) local_buffer->name = name;
+}
+
+void trace_start(void) {
+    TraceRegistry &reg = registry();
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (auto &buffer : reg.buffers) buffer->events.clear();
+        reg.start_ns = steady_ns();
+    }
+    trace_on.store(true, std::memory_order_relaxed);
+}
+
+static void write_string(FILE *out, const std::string &text) {
+    fputc('"', out);
+    for (char c : text) {
+        if (c == '"' || c == '\\') fputc('\\', out);
+        if ((unsigned char)c >= 0x20) fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+int trace_stop(const char *path) {
+    trace_on.store(false, std::memory_order_relaxed);
+    TraceRegistry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    FILE *out = fopen(path, "w");
+    if (!out) return -1;
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    bool first = true;
+    for (const auto &buffer : reg.buffers) {
+        if (buffer->events.empty()) continue;
+        fprintf(out, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": ",
+                first ? "" : ",", buffer->tid);
+        write_string(out, buffer->name.empty() ? "thread " + std::to_string(buffer->tid) : buffer->name);
+        fprintf(out, "}}");
+        first = false;
+        for (const TraceEvent &e : buffer->events) {
+            double ts_us = (e.ts_ns - reg.start_ns) / 1000.0;
+            fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"mycrypt\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u",
+                    e.name, e.phase, ts_us, buffer->tid);
+            if (e.arg_name) fprintf(out, ", \"args\": {\"%s\": %lld}", e.arg_name, (long long)e.arg);
+            fprintf(out, "}");
+        }
+        buffer->events.clear();
+    }
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0 ? 0 : -1;
+}
@@ -508,9 +508,178 @@ else
     ((FAILED++))
 fi
 
+# Test 31: Stream container through pipes
+echo "Test 31: Encrypt and decrypt through stdin/stdout"
+head -c 700000 /dev/urandom > test_pipe.bin
+if cat test_pipe.bin | $EXE encrypt - pass 2>/dev/null | $EXE decrypt - pass 2>/dev/null > test_pipe_dec.bin \
+    && cmp -s test_pipe.bin test_pipe_dec.bin; then
+    echo "[PASS] Pipe round trip works"
+    ((PASSED++))
+else
+    echo "[FAIL] Pipe round trip failed"
+    ((FAILED++))
+fi
+
+# Test 32: Stream container written to a file decrypts by auto-detection
+echo "Test 32: Stream container file with auto-detecting decrypt"
+if $EXE encrypt - pass test_pipe.enc < test_pipe.bin > /dev/null 2>&1 \
+    && $EXE decrypt test_pipe.enc pass test_pipe_dec2.bin > /dev/null 2>&1 \
+    && cmp -s test_pipe.bin test_pipe_dec2.bin; then
+    echo "[PASS] Stream file decrypts"
+    ((PASSED++))
+else
+    echo "[FAIL] Stream file decrypt failed"
+    ((FAILED++))
+fi
+
+# Test 33: Decrypt a byte range without the rest of the file
+echo "Test 33: Range decrypt with --offset and --length"
+if $EXE --format=v2 encrypt test_pipe.bin pass test_range.enc > /dev/null 2>&1 \
+    && $EXE --offset=524000 --length=1000 decrypt test_range.enc pass test_range.bin > /dev/null 2>&1 \
+    && tail -c +524001 test_pipe.bin | head -c 1000 | cmp -s - test_range.bin; then
+    echo "[PASS] Range decrypt matches the original bytes"
+    ((PASSED++))
+else
+    echo "[FAIL] Range decrypt failed"
+    ((FAILED++))
+fi
+
+# Test 34: Compressed archive is smaller and decrypts to the original
+echo "Test 34: Encrypt with --compress=deflate"
+for i in $(seq 1 20000); do echo "log line $i: request served"; done > test_compress.txt
+if $EXE --compress=deflate encrypt test_compress.txt pass test_compress.enc > /dev/null 2>&1 \
+    && [ $(wc -c < test_compress.enc) -lt $(( $(wc -c < test_compress.txt) / 2 )) ] \
+    && $EXE decrypt test_compress.enc pass test_compress_dec.txt > /dev/null 2>&1 \
+    && cmp -s test_compress.txt test_compress_dec.txt; then
+    echo "[PASS] Compressed archive round trip works"
+    ((PASSED++))
+else
+    echo "[FAIL] Compressed archive round trip failed"
+    ((FAILED++))
+fi
+
+# Test 35: --stats reports random data as skipped by entropy sampling
+echo "Test 35: Compression statistics with --stats"
+head -c 300000 /dev/urandom > test_entropy.bin
+if $EXE --stats --compress=deflate encrypt test_entropy.bin pass test_entropy.enc 2>/dev/null \
+        | grep -q "1 chunks: 0 compressed, 1 skipped as incompressible" \
+    && $EXE decrypt test_entropy.enc pass test_entropy_dec.bin > /dev/null 2>&1 \
+    && cmp -s test_entropy.bin test_entropy_dec.bin; then
+    echo "[PASS] Incompressible chunk skipped and reported"
+    ((PASSED++))
+else
+    echo "[FAIL] Compression statistics missing or wrong"
+    ((FAILED++))
+fi
+
+# Test 36: MYCRYPT_IO=buffered turns memory mapping off
+echo "Test 36: Buffered I/O fallback"
+head -c 2000000 /dev/urandom > test_buffered.bin
+if MYCRYPT_IO=buffered $EXE encrypt test_buffered.bin pass test_buffered.enc > /dev/null 2>&1 \
+    && $EXE decrypt test_buffered.enc pass test_buffered_dec.bin > /dev/null 2>&1 \
+    && cmp -s test_buffered.bin test_buffered_dec.bin \
+    && MYCRYPT_IO=buffered $EXE decrypt test_buffered.enc pass test_buffered_dec.bin > /dev/null 2>&1 \
+    && cmp -s test_buffered.bin test_buffered_dec.bin; then
+    echo "[PASS] Buffered and mapped I/O interoperate"
+    ((PASSED++))
+else
+    echo "[FAIL] Buffered I/O round trip failed"
+    ((FAILED++))
+fi
+
+# Test 37: --io=direct round trip (O_DIRECT where the filesystem allows it)
+echo "Test 37: Direct I/O backend"
+head -c 3000000 /dev/urandom > test_direct.bin
+if $EXE --io=direct --format=v2 encrypt test_direct.bin pass test_direct.enc > /dev/null 2>&1 \
+    && $EXE --io=direct decrypt test_direct.enc pass test_direct_dec.bin > /dev/null 2>&1 \
+    && cmp -s test_direct.bin test_direct_dec.bin \
+    && ! $EXE --io=uring encrypt test_direct.bin pass test_direct.enc > /dev/null 2>&1; then
+    echo "[PASS] Direct I/O round trip works and unknown backends are rejected"
+    ((PASSED++))
+else
+    echo "[FAIL] Direct I/O round trip failed"
+    ((FAILED++))
+fi
+
+# Test 38: --stats times each phase, --stats=json prints the same as JSON
+echo "Test 38: Phase timing report"
+head -c 1000000 /dev/urandom > test_stats.bin
+if $EXE --stats encrypt test_stats.bin pass test_stats.enc 2>/dev/null | grep -q "^  transform " \
+    && $EXE --stats=json decrypt test_stats.enc pass test_stats_dec.bin 2>/dev/null \
+        | grep -q '"run": {"wall_ms": .*"peak_rss_bytes": .*"phases": {"kdf": ' \
+    && cmp -s test_stats.bin test_stats_dec.bin \
+    && ! $EXE --stats=xml encrypt test_stats.bin pass test_stats.enc > /dev/null 2>&1; then
+    echo "[PASS] Phase timings reported as text and JSON"
+    ((PASSED++))
+else
+    echo "[FAIL] Phase timing report missing or wrong"
+    ((FAILED++))
+fi
+
+# Test 39: --trace writes a Chrome Trace Event file
+echo "Test 39: Chrome trace export"
+head -c 1000000 /dev/urandom > test_trace.bin
+if $EXE --trace test_trace.json encrypt test_trace.bin pass test_trace.enc > /dev/null 2>&1 \
+    && grep -q '^{"displayTimeUnit": "ms", "traceEvents": \[' test_trace.json \
+    && grep -q '"name": "transform", "cat": "mycrypt", "ph": "B", .*"args": {"chunk": 0}' test_trace.json \
+    && grep -q '"name": "kdf iterations"' test_trace.json \
+    && [ $(grep -c '"ph": "B"' test_trace.json) -eq $(grep -c '"ph": "E"' test_trace.json) ] \
+    && $EXE --trace=test_trace.json decrypt test_trace.enc pass test_trace_dec.bin > /dev/null 2>&1 \
+    && cmp -s test_trace.bin test_trace_dec.bin; then
+    echo "[PASS] Trace written with balanced begin/end events"
+    ((PASSED++))
+else
+    echo "[FAIL] Trace missing or malformed"
+    ((FAILED++))
+fi
+
+# Test 40: passwords starting with "--" stay positional, and "--" ends the options
+echo "Test 40: Password starting with --"
+echo "Dash password test" > test_dashpass.txt
+if $EXE encrypt test_dashpass.txt --secret test_dashpass.enc > /dev/null 2>&1 \
+    && $EXE decrypt test_dashpass.enc --secret test_dashpass_dec.txt > /dev/null 2>&1 \
+    && cmp -s test_dashpass.txt test_dashpass_dec.txt \
+    && $EXE encrypt -- test_dashpass.txt --format=v2 test_dashpass.enc > /dev/null 2>&1 \
+    && $EXE decrypt -- test_dashpass.enc --format=v2 test_dashpass_dec.txt > /dev/null 2>&1 \
+    && cmp -s test_dashpass.txt test_dashpass_dec.txt \
+    && ! $EXE decrypt test_dashpass.enc wrongpass test_dashpass_dec.txt > /dev/null 2>&1; then
+    echo "[PASS] Passwords starting with -- round trip"
+    ((PASSED++))
+else
+    echo "[FAIL] Password starting with -- rejected or mangled"
+    ((FAILED++))
+fi
+
+# Test 41: a damaged archive fails the decrypt and leaves no output behind
+echo "Test 41: Failed decrypt leaves no output"
+seq 1 400000 > test_broken.txt
+flip_byte() {  # file offset: replace the byte at offset with a different one
+    local old=$(od -An -tu1 -j "$2" -N1 "$1" | tr -d ' ')
+    printf "\\$(printf '%03o' $(( (old + 1) % 256 )))" | dd of="$1" bs=1 seek="$2" conv=notrunc 2> /dev/null
+}
+ENCRYPTED=0
+$EXE --compress=deflate encrypt test_broken.txt pass test_broken.zip > /dev/null 2>&1 \
+    && $EXE --format=v2 encrypt test_broken.txt pass test_broken.v2 > /dev/null 2>&1 && ENCRYPTED=1
+flip_byte test_broken.zip $(( $(wc -c < test_broken.zip) / 2 ))
+V2_SIZE=$(wc -c < test_broken.v2)
+INDEX_AT=$(od -An -tu8 -j $((V2_SIZE - 32)) -N8 test_broken.v2 | tr -d ' ')
+# Flags of chunk 1 (index entries are 32 bytes, flags at +24): raw becomes compressed
+printf '\001' | dd of=test_broken.v2 bs=1 seek=$((INDEX_AT + 32 + 24)) conv=notrunc 2> /dev/null
+rm -f test_broken_zip.txt test_broken_v2.txt
+if [ $ENCRYPTED -eq 1 ] && ! $EXE decrypt test_broken.zip pass test_broken_zip.txt > /dev/null 2>&1 && [ ! -e test_broken_zip.txt ] \
+    && ! $EXE decrypt test_broken.v2 pass test_broken_v2.txt > /dev/null 2>&1 && [ ! -e test_broken_v2.txt ]; then
+    echo "[PASS] Broken ZIP and v2 archives leave no output"
+    ((PASSED++))
+else
+    echo "[FAIL] A failed decrypt left output behind"
+    ((FAILED++))
+fi
+
 # Cleanup
 echo
 echo "Cleaning up test files..."
+rm -f test_direct.bin test_direct.enc test_direct_dec.bin
+rm -f test_buffered.bin test_buffered.enc test_buffered_dec.bin
 rm -f test_cli.txt test_cli.txt.enc test_cli_dec.txt test_wrong.txt
 rm -f custom_output.enc custom_dec.txt
 rm -f test_binary.exe test_binary.enc test_binary_dec.exe
@@ -530,12 +699,20 @@ rm -f test_numpass.txt test_numpass.txt.enc test_numpass_dec.txt
 rm -f test_spacepass.txt test_spacepass.txt.enc test_spacepass_dec.txt
 rm -f test_rt.txt test_rt1.enc test_rt1_dec.txt test_rt2.enc test_rt2_dec.txt
 rm -f test_utf8.txt test_utf8.txt.enc test_utf8_dec.txt
+rm -f test_pipe.bin test_pipe_dec.bin test_pipe.enc test_pipe_dec2.bin
+rm -f test_range.enc test_range.bin
+rm -f test_compress.txt test_compress.enc test_compress_dec.txt
+rm -f test_entropy.bin test_entropy.enc test_entropy_dec.bin
+rm -f test_stats.bin test_stats.enc test_stats_dec.bin
+rm -f test_trace.bin test_trace.enc test_trace_dec.bin test_trace.json
+rm -f test_dashpass.txt test_dashpass.enc test_dashpass_dec.txt
+rm -f test_broken.txt test_broken.zip test_broken.v2 test_broken_zip.txt test_broken_v2.txt
 
 echo
 echo "========================================"
 echo "Test Results"
 echo "========================================"
-echo "Total Tests: 30"
+echo "Total Tests: 41"
 echo "Passed: $PASSED"
 echo "Failed: $FAILED"
 echo "========================================"
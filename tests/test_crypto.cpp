@@ -1,15 +1,121 @@
 #include "../include/crypto.h"
+#include "../include/random.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 static int passed = 0, failed = 0;
 
+// FNV-1a, to pin known-answer hashes without embedding 600-character strings.
+static unsigned long long fnv1a(const char *s) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
 static void test(const char *name, bool condition) {
     printf("Test %d: %s - %s\n", passed + failed + 1, name, condition ? "PASS" : "FAIL");
     if (condition) passed++; else failed++;
 }
 
+// The original O(n^2) selection that sort_by_nth_element replaced.
+static std::vector<uint8_t> reference_sort_by_nth(const std::vector<uint8_t>& data, size_t n) {
+    std::vector<uint8_t> arr_copy = data, result;
+    size_t index = 0;
+    for (size_t i = 0; i < data.size(); ++i) {
+        long long idx = static_cast<long long>(index) + static_cast<long long>(n) - 1;
+        long long mod = idx % static_cast<long long>(arr_copy.size());
+        if (mod < 0) mod += static_cast<long long>(arr_copy.size());
+        index = static_cast<size_t>(mod);
+        result.push_back(arr_copy[index]);
+        arr_copy.erase(arr_copy.begin() + index);
+    }
+    return result;
+}
+
+static bool sort_by_nth_matches_reference() {
+    const size_t steps[] = {0, 1, 2, 3, 4, 5, 7, 64, 1000, (size_t)-1, (size_t)-3};
+    unsigned state = 12345;
+    for (size_t len = 0; len <= 2100; len += (len < 70) ? 1 : 61) {
+        std::vector<uint8_t> data(len), actual(len);
+        for (size_t i = 0; i < len; i++) {
+            state = state * 1103515245u + 12345u;
+            data[i] = (uint8_t)(state >> 16);
+        }
+        for (size_t n : steps) {
+            sort_by_nth_element(data.data(), len, n, actual.data());
+            if (actual != reference_sort_by_nth(data, n)) {
+                printf("  mismatch: len=%zu n=%zu\n", len, n);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool random_sizes_filled() {
+    const size_t sizes[] = {1, 16, 4095, 4096, 4097, 100000};
+    for (size_t len : sizes) {
+        std::vector<uint8_t> a(len, 0), b(len, 0);
+        if (random_bytes(a.data(), len) != 0 || random_bytes(b.data(), len) != 0) return false;
+        // Single bytes may collide; anything longer must not.
+        if (len >= 16 && a == b) return false;
+    }
+    return true;
+}
+
+// Draws from several threads at once; pooled bytes must never be handed out twice.
+static bool random_threads_distinct() {
+    const int THREADS = 4, DRAWS = 2000;
+    std::vector<std::string> draws(THREADS * DRAWS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&draws, t] {
+            for (int i = 0; i < DRAWS; i++) {
+                uint8_t buf[16];
+                random_bytes(buf, sizeof(buf));
+                draws[t * DRAWS + i].assign((const char*)buf, sizeof(buf));
+            }
+        });
+    }
+    for (std::thread &t : threads) t.join();
+    return std::set<std::string>(draws.begin(), draws.end()).size() == draws.size();
+}
+
+#ifndef _WIN32
+// A forked child must not replay the bytes left in the parent's pool.
+static bool random_fork_distinct() {
+    uint8_t warm[1], parent[16], child[16];
+    random_bytes(warm, 1);
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    pid_t pid = fork();
+    if (pid == 0) {
+        random_bytes(child, sizeof(child));
+        ssize_t w = write(fds[1], child, sizeof(child));
+        _exit(w == (ssize_t)sizeof(child) ? 0 : 1);
+    }
+    random_bytes(parent, sizeof(parent));
+    close(fds[1]);
+    ssize_t r = read(fds[0], child, sizeof(child));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return r == (ssize_t)sizeof(child) && memcmp(parent, child, sizeof(child)) != 0;
+}
+#endif
+
 int main(void) {
     const char *salt1 = "testSalt12345678";
     const char *salt2 = "otherSalt1234567";
@@ -423,6 +529,68 @@ int main(void) {
     test("Final test at cost=13", strcmp(h1, h2) == 0);
     free(h1); free(h2);
     
+    // Test 81-83: Legacy XOR file encryption
+    {
+        const size_t size = 200003;
+        const unsigned char key[] = "sevenkey";
+        const size_t key_len = 7;
+        FILE *f = fopen("test_xor_in.bin", "wb");
+        for (size_t i = 0; i < size; i++) fputc((int)((i * 37 + 11) & 0xFF), f);
+        fclose(f);
+        
+        int rc = encrypt_file("test_xor_in.bin", "test_xor_enc.bin", key, key_len);
+        bool matches = rc == 0;
+        f = fopen("test_xor_enc.bin", "rb");
+        for (size_t i = 0; matches && f && i < size; i++) {
+            matches = fgetc(f) == (int)(((i * 37 + 11) & 0xFF) ^ key[i % key_len]);
+        }
+        matches = matches && f && fgetc(f) == EOF;
+        if (f) fclose(f);
+        test("encrypt_file output equals byte-wise repeating-key XOR", matches);
+        
+        rc = decrypt_file("test_xor_enc.bin", "test_xor_dec.bin", key, key_len);
+        matches = rc == 0;
+        f = fopen("test_xor_dec.bin", "rb");
+        for (size_t i = 0; matches && f && i < size; i++) {
+            matches = fgetc(f) == (int)((i * 37 + 11) & 0xFF);
+        }
+        if (f) fclose(f);
+        test("decrypt_file restores the original", matches);
+        
+        test("encrypt_file rejects a missing input", encrypt_file("missing_xor.bin", "test_xor_x.bin", key, key_len) == -1);
+        remove("test_xor_in.bin");
+        remove("test_xor_enc.bin");
+        remove("test_xor_dec.bin");
+    }
+    
+    // Test 84-88: Known answers recorded before the memo moved to shared spans
+    {
+        struct { const char *password; int cost; const char *salt; size_t len; unsigned long long digest; } known[] = {
+            {"mypassword", 8, "testSalt12345678", 637, 0x51a7b6a01daee7afULL},
+            {"correct horse battery staple", 10, "otherSalt1234567", 639, 0x2ac4b3d9baf36958ULL},
+            {"p\xe4ssw\xf6rd\xff", 12, "testSalt12345678", 630, 0x924bf669d094f0aaULL},
+            {"a", 5, "Zz$%&'()*+,-./01", 568, 0xdd32aae885286f9cULL},
+            {"mypassword", 14, "testSalt12345678", 643, 0xac31b9f02f2b801fULL},
+        };
+        for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+            char name[64];
+            snprintf(name, sizeof(name), "Known-answer hash at cost=%d", known[i].cost);
+            h1 = hash_password(known[i].password, known[i].cost, known[i].salt);
+            test(name, h1 && strlen(h1) == known[i].len && fnv1a(h1) == known[i].digest);
+            free(h1);
+        }
+    }
+    
+    // Test 89: Fenwick-tree selection against the original erase loop
+    test("sort_by_nth_element matches the O(n^2) reference", sort_by_nth_matches_reference());
+    
+    // Test 90-92: Pooled random bytes
+    test("random_bytes fills requests around the pool size", random_sizes_filled());
+    test("random_bytes never repeats across threads", random_threads_distinct());
+#ifndef _WIN32
+    test("random_bytes pool is discarded in a forked child", random_fork_distinct());
+#endif
+    
     printf("\n========================================\n");
     printf("Total: %d tests\n", passed + failed);
     printf("Passed: %d\n", passed);
@@ -1,11 +1,25 @@
 #include "encryption.h"
 #include "crypto.h"
+#include "async_io.h"
+#include "encrypted_file_reader.h"
+#include "native_container.h"
+#include "kernels.h"
+#include "key_schedule.h"
+#include "thread_pool.h"
+#include "trace.h"
 #include <stdio.h>
 #include <string.h>
 #include <fstream>
 #include <vector>
 #include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 static int passed = 0;
 static int failed = 0;
@@ -64,6 +78,296 @@ static size_t get_file_size(const char *filename) {
     return 0;
 }
 
+// Reference copies of the original allocating rotate implementations. The only
+// change is the 8-byte mask: (1ULL << 64) - 1 is undefined and zeroed the
+// buffer on x86, so the references use an all-ones mask for n == 64.
+static void legacy_rotate_left(uint8_t *data, size_t len, int k) {
+    if (len == 0 || k == 0) return;
+    k = k % (len * 8);
+    if (k < 0) k += len * 8;
+    size_t n = len * 8;
+    std::vector<uint8_t> temp(data, data + len);
+    uint64_t int_val = 0;
+    for (size_t i = 0; i < len && i < 8; i++) int_val = (int_val << 8) | temp[i];
+    if (len <= 8) {
+        if (k == 0) return;
+        uint64_t mask = (n == 64) ? ~0ULL : ((1ULL << n) - 1);
+        uint64_t rotated = ((int_val << k) | (int_val >> (n - k))) & mask;
+        for (int i = len - 1; i >= 0; i--) {
+            data[i] = rotated & 0xFF;
+            rotated >>= 8;
+        }
+    } else {
+        std::vector<uint8_t> result(len);
+        size_t byte_shift = k / 8;
+        int bit_shift = k % 8;
+        for (size_t i = 0; i < len; i++) result[i] = temp[(i + len - byte_shift) % len];
+        if (bit_shift > 0) {
+            uint8_t carry = 0;
+            for (size_t i = 0; i < len; i++) {
+                uint8_t new_carry = result[i] >> (8 - bit_shift);
+                result[i] = (result[i] << bit_shift) | carry;
+                carry = new_carry;
+            }
+            result[0] |= carry;
+        }
+        memcpy(data, result.data(), len);
+    }
+}
+
+static void legacy_rotate_right(uint8_t *data, size_t len, int k) {
+    if (len == 0 || k == 0) return;
+    k = k % (len * 8);
+    if (k < 0) k += len * 8;
+    size_t n = len * 8;
+    std::vector<uint8_t> temp(data, data + len);
+    uint64_t int_val = 0;
+    for (size_t i = 0; i < len && i < 8; i++) int_val = (int_val << 8) | temp[i];
+    if (len <= 8) {
+        if (k == 0) return;
+        uint64_t mask = (n == 64) ? ~0ULL : ((1ULL << n) - 1);
+        uint64_t rotated = ((int_val >> k) | (int_val << (n - k))) & mask;
+        for (int i = len - 1; i >= 0; i--) {
+            data[i] = rotated & 0xFF;
+            rotated >>= 8;
+        }
+    } else {
+        std::vector<uint8_t> result(len);
+        size_t byte_shift = k / 8;
+        int bit_shift = k % 8;
+        for (size_t i = 0; i < len; i++) result[i] = temp[(i + byte_shift) % len];
+        if (bit_shift > 0) {
+            uint8_t carry = 0;
+            for (int i = len - 1; i >= 0; i--) {
+                uint8_t new_carry = result[i] << (8 - bit_shift);
+                result[i] = (result[i] >> bit_shift) | carry;
+                carry = new_carry;
+            }
+            result[len - 1] |= carry;
+        }
+        memcpy(data, result.data(), len);
+    }
+}
+
+// Shift amounts checked for a buffer of `len` bytes: every shift for short
+// buffers, otherwise every bit/byte-offset combination near both ends of the range.
+static std::vector<int> rotate_test_shifts(size_t len) {
+    std::vector<int> shifts;
+    int n = (int)(len * 8);
+    if (len <= 64) {
+        for (int k = -n; k <= 2 * n; k++) shifts.push_back(k);
+        return shifts;
+    }
+    for (int k = -17; k <= 40; k++) shifts.push_back(k);
+    for (int k = n - 17; k <= n + 17; k++) shifts.push_back(k);
+    shifts.push_back(n / 2 + 3);
+    shifts.push_back((int)(len * 37 % n));
+    return shifts;
+}
+
+static bool rotate_matches_legacy(bool left, size_t max_len = 4096) {
+    std::vector<uint8_t> original(max_len), expected, actual;
+    for (size_t i = 0; i < original.size(); i++) original[i] = (uint8_t)(i * 167 + 13);
+    for (size_t len = 1; len <= original.size(); len++) {
+        for (int k : rotate_test_shifts(len)) {
+            expected.assign(original.begin(), original.begin() + len);
+            actual = expected;
+            if (left) {
+                legacy_rotate_left(expected.data(), len, k);
+                rotate_left(actual.data(), len, k);
+            } else {
+                legacy_rotate_right(expected.data(), len, k);
+                rotate_right(actual.data(), len, k);
+            }
+            if (expected != actual) {
+                printf("  mismatch: len=%zu k=%d\n", len, k);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Runs byte_manipulations' rounds through the generic rotate/XOR functions.
+static void generic_rounds(uint8_t *data, size_t len, const uint8_t *key, size_t key_len, int iterat, bool reverse) {
+    iterat = 10 + (iterat % 6);
+    int n = key[(key[1] + key[2]) % (key_len - 5)] % 7;
+    if (!reverse) {
+        for (int i = 0; i < iterat; i++) {
+            rotate_left(data, len, 1 + ((n + i) % 7));
+            xor_bytes(data, len, key, key_len);
+        }
+    } else {
+        for (int i = iterat - 1; i >= 0; i--) {
+            xor_bytes(data, len, key, key_len);
+            rotate_right(data, len, 1 + ((n + i) % 7));
+        }
+    }
+}
+
+static bool block_kernels_match_generic() {
+    std::vector<uint8_t> block(SUB_CHUNK_SIZE), expected, actual, key_stream(SUB_CHUNK_SIZE);
+    for (size_t i = 0; i < block.size(); i++) block[i] = (uint8_t)(i * 89 + 5);
+    const size_t key_lens[] = {6, 7, 64, 97, 1023, 1500};
+    for (size_t key_len : key_lens) {
+        std::vector<uint8_t> key(key_len);
+        for (size_t i = 0; i < key_len; i++) key[i] = (uint8_t)(i * 31 + key_len);
+        expand_key_stream(key_stream.data(), SUB_CHUNK_SIZE, key.data(), key_len);
+        for (int shift = 1; shift <= 7; shift++) {
+            expected = block;
+            actual = block;
+            rotate_left(expected.data(), SUB_CHUNK_SIZE, shift);
+            xor_bytes(expected.data(), SUB_CHUNK_SIZE, key.data(), key_len);
+            active_kernels().round_forward[shift](actual.data(), key_stream.data());
+            if (expected != actual) return false;
+            xor_bytes(expected.data(), SUB_CHUNK_SIZE, key.data(), key_len);
+            rotate_right(expected.data(), SUB_CHUNK_SIZE, shift);
+            active_kernels().round_reverse[shift](actual.data(), key_stream.data());
+            if (expected != actual || actual != block) return false;
+        }
+        for (int iterat = 0; iterat < 6; iterat++) {
+            expected = block;
+            actual = block;
+            generic_rounds(expected.data(), SUB_CHUNK_SIZE, key.data(), key_len, iterat, false);
+            byte_manipulations(actual.data(), SUB_CHUNK_SIZE, key.data(), key_len, iterat);
+            if (expected != actual) return false;
+            byte_manipulations_reverse(actual.data(), SUB_CHUNK_SIZE, key.data(), key_len, iterat);
+            if (actual != block) return false;
+        }
+    }
+    return true;
+}
+
+static bool xor_matches_bytewise() {
+    std::vector<uint8_t> original(5000), actual;
+    for (size_t i = 0; i < original.size(); i++) original[i] = (uint8_t)(i * 53 + 1);
+    const size_t key_lens[] = {1, 6, 7, 13, 64, 100, 1024, 1031, 3000};
+    for (size_t key_len : key_lens) {
+        std::vector<uint8_t> key(key_len);
+        for (size_t i = 0; i < key_len; i++) key[i] = (uint8_t)(i * 7 + 3);
+        for (size_t len = 0; len <= original.size(); len += (len < 300) ? 1 : 97) {
+            actual.assign(original.begin(), original.begin() + len);
+            xor_bytes(actual.data(), len, key.data(), key_len);
+            for (size_t i = 0; i < len; i++) {
+                if (actual[i] != (uint8_t)(original[i] ^ key[i % key_len])) return false;
+            }
+        }
+    }
+    return true;
+}
+
+// byte_manipulations on every length up to a little past one sub-chunk
+// against rounds built from the legacy rotates and a byte-wise XOR.
+static bool rounds_match_legacy() {
+    const char *key_str = "$2b$10$abcdefghijklmnopqrstuv";
+    const uint8_t *key = (const uint8_t*)key_str;
+    size_t key_len = strlen(key_str);
+    int n = key[(key[1] + key[2]) % (key_len - 5)] % 7;
+    std::vector<uint8_t> original(SUB_CHUNK_SIZE + 80), expected, actual;
+    for (size_t i = 0; i < original.size(); i++) original[i] = (uint8_t)(i * 71 + 9);
+    for (size_t len = 1; len <= original.size(); len++) {
+        expected.assign(original.begin(), original.begin() + len);
+        actual = expected;
+        for (int i = 0; i < 13; i++) {
+            legacy_rotate_left(expected.data(), len, 1 + ((n + i) % 7));
+            for (size_t j = 0; j < len; j++) expected[j] ^= key[j % key_len];
+        }
+        byte_manipulations(actual.data(), len, key, key_len, 3);
+        if (expected != actual) {
+            printf("  mismatch: len=%zu\n", len);
+            return false;
+        }
+        byte_manipulations_reverse(actual.data(), len, key, key_len, 3);
+        if (!std::equal(actual.begin(), actual.end(), original.begin())) return false;
+    }
+    return true;
+}
+
+// Runs the kernel checks once per variant this CPU can execute.
+static bool every_kernel_variant_matches() {
+    bool ok = true;
+    for (int isa = 0; isa < KERNEL_ISA_COUNT; isa++) {
+        const KernelSet *set = kernel_set((KernelIsa)isa);
+        if (!set) continue;
+        printf("  kernel variant: %s\n", set->name);
+        select_kernels(set->name);
+        // 300 bytes already crosses every vector/word/byte tail boundary.
+        ok = ok && rotate_matches_legacy(true, 300) && rotate_matches_legacy(false, 300) &&
+             block_kernels_match_generic() && xor_matches_bytewise() && rounds_match_legacy();
+    }
+    select_kernels("auto");
+    return ok;
+}
+
+// KeySchedule against rounds built from the legacy rotates and a byte-wise
+// XOR, for every path (fixed block, fused, generic) and iteration class.
+static bool schedule_matches_legacy() {
+    const size_t key_lens[] = {6, 7, 64, 2000};
+    const size_t lens[] = {1, 5, 8, 9, 100, 1000, 1024, 1500, 2100};
+    std::vector<uint8_t> original(2100), expected, actual;
+    for (size_t i = 0; i < original.size(); i++) original[i] = (uint8_t)(i * 29 + 3);
+    for (size_t key_len : key_lens) {
+        std::vector<uint8_t> key(key_len);
+        for (size_t i = 0; i < key_len; i++) key[i] = (uint8_t)(i * 13 + key_len);
+        KeySchedule schedule(key.data(), key_len);
+        int n = key[(key[1] + key[2]) % (key_len - 5)] % 7;
+        for (size_t len : lens) {
+            for (int iterat = -7; iterat <= 13; iterat++) {
+                expected.assign(original.begin(), original.begin() + len);
+                actual = expected;
+                for (int i = 0; i < 10 + (iterat % 6); i++) {
+                    if (schedule.shift(i) != 1 + ((n + i) % 7)) return false;
+                    legacy_rotate_left(expected.data(), len, 1 + ((n + i) % 7));
+                    for (size_t j = 0; j < len; j++) expected[j] ^= key[j % key_len];
+                }
+                schedule.forward(actual.data(), len, iterat);
+                if (expected != actual) {
+                    printf("  mismatch: key_len=%zu len=%zu iterat=%d\n", key_len, len, iterat);
+                    return false;
+                }
+                schedule.reverse(actual.data(), len, iterat);
+                if (!std::equal(actual.begin(), actual.end(), original.begin())) return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The one-pass closed form against the round-by-round path for every length
+// up to 300 and a spread beyond, both directions, under every kernel variant.
+// A fresh schedule per length keeps each length on the cached path.
+static bool closed_form_matches_rounds() {
+    std::vector<uint8_t> key(11), original(2100), expected, actual;
+    for (size_t i = 0; i < key.size(); i++) key[i] = (uint8_t)(i * 41 + 7);
+    for (size_t i = 0; i < original.size(); i++) original[i] = (uint8_t)(i * 131 + 17);
+    for (int isa = 0; isa < KERNEL_ISA_COUNT; isa++) {
+        const KernelSet *set = kernel_set((KernelIsa)isa);
+        if (!set) continue;
+        select_kernels(set->name);
+        for (size_t len = 1; len <= original.size(); len += (len < 300 ? 1 : 37)) {
+            KeySchedule schedule(key.data(), key.size());
+            for (int iterat = -7; iterat <= 13; iterat++) {
+                expected.assign(original.begin(), original.begin() + len);
+                actual = expected;
+                schedule.forward_rounds(expected.data(), len, iterat);
+                schedule.forward(actual.data(), len, iterat);
+                if (expected != actual) {
+                    printf("  mismatch: %s len=%zu iterat=%d\n", set->name, len, iterat);
+                    select_kernels("auto");
+                    return false;
+                }
+                schedule.reverse(actual.data(), len, iterat);
+                if (!std::equal(actual.begin(), actual.end(), original.begin())) {
+                    select_kernels("auto");
+                    return false;
+                }
+            }
+        }
+    }
+    select_kernels("auto");
+    return true;
+}
+
 int main() {
     printf("========================================\n");
     printf("File Encryption/Decryption Tests\n");
@@ -434,10 +738,687 @@ int main() {
     rc = decrypt_file_advanced("test_exact_1kb.enc", "test_exact_1kb_dec.bin", "pass");
     test("Test 110: Exactly 1KB decryption", rc == 0 && files_match("test_exact_1kb.bin", "test_exact_1kb_dec.bin"));
     
+    // Test 111-113: Shared work-stealing pool
+    {
+        ThreadPool pool(4);
+        std::vector<int> hits(1000, 0);
+        parallel_for(pool, hits.size(), [&](size_t i) { hits[i]++; });
+        bool all_once = true;
+        for (int h : hits) all_once = all_once && h == 1;
+        test("Test 111: parallel_for runs every index exactly once", all_once);
+        
+        std::atomic<int> nested(0);
+        parallel_for(pool, 8, [&](size_t) {
+            parallel_for(pool, 8, [&](size_t) { nested++; });
+        });
+        test("Test 112: Nested parallel_for completes", nested == 64);
+        
+        std::atomic<int> ran(0);
+        {
+            TaskGroup group(pool);
+            for (int i = 0; i < 100; i++) group.run([&]() { ran++; });
+        }
+        test("Test 113: TaskGroup waits for all tasks on destruction", ran == 100);
+    }
+    
+    // Test 114-117: Word-wide rotate kernels match the original implementation
+    test("Test 114: rotate_left matches legacy for lengths 1-4096", rotate_matches_legacy(true));
+    test("Test 115: rotate_right matches legacy for lengths 1-4096", rotate_matches_legacy(false));
+    {
+        uint8_t block[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+        uint8_t copy[8];
+        memcpy(copy, block, 8);
+        rotate_left(block, 8, 5);
+        bool changed = memcmp(block, copy, 8) != 0;
+        rotate_right(block, 8, 5);
+        test("Test 116: 8-byte rotate is a reversible 64-bit rotation", changed && memcmp(block, copy, 8) == 0);
+    }
+    create_test_file_binary("test_tail8.bin", 1024 + 8);
+    rc = encrypt_file_advanced("test_tail8.bin", "test_tail8.enc", "pass", 8);
+    rc |= decrypt_file_advanced("test_tail8.enc", "test_tail8_dec.bin", "pass");
+    test("Test 117: 8-byte tail sub-chunk round-trips", rc == 0 && files_match("test_tail8.bin", "test_tail8_dec.bin"));
+    
+    // Test 118: Fixed-size round kernels match the generic rounds
+    test("Test 118: Sub-chunk round kernels match generic rotate+XOR", block_kernels_match_generic());
+    
+    // Test 119: Vector XOR against the expanded key stream
+    test("Test 119: xor_bytes matches byte-wise repeating-key XOR", xor_matches_bytewise());
+    
+    // Test 120-121: Runtime kernel dispatch
+    test("Test 120: Every supported kernel variant matches the reference", every_kernel_variant_matches());
+    {
+        const char *active = active_kernels().name;
+        bool rejected = !select_kernels("mmx") && strcmp(active_kernels().name, active) == 0;
+        bool scalar = select_kernels("scalar") && strcmp(active_kernels().name, "scalar") == 0;
+        select_kernels("auto");
+        test("Test 121: select_kernels rejects unknown names and accepts scalar", rejected && scalar);
+    }
+    
+    // Test 122: Per-file key schedule
+    test("Test 122: KeySchedule matches the legacy rounds for every class", schedule_matches_legacy());
+    
+    // Test 123: Closed-form transform
+    test("Test 123: Closed-form transform matches the rounds for every length", closed_form_matches_rounds());
+    
+    // Test 124-126: Batch encrypt/decrypt on the shared pool
+    {
+        const char *inputs[] = {"test_batch1.txt", "test_batch2.bin", "test_batch3.bin", "test_batch4.bin"};
+        const char *encrypted[] = {"test_batch1.enc", "test_batch2.enc", "test_batch3.enc", "test_batch4.enc"};
+        const char *decrypted[] = {"test_batch1_dec.txt", "test_batch2_dec.bin", "test_batch3_dec.bin", "test_batch4_dec.bin"};
+        create_test_file(inputs[0], "small batch file");
+        create_test_file_binary(inputs[1], 1000);
+        create_test_file_binary(inputs[2], 300 * 1024);
+        create_test_file_binary(inputs[3], 6 * 1024 * 1024);
+        BatchEntry entries[4];
+        for (int i = 0; i < 4; i++) entries[i] = BatchEntry{inputs[i], encrypted[i], 1};
+        int failures = encrypt_files_batch(entries, 4, "batchpass", 8, NULL);
+        bool all_ok = failures == 0;
+        for (int i = 0; i < 4; i++) {
+            all_ok = all_ok && entries[i].status == 0;
+            entries[i] = BatchEntry{encrypted[i], decrypted[i], 1};
+        }
+        failures = decrypt_files_batch(entries, 4, "batchpass");
+        bool match = failures == 0;
+        for (int i = 0; i < 4; i++) match = match && entries[i].status == 0 && files_match(inputs[i], decrypted[i]);
+        test("Test 124: Batch encrypt succeeds for every file", all_ok);
+        test("Test 125: Batch decrypt restores every file", match);
+        
+        BatchEntry mixed[3] = {
+            {encrypted[0], decrypted[0], 1},
+            {"test_batch_missing.enc", "test_batch_missing_dec.txt", 1},
+            {encrypted[1], decrypted[1], 1},
+        };
+        failures = decrypt_files_batch(mixed, 3, "batchpass");
+        bool isolated = failures == 1 && mixed[0].status == 0 && mixed[1].status == -1 && mixed[2].status == 0;
+        BatchEntry wrong = {encrypted[0], "test_batch_wrong.txt", 1};
+        isolated = isolated && decrypt_files_batch(&wrong, 1, "notthepass") == 1 && wrong.status == -2;
+        test("Test 126: Batch failures are reported per file", isolated);
+    }
+    
+    // Test 127-129: Framed stream container
+    {
+        const size_t sizes[] = {0, 1, 1000, 1300 * 1024};
+        bool round_trip = true;
+        for (size_t size : sizes) {
+            create_test_file_binary("test_stream.bin", size);
+            FILE *in = fopen("test_stream.bin", "rb");
+            FILE *out = fopen("test_stream.enc", "wb");
+            int enc_rc = encrypt_stream(in, out, "test_stream.bin", "streampass", 8);
+            fclose(in);
+            fclose(out);
+            // decrypt_file_advanced tells the stream container from a ZIP archive.
+            int dec_rc = decrypt_file_advanced("test_stream.enc", "test_stream_dec.bin", "streampass");
+            round_trip = round_trip && enc_rc == 0 && dec_rc == 0 && files_match("test_stream.bin", "test_stream_dec.bin");
+        }
+        test("Test 127: Stream container round-trips 0 bytes to multi-frame input", round_trip);
+        
+        rc = decrypt_file_advanced("test_stream.enc", "test_stream_wrong.bin", "notthepass");
+        test("Test 128: Stream container rejects a wrong password without output",
+             rc == -2 && !file_exists("test_stream_wrong.bin"));
+        
+        // Dropping the trailer must be detected even though every frame is intact.
+        size_t enc_size = get_file_size("test_stream.enc");
+        std::vector<uint8_t> encrypted(enc_size);
+        FILE *f = fopen("test_stream.enc", "rb");
+        size_t got = fread(encrypted.data(), 1, enc_size, f);
+        fclose(f);
+        f = fopen("test_stream_cut.enc", "wb");
+        fwrite(encrypted.data(), 1, got - 28, f);
+        fclose(f);
+        rc = decrypt_file_advanced("test_stream_cut.enc", "test_stream_cut.bin", "streampass");
+        test("Test 129: Truncated stream container is rejected", got == enc_size && rc == -1);
+    }
+    
+    // Test 130-132: Native v2 container
+    {
+        const size_t sizes[] = {0, 1000, 6 * 1024 * 1024 + 123};
+        bool round_trip = true;
+        for (size_t size : sizes) {
+            create_test_file_binary("test_v2.bin", size);
+            int enc_rc = encrypt_file_v2("test_v2.bin", "test_v2.enc", "v2pass", 8, NULL, NULL);
+            int dec_rc = decrypt_file_advanced("test_v2.enc", "test_v2_dec.bin", "v2pass");
+            round_trip = round_trip && enc_rc == 0 && dec_rc == 0 && files_match("test_v2.bin", "test_v2_dec.bin");
+        }
+        test("Test 130: v2 container round-trips empty, single and multi-chunk files", round_trip);
+        
+        rc = decrypt_file_advanced("test_v2.enc", "test_v2_wrong.bin", "notthepass");
+        test("Test 131: v2 container rejects a wrong password without output",
+             rc == -2 && !file_exists("test_v2_wrong.bin"));
+        
+        // A damaged footer must be caught when the index is opened.
+        size_t enc_size = get_file_size("test_v2.enc");
+        std::vector<uint8_t> encrypted(enc_size);
+        FILE *f = fopen("test_v2.enc", "rb");
+        size_t got = fread(encrypted.data(), 1, enc_size, f);
+        fclose(f);
+        encrypted[enc_size - 20] ^= 0x01;
+        f = fopen("test_v2_bad.enc", "wb");
+        fwrite(encrypted.data(), 1, got, f);
+        fclose(f);
+        rc = decrypt_file_advanced("test_v2_bad.enc", "test_v2_bad.bin", "v2pass");
+        test("Test 132: v2 container with a corrupt index is rejected", got == enc_size && rc == -1);
+    }
+    
+    // Test 133-135: Range decryption
+    {
+        // 6MB spans several 512KB chunks; ranges start and end inside
+        // sub-chunks and cross chunk boundaries.
+        size_t size = 6 * 1024 * 1024 + 123;
+        create_test_file_binary("test_range.bin", size);
+        std::vector<uint8_t> plain(size);
+        FILE *f = fopen("test_range.bin", "rb");
+        size_t got = fread(plain.data(), 1, size, f);
+        fclose(f);
+        bool enc_ok = got == size &&
+                      encrypt_file_advanced("test_range.bin", "test_range.zip", "rangepass", 8) == 0 &&
+                      encrypt_file_v2("test_range.bin", "test_range.v2", "rangepass", 8, NULL, NULL) == 0;
+        const uint64_t ranges[][2] = {
+            {0, 1}, {1000, 100}, {524288 - 700, 1500}, {3 * 524288 + 5, 2 * 524288 + 17},
+            {size - 50, 50}, {size - 10, 1000}, {size, 10}, {777, size}};
+        bool ranges_ok = enc_ok;
+        for (const char *archive : {"test_range.zip", "test_range.v2"}) {
+            for (const auto &range : ranges) {
+                uint64_t end = std::min<uint64_t>(size, range[0] + range[1]);
+                int range_rc = decrypt_file_range(archive, "test_range_out.bin", "rangepass", range[0], range[1]);
+                std::vector<uint8_t> out(end - range[0] + 1);
+                f = fopen("test_range_out.bin", "rb");
+                size_t n = f ? fread(out.data(), 1, out.size(), f) : 0;
+                if (f) fclose(f);
+                ranges_ok = ranges_ok && range_rc == 0 && n == end - range[0] &&
+                            std::equal(plain.begin() + range[0], plain.begin() + end, out.begin());
+            }
+        }
+        test("Test 133: Range decryption matches the plaintext for ZIP and v2 archives", ranges_ok);
+        
+        remove("test_range_out.bin");
+        rc = decrypt_file_range("test_range.v2", "test_range_out.bin", "wrongpass", 10, 10);
+        int zip_rc = decrypt_file_range("test_range.zip", "test_range_out.bin", "wrongpass", 10, 10);
+        test("Test 134: Range decryption rejects a wrong password without output",
+             rc == -2 && zip_rc == -2 && !file_exists("test_range_out.bin"));
+        
+        FILE *in = fopen("test_range.bin", "rb");
+        FILE *out = fopen("test_range.stream", "wb");
+        bool stream_ok = in && out && encrypt_stream(in, out, "test_range.bin", "rangepass", 8) == 0;
+        if (in) fclose(in);
+        if (out) fclose(out);
+        rc = decrypt_file_range("test_range.v2", "test_range_out.bin", "rangepass", size + 1, 10);
+        int stream_rc = decrypt_file_range("test_range.stream", "test_range_out.bin", "rangepass", 0, 10);
+        test("Test 135: Range decryption rejects offsets past the end and stream containers",
+             stream_ok && rc == -1 && stream_rc == -1);
+    }
+    
+    // Test 136-138: EncryptedFileReader
+    {
+        size_t size = 6 * 1024 * 1024 + 123;
+        create_test_file_binary("test_reader.bin", size);
+        std::vector<uint8_t> plain(size);
+        FILE *f = fopen("test_reader.bin", "rb");
+        size_t got = fread(plain.data(), 1, size, f);
+        fclose(f);
+        bool enc_ok = got == size &&
+                      encrypt_file_advanced("test_reader.bin", "test_reader.zip", "readerpass", 8) == 0 &&
+                      encrypt_file_v2("test_reader.bin", "test_reader.v2", "readerpass", 8, NULL, NULL) == 0;
+        
+        // Reads that start and end inside chunks, cross chunk boundaries and
+        // run past the end of the file; the first few touch chunk 0 repeatedly.
+        bool reads_ok = enc_ok;
+        bool counters_ok = true;
+        for (const char *archive : {"test_reader.zip", "test_reader.v2"}) {
+            EncryptedFileReader reader(4 * 1024 * 1024);
+            reads_ok = reads_ok && reader.open(archive, "readerpass") == 0 && reader.size() == size;
+            const uint64_t reads[][2] = {
+                {0, 100}, {5000, 3000}, {100, 10}, {524288 - 10, 20},
+                {3 * 524288 + 1, 524288 + 2}, {size - 7, 100}, {size, 1}};
+            for (const auto &r : reads) {
+                std::vector<uint8_t> out(r[1]);
+                long long n = reader.pread(out.data(), out.size(), r[0]);
+                uint64_t expect = std::min<uint64_t>(r[1], size - r[0]);
+                reads_ok = reads_ok && n == (long long)expect &&
+                           std::equal(plain.begin() + r[0], plain.begin() + r[0] + expect, out.begin());
+            }
+            uint8_t byte;
+            reads_ok = reads_ok && reader.pread(&byte, 1, size + 1) == -1;
+            EncryptedReaderStats st = reader.stats();
+            // Chunks 0, 1, 3, 4 and the last decrypt once each; the rest hit.
+            counters_ok = counters_ok && st.cache_misses == 5 && st.cache_hits == 3 && st.hit_rate() > 0.3 &&
+                          st.bytes_decrypted == 4 * 524288 + (size - 12 * 524288) && st.reads == 7 &&
+                          st.cached_bytes <= 4 * 1024 * 1024;
+        }
+        test("Test 136: EncryptedFileReader pread matches the plaintext for ZIP and v2", reads_ok);
+        test("Test 137: EncryptedFileReader counts cache hits, misses and bytes decrypted", counters_ok);
+        
+        // Several threads reading random ranges through a cache smaller than
+        // the file, so entries are evicted and re-decrypted while others read.
+        EncryptedFileReader shared_reader(1024 * 1024);
+        bool shared_ok = shared_reader.open("test_reader.v2", "readerpass") == 0;
+        EncryptedFileReader wrong;
+        int wrong_rc = wrong.open("test_reader.zip", "notthepass");
+        std::atomic<bool> mismatch(false);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t] {
+                uint32_t state = 12345u + t;
+                std::vector<uint8_t> out;
+                for (int i = 0; i < 60; i++) {
+                    state = state * 1103515245u + 12345u;
+                    uint64_t offset = state % size;
+                    size_t len = 1 + (state >> 8) % 70000;
+                    out.resize(len);
+                    long long n = shared_reader.pread(out.data(), len, offset);
+                    uint64_t expect = std::min<uint64_t>(len, size - offset);
+                    if (n != (long long)expect ||
+                        !std::equal(plain.begin() + offset, plain.begin() + offset + expect, out.begin())) {
+                        mismatch = true;
+                    }
+                }
+            });
+        }
+        for (std::thread &thread : threads) thread.join();
+        test("Test 138: EncryptedFileReader serves concurrent readers and rejects a wrong password",
+             shared_ok && !mismatch && wrong_rc == -2 && !wrong.is_open() &&
+             shared_reader.stats().cached_bytes <= 1024 * 1024);
+    }
+    
+    // Test 139-141: Plaintext compression stage
+    {
+        // 7MB: compressible text, then random bytes, so some chunks shrink
+        // and some stay raw.
+        size_t size = 7 * 1024 * 1024;
+        std::vector<uint8_t> plain(size);
+        const char *line = "2024-01-01 12:00:00 INFO request served status=200\n";
+        for (size_t i = 0; i < size / 2; i++) plain[i] = (uint8_t)line[i % strlen(line)];
+        uint32_t state = 42;
+        for (size_t i = size / 2; i < size; i++) {
+            state = state * 1103515245u + 12345u;
+            plain[i] = (uint8_t)(state >> 16);
+        }
+        FILE *f = fopen("test_compress_in.bin", "wb");
+        fwrite(plain.data(), 1, size, f);
+        fclose(f);
+        
+        const char *codecs[] = {"deflate", "deflate:1", "lzma:3"};
+        bool round_trip = true;
+        for (const char *codec : codecs) {
+            CompressionOptions opts = {};
+            round_trip = round_trip && parse_compression(codec, &opts) == 0;
+            int zip_rc = encrypt_file_compressed("test_compress_in.bin", "test_compress.zip", "zippass", 8, &opts, NULL);
+            int v2_rc = encrypt_file_v2("test_compress_in.bin", "test_compress.v2", "zippass", 8, &opts, NULL);
+            round_trip = round_trip && zip_rc == 0 && v2_rc == 0 &&
+                         get_file_size("test_compress.zip") < size * 3 / 4 &&
+                         get_file_size("test_compress.v2") < size * 3 / 4 &&
+                         decrypt_file_advanced("test_compress.zip", "test_compress_out.bin", "zippass") == 0 &&
+                         files_match("test_compress_in.bin", "test_compress_out.bin") &&
+                         decrypt_file_advanced("test_compress.v2", "test_compress_out.bin", "zippass") == 0 &&
+                         files_match("test_compress_in.bin", "test_compress_out.bin");
+        }
+        test("Test 139: Compressed ZIP and v2 archives round-trip with deflate and LZMA", round_trip);
+        
+        // Reads straddling the compressed/raw boundary go through whole-chunk
+        // decompression; ranges on the raw half still work sub-chunk wise.
+        bool reads_ok = true;
+        for (const char *archive : {"test_compress.zip", "test_compress.v2"}) {
+            EncryptedFileReader reader(2 * 1024 * 1024);
+            reads_ok = reads_ok && reader.open(archive, "zippass") == 0 && reader.size() == size;
+            const uint64_t reads[][2] = {{10, 1000}, {size / 2 - 300, 600}, {size - 5000, 5000}, {524288 - 3, 6}};
+            for (const auto &r : reads) {
+                std::vector<uint8_t> out(r[1]);
+                reads_ok = reads_ok && reader.pread(out.data(), out.size(), r[0]) == (long long)r[1] &&
+                           std::equal(out.begin(), out.end(), plain.begin() + r[0]);
+            }
+            reads_ok = reads_ok && decrypt_file_range(archive, "test_compress_out.bin", "zippass", size / 2 - 10, 20) == 0;
+            std::vector<uint8_t> out(20);
+            f = fopen("test_compress_out.bin", "rb");
+            size_t got = f ? fread(out.data(), 1, out.size(), f) : 0;
+            if (f) fclose(f);
+            reads_ok = reads_ok && got == 20 && std::equal(out.begin(), out.end(), plain.begin() + size / 2 - 10);
+        }
+        test("Test 140: Random reads and ranges decompress compressed chunks", reads_ok);
+        
+        CompressionOptions opts = {};
+        bool parse_ok = parse_compression("store", &opts) == 0 && opts.codec == COMPRESS_STORE &&
+                        parse_compression("deflate", &opts) == 0 && opts.codec == COMPRESS_DEFLATE &&
+                        opts.level == DEFLATE_DEFAULT_LEVEL &&
+                        parse_compression("lzma:9", &opts) == 0 && opts.codec == COMPRESS_LZMA && opts.level == 9 &&
+                        parse_compression("deflate:0", &opts) == -1 && parse_compression("store:1", &opts) == -1 &&
+                        parse_compression("lzma:10", &opts) == -1 && parse_compression("zstd", &opts) == -1;
+        test("Test 141: Compression options parse codec and level", parse_ok);
+    }
+    
+    // Test 142-143: Entropy sampling skips incompressible chunks
+    {
+        std::vector<uint8_t> random_data(600000), text(600000), zeros(600000, 0);
+        uint32_t state = 7;
+        for (size_t i = 0; i < random_data.size(); i++) {
+            state = state * 1103515245u + 12345u;
+            random_data[i] = (uint8_t)(state >> 16);
+        }
+        const char *words = "the quick brown fox jumps over the lazy dog ";
+        for (size_t i = 0; i < text.size(); i++) text[i] = (uint8_t)words[i % strlen(words)];
+        double random_bits = sample_entropy(random_data.data(), random_data.size());
+        double text_bits = sample_entropy(text.data(), text.size());
+        test("Test 142: Entropy sampling separates random data from text",
+             random_bits >= INCOMPRESSIBLE_ENTROPY && text_bits < 5.0 &&
+             sample_entropy(zeros.data(), zeros.size()) == 0.0 && sample_entropy(random_data.data(), 100) < 8.0);
+        
+        // 6MB: the text half compresses, the random half is skipped, and the
+        // v2 index carries the per-chunk flags.
+        size_t size = 6 * 1024 * 1024;
+        FILE *f = fopen("test_entropy.bin", "wb");
+        for (size_t written = 0; written < size / 2; written += text.size()) {
+            fwrite(text.data(), 1, std::min(text.size(), size / 2 - written), f);
+        }
+        for (size_t written = 0; written < size / 2; written += random_data.size()) {
+            fwrite(random_data.data(), 1, std::min(random_data.size(), size / 2 - written), f);
+        }
+        fclose(f);
+        CompressionStats stats = {};
+        CompressionOptions opts = {COMPRESS_DEFLATE, 6, &stats};
+        bool ok = encrypt_file_v2("test_entropy.bin", "test_entropy.enc", "entropypass", 8, &opts, NULL) == 0 &&
+                  decrypt_file_advanced("test_entropy.enc", "test_entropy_dec.bin", "entropypass") == 0 &&
+                  files_match("test_entropy.bin", "test_entropy_dec.bin");
+        InputFile archive_file;
+        NativeArchive archive;
+        size_t skipped_flags = 0, compressed_flags = 0;
+        if (archive_file.open("test_entropy.enc") && open_native_archive(archive_file, archive)) {
+            for (const NativeChunk &chunk : archive.chunks) {
+                if (chunk.flags == CHUNK_INCOMPRESSIBLE) skipped_flags++;
+                if (chunk.flags == CHUNK_COMPRESSED) compressed_flags++;
+            }
+        }
+        test("Test 143: Incompressible chunks are stored raw, flagged and counted",
+             ok && stats.chunks == 12 && stats.chunks_skipped >= 5 && stats.chunks_compressed >= 5 &&
+             stats.chunks_skipped + stats.chunks_compressed + stats.chunks_not_smaller == stats.chunks &&
+             stats.bytes_in == size && stats.bytes_skipped == stats.chunks_skipped * 524288 &&
+             skipped_flags == stats.chunks_skipped && compressed_flags == stats.chunks_compressed &&
+             estimated_skip_savings_ns(stats) > 0);
+    }
+    
+    // Test 144-145: Memory-mapped I/O and the buffered fallback
+    {
+        // Encrypt with one I/O mode and decrypt with the other, for both
+        // containers, raw and compressed (test_entropy.bin mixes both kinds).
+        CompressionOptions deflate = {COMPRESS_DEFLATE, 6, NULL};
+        bool ok = true;
+        for (int mode = 0; mode < 2 && ok; mode++) {
+            for (int compressed = 0; compressed < 2 && ok; compressed++) {
+                const CompressionOptions *opts = compressed ? &deflate : NULL;
+                set_io_backend(mode == 0 ? IO_MMAP : IO_BUFFERED);
+                ok = encrypt_file_compressed("test_entropy.bin", "test_mmap.enc", "mmappass", 8, opts, NULL) == 0 &&
+                     encrypt_file_v2("test_entropy.bin", "test_mmap_v2.enc", "mmappass", 8, opts, NULL) == 0;
+                set_io_backend(mode != 0 ? IO_MMAP : IO_BUFFERED);
+                ok = ok && decrypt_file_advanced("test_mmap.enc", "test_mmap_dec.bin", "mmappass") == 0 &&
+                     files_match("test_entropy.bin", "test_mmap_dec.bin") &&
+                     decrypt_file_advanced("test_mmap_v2.enc", "test_mmap_dec.bin", "mmappass") == 0 &&
+                     files_match("test_entropy.bin", "test_mmap_dec.bin");
+            }
+        }
+        set_io_backend(IO_MMAP);
+        test("Test 144: Mapped and buffered I/O produce interchangeable archives", ok);
+        
+        InputFile empty, mapped, buffered;
+        std::vector<uint8_t> a(4096), b(4096);
+        set_io_backend(IO_BUFFERED);
+        bool disabled = buffered.open("test_entropy.bin") && !buffered.map() && buffered.data() == nullptr;
+        set_io_backend(IO_MMAP);
+        bool map_ok = mapped.open("test_entropy.bin") && mapped.map() && mapped.data() != nullptr &&
+                      mapped.read_at(a.data(), a.size(), 3000000) && buffered.read_at(b.data(), b.size(), 3000000) &&
+                      a == b && memcmp(mapped.data() + 3000000, a.data(), a.size()) == 0 &&
+                      !mapped.read_at(a.data(), a.size(), mapped.size() - 10);
+        test("Test 145: Input files map on request and fall back to reads",
+             disabled && map_ok && empty.open("test_empty.txt") && !empty.map());
+    }
+    
+    // Test 146-147: Direct I/O backend
+    {
+        // Both queue implementations: three writes in flight, then reads back,
+        // the last of which runs into end of file. Windows has neither.
+        bool queue_ok = true;
+#ifndef _WIN32
+        for (int uring = 0; uring < 2; uring++) {
+            IoQueue queue(4, uring == 1);
+            std::vector<uint8_t> out(3 * 8192), in(3 * 8192 + 100, 0);
+            for (size_t i = 0; i < out.size(); i++) out[i] = (uint8_t)(i * 7 + uring);
+            FILE *f = fopen("test_ioqueue.bin", "wb");
+            if (f) fclose(f);
+            int fd = ::open("test_ioqueue.bin", O_RDWR);
+            uint64_t tag;
+            long long result;
+            long long total = 0;
+            for (size_t b = 0; b < 3; b++) queue_ok = queue_ok && queue.submit_write(fd, out.data() + b * 8192, 8192, b * 8192, b);
+            for (size_t b = 0; b < 3; b++) {
+                queue_ok = queue_ok && queue.wait(&tag, &result) && tag < 3 && result == 8192;
+            }
+            queue_ok = queue_ok && queue.submit_read(fd, in.data(), 16384, 0, 10) &&
+                       queue.submit_read(fd, in.data() + 16384, 8192 + 100, 16384, 11);
+            for (int r = 0; r < 2; r++) {
+                queue_ok = queue_ok && queue.wait(&tag, &result) && (tag == 10 || tag == 11);
+                total += result;
+            }
+            queue_ok = queue_ok && total == (long long)out.size() && memcmp(in.data(), out.data(), out.size()) == 0 &&
+                       !queue.wait(&tag, &result) && queue.outstanding() == 0;
+            if (fd >= 0) ::close(fd);
+        }
+#endif
+        test("Test 146: io_uring and thread-backed I/O queues complete reads and writes", queue_ok);
+        
+        // Encrypt and decrypt with the direct backend, and across backends.
+        IoBackend backend = IO_MMAP;
+        bool parse_ok = parse_io_backend("direct", &backend) == 0 && backend == IO_DIRECT &&
+                        parse_io_backend("uring", &backend) == -1 && strcmp(io_backend_name(IO_BUFFERED), "buffered") == 0;
+        CompressionOptions deflate = {COMPRESS_DEFLATE, 6, NULL};
+        bool ok = parse_ok;
+        for (int compressed = 0; compressed < 2 && ok; compressed++) {
+            const CompressionOptions *opts = compressed ? &deflate : NULL;
+            set_io_backend(IO_DIRECT);
+            ok = encrypt_file_compressed("test_entropy.bin", "test_direct.enc", "directpass", 8, opts, NULL) == 0 &&
+                 encrypt_file_v2("test_entropy.bin", "test_direct_v2.enc", "directpass", 8, opts, NULL) == 0 &&
+                 decrypt_file_advanced("test_direct.enc", "test_direct_dec.bin", "directpass") == 0 &&
+                 files_match("test_entropy.bin", "test_direct_dec.bin") &&
+                 decrypt_file_advanced("test_direct_v2.enc", "test_direct_dec.bin", "directpass") == 0 &&
+                 files_match("test_entropy.bin", "test_direct_dec.bin");
+            set_io_backend(IO_MMAP);
+            ok = ok && decrypt_file_advanced("test_direct_v2.enc", "test_direct_dec.bin", "directpass") == 0 &&
+                 files_match("test_entropy.bin", "test_direct_dec.bin");
+        }
+        set_io_backend(IO_DIRECT);
+        ok = ok && encrypt_file_v2("test_single.txt", "test_direct_v2.enc", "directpass", 8, NULL, NULL) == 0 &&
+             decrypt_file_advanced("test_direct_v2.enc", "test_direct_dec.bin", "directpass") == 0 &&
+             files_match("test_single.txt", "test_direct_dec.bin");
+        set_io_backend(IO_MMAP);
+        test("Test 147: Direct I/O backend round-trips ZIP and v2 archives", ok);
+    }
+    
+    // Test 148-149: Phase timings of encrypt and decrypt
+    {
+        // 6MB of half text, half random: twelve 512KB chunks, some compressed.
+        const uint64_t size = 6 * 1024 * 1024;
+        CompressionStats compressed = {};
+        CompressionOptions deflate = {COMPRESS_DEFLATE, 6, &compressed};
+        RunStats zip_stats, v2_stats;
+        memset(&zip_stats, 0xFF, sizeof(zip_stats));
+        bool ok = encrypt_file_compressed("test_entropy.bin", "test_stats.zip", "statspass", 8, &deflate, &zip_stats) == 0;
+        uint64_t zip_payload = compressed.bytes_out;
+        ok = ok && encrypt_file_v2("test_entropy.bin", "test_stats.v2", "statspass", 8, &deflate, &v2_stats) == 0;
+        struct stat zip_st, v2_st;
+        ok = ok && stat("test_stats.zip", &zip_st) == 0 && stat("test_stats.v2", &v2_st) == 0;
+        const RunStats *runs[2] = {&zip_stats, &v2_stats};
+        for (int i = 0; i < 2 && ok; i++) {
+            const RunStats &r = *runs[i];
+            ok = r.bytes_in == size && r.bytes_out == (uint64_t)(i ? v2_st.st_size : zip_st.st_size) &&
+                 r.chunks == 12 && r.chunk_size == 512 * 1024 && r.threads == ThreadPool::shared().size() &&
+                 r.peak_rss_bytes > 0 && r.cpu_ns > 0 && r.phases[PHASE_KDF].busy_ns > 0 &&
+                 r.phases[PHASE_KDF].bytes == 0 && r.wall_ns >= r.phases[PHASE_KDF].wall_ns &&
+                 r.phases[PHASE_READ].bytes == size && r.phases[PHASE_COMPRESS].bytes == size &&
+                 r.phases[PHASE_TRANSFORM].bytes == zip_payload && r.phases[PHASE_TRANSFORM].busy_ns > 0 &&
+                 r.phases[PHASE_WRITE].bytes >= zip_payload &&
+                 phase_mbps(&r.phases[PHASE_TRANSFORM]) > 0 && phase_mbps(&r.phases[PHASE_KDF]) == 0;
+        }
+        // v2 writes the header and index through the same calls as the chunks.
+        ok = ok && v2_stats.phases[PHASE_WRITE].bytes == v2_stats.bytes_out;
+        test("Test 148: Encrypts report per-phase times, bytes, chunks and peak RSS", ok);
+        
+        RunStats dec_stats;
+        const char *archives[2] = {"test_stats.zip", "test_stats.v2"};
+        for (int i = 0; i < 2 && ok; i++) {
+            memset(&dec_stats, 0, sizeof(dec_stats));
+            ok = decrypt_file_stats(archives[i], "test_stats_dec.bin", "statspass", &dec_stats) == 0 &&
+                 files_match("test_entropy.bin", "test_stats_dec.bin") &&
+                 dec_stats.bytes_out == size && dec_stats.chunks == 12 && dec_stats.chunk_size == 512 * 1024 &&
+                 dec_stats.phases[PHASE_KDF].busy_ns > 0 && dec_stats.phases[PHASE_READ].bytes == zip_payload &&
+                 dec_stats.phases[PHASE_TRANSFORM].bytes == zip_payload &&
+                 dec_stats.phases[PHASE_COMPRESS].bytes > 0 && dec_stats.phases[PHASE_COMPRESS].bytes < zip_payload &&
+                 dec_stats.phases[PHASE_WRITE].bytes == size;
+        }
+        ok = ok && decrypt_file_stats("test_stats.v2", "test_stats_dec.bin", "wrongpass", &dec_stats) == -2;
+        
+        // Stream files time the same phases, one chunk per frame.
+        RunStats stream_stats;
+        memset(&stream_stats, 0xFF, sizeof(stream_stats));
+        FILE *stream_in = fopen("test_entropy.bin", "rb");
+        FILE *stream_out = fopen("test_stats.stream", "wb");
+        bool stream_ok = stream_in && stream_out &&
+                         encrypt_stream(stream_in, stream_out, "test_entropy.bin", "statspass", 8) == 0;
+        if (stream_in) fclose(stream_in);
+        if (stream_out) fclose(stream_out);
+        ok = ok && stream_ok &&
+             decrypt_file_stats("test_stats.stream", "test_stats_dec.bin", "statspass", &stream_stats) == 0 &&
+             files_match("test_entropy.bin", "test_stats_dec.bin") && stream_stats.bytes_out == size &&
+             stream_stats.bytes_in == get_file_size("test_stats.stream") &&
+             stream_stats.chunks == 12 && stream_stats.chunk_size == 512 * 1024 &&
+             stream_stats.phases[PHASE_KDF].busy_ns > 0 && stream_stats.phases[PHASE_READ].bytes == size &&
+             stream_stats.phases[PHASE_TRANSFORM].bytes == size && stream_stats.phases[PHASE_TRANSFORM].busy_ns > 0 &&
+             stream_stats.phases[PHASE_COMPRESS].bytes == 0 && stream_stats.phases[PHASE_WRITE].bytes == size;
+        
+        // Both report formats name every phase.
+        FILE *report = tmpfile();
+        std::string text;
+        if (report) {
+            print_run_stats(report, &dec_stats);
+            fputc('\n', report);
+            print_run_stats_json(report, &dec_stats);
+            rewind(report);
+            char buf[4096];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), report)) > 0) text.append(buf, n);
+            fclose(report);
+        }
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            std::string name = run_phase_name((RunPhase)p);
+            ok = ok && text.find("  " + name + " ") != std::string::npos &&
+                 text.find("\"" + name + "\": {\"wall_ms\"") != std::string::npos;
+        }
+        ok = ok && text.find("\"peak_rss_bytes\": ") != std::string::npos;
+        test("Test 149: ZIP, v2 and stream decrypts report their phases as text and JSON", ok);
+    }
+    
+    // Test 150: Chrome trace of an encrypt and decrypt
+    {
+        trace_start();
+        bool ok = encrypt_file_v2("test_entropy.bin", "test_trace.v2", "tracepass", 8, NULL, NULL) == 0 &&
+                  decrypt_file_advanced("test_trace.v2", "test_trace_dec.bin", "tracepass") == 0 &&
+                  trace_stop("test_trace.json") == 0 && files_match("test_entropy.bin", "test_trace_dec.bin");
+        std::ifstream in("test_trace.json");
+        std::stringstream buf;
+        buf << in.rdbuf();
+        std::string json = buf.str();
+        size_t begins = 0, ends = 0;
+        for (size_t at = 0; (at = json.find("\"ph\": \"B\"", at)) != std::string::npos; at++) begins++;
+        for (size_t at = 0; (at = json.find("\"ph\": \"E\"", at)) != std::string::npos; at++) ends++;
+        // Cost 8 is 256 iterations: 16 blocks for each of the four derivations.
+        size_t kdf_blocks = 0;
+        for (size_t at = 0; (at = json.find("\"name\": \"kdf iterations\", \"cat\": \"mycrypt\", \"ph\": \"B\"", at)) !=
+             std::string::npos; at++) {
+            kdf_blocks++;
+        }
+        ok = ok && json.compare(0, 42, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [") == 0 &&
+             begins > 0 && begins == ends && kdf_blocks == 4 * 256 / KDF_TRACE_BLOCK &&
+             json.find("\"name\": \"transform\"") != std::string::npos &&
+             json.find("\"args\": {\"chunk\": 11}") != std::string::npos &&
+             json.find("\"args\": {\"name\": \"pool worker 0\"}") != std::string::npos;
+        // Nothing is recorded once the trace is stopped.
+        ok = ok && !trace_enabled() && decrypt_file_advanced("test_trace.v2", "test_trace_dec.bin", "tracepass") == 0 &&
+             trace_stop("test_trace_empty.json") == 0 && trace_stop("no_such_dir/trace.json") == -1;
+        std::ifstream empty("test_trace_empty.json");
+        std::string line, rest;
+        std::getline(empty, line);
+        std::getline(empty, rest, '\0');
+        test("Test 150: Traces record balanced per-chunk and KDF block events",
+             ok && line == "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" && rest == "]}\n");
+    }
+    
+    // Test 151: a damaged ZIP chunk fails the decrypt without leaving output
+    {
+        // Letters from a 16-symbol alphabet deflate to about half, so the
+        // middle of the archive is inside a chunk's compressed data.
+        const size_t size = 2 * 1024 * 1024;
+        std::vector<uint8_t> plain(size);
+        uint32_t state = 7;
+        for (size_t i = 0; i < size; i++) {
+            state = state * 1103515245u + 12345u;
+            plain[i] = (uint8_t)('a' + ((state >> 16) & 15));
+        }
+        FILE *f = fopen("test_badzip.bin", "wb");
+        fwrite(plain.data(), 1, size, f);
+        fclose(f);
+        CompressionOptions opts = {};
+        bool ok = parse_compression("deflate", &opts) == 0 &&
+                  encrypt_file_compressed("test_badzip.bin", "test_badzip.zip", "badpass", 8, &opts, NULL) == 0;
+        size_t enc_size = get_file_size("test_badzip.zip");
+        std::vector<uint8_t> encrypted(enc_size);
+        f = fopen("test_badzip.zip", "rb");
+        size_t got = f ? fread(encrypted.data(), 1, enc_size, f) : 0;
+        if (f) fclose(f);
+        ok = ok && got == enc_size && enc_size > 0 && enc_size < size * 3 / 4;
+        if (ok) {
+            encrypted[enc_size / 2] ^= 0x40;
+            f = fopen("test_badzip.zip", "wb");
+            fwrite(encrypted.data(), 1, enc_size, f);
+            fclose(f);
+        }
+        remove("test_badzip_dec.bin");
+        ok = ok && decrypt_file_advanced("test_badzip.zip", "test_badzip_dec.bin", "badpass") == -1 &&
+             !file_exists("test_badzip_dec.bin");
+        test("Test 151: A corrupt ZIP chunk fails the decrypt and removes the output", ok);
+    }
+    
+    // Test 152: a damaged v2 index entry fails the decrypt without leaving output
+    {
+        create_test_file_binary("test_badv2.bin", 6000000);
+        bool ok = encrypt_file_v2("test_badv2.bin", "test_badv2.v2", "badpass", 8, NULL, NULL) == 0;
+        size_t enc_size = get_file_size("test_badv2.v2");
+        std::vector<uint8_t> encrypted(enc_size);
+        FILE *f = fopen("test_badv2.v2", "rb");
+        size_t got = f ? fread(encrypted.data(), 1, enc_size, f) : 0;
+        if (f) fclose(f);
+        ok = ok && got == enc_size && enc_size > NATIVE_FOOTER_SIZE;
+        if (ok) {
+            // The footer starts with the index offset; mark chunk 5, a raw
+            // chunk of a store archive, as compressed.
+            uint64_t index_offset = 0;
+            for (int b = 7; b >= 0; b--) index_offset = index_offset << 8 | encrypted[enc_size - NATIVE_FOOTER_SIZE + b];
+            size_t flags_at = (size_t)index_offset + 5 * NATIVE_INDEX_ENTRY_SIZE + 24;
+            ok = flags_at + 4 <= enc_size - NATIVE_FOOTER_SIZE;
+            if (ok) {
+                encrypted[flags_at] = 1;
+                f = fopen("test_badv2.v2", "wb");
+                fwrite(encrypted.data(), 1, enc_size, f);
+                fclose(f);
+            }
+        }
+        remove("test_badv2_dec.bin");
+        ok = ok && decrypt_file_advanced("test_badv2.v2", "test_badv2_dec.bin", "badpass") != 0 &&
+             !file_exists("test_badv2_dec.bin");
+        test("Test 152: A corrupt v2 index entry fails the decrypt and removes the output", ok);
+    }
+    
     // Cleanup
     printf("\nCleaning up test files...\n");
     const char* cleanup_files[] = {
         "test1.txt", "test1.enc", "test1_dec.txt", "test1_wrong.txt",
+        "test_mmap.enc", "test_mmap_v2.enc", "test_mmap_dec.bin",
+        "test_badzip.bin", "test_badzip.zip", "test_badzip_dec.bin",
+        "test_badv2.bin", "test_badv2.v2", "test_badv2_dec.bin",
+        "test_ioqueue.bin", "test_direct.enc", "test_direct_v2.enc", "test_direct_dec.bin",
         "test_empty.txt", "test_empty.enc", "test_empty_dec.txt",
         "test_single.txt", "test_single.enc", "test_single_dec.txt",
         "test_special.txt", "test_special.enc", "test_special_dec.txt",
@@ -485,7 +1466,22 @@ int main() {
         "test_stress2.bin", "test_stress2.enc", "test_stress2_dec.bin",
         "test_long_line.txt", "test_long_line.enc", "test_long_line_dec.txt",
         "test_many_lines.txt", "test_many_lines.enc", "test_many_lines_dec.txt",
-        "test_exact_1kb.bin", "test_exact_1kb.enc", "test_exact_1kb_dec.bin"
+        "test_exact_1kb.bin", "test_exact_1kb.enc", "test_exact_1kb_dec.bin",
+        "test_tail8.bin", "test_tail8.enc", "test_tail8_dec.bin",
+        "test_batch1.txt", "test_batch1.enc", "test_batch1_dec.txt",
+        "test_batch2.bin", "test_batch2.enc", "test_batch2_dec.bin",
+        "test_batch3.bin", "test_batch3.enc", "test_batch3_dec.bin",
+        "test_batch4.bin", "test_batch4.enc", "test_batch4_dec.bin",
+        "test_batch_wrong.txt",
+        "test_stream.bin", "test_stream.enc", "test_stream_dec.bin", "test_stream_wrong.bin",
+        "test_stream_cut.enc", "test_stream_cut.bin",
+        "test_v2.bin", "test_v2.enc", "test_v2_dec.bin", "test_v2_wrong.bin", "test_v2_bad.enc", "test_v2_bad.bin",
+        "test_range.bin", "test_range.zip", "test_range.v2", "test_range.stream", "test_range_out.bin",
+        "test_reader.bin", "test_reader.zip", "test_reader.v2",
+        "test_compress_in.bin", "test_compress.zip", "test_compress.v2", "test_compress_out.bin",
+        "test_entropy.bin", "test_entropy.enc", "test_entropy_dec.bin",
+        "test_stats.zip", "test_stats.v2", "test_stats.stream", "test_stats_dec.bin",
+        "test_trace.v2", "test_trace_dec.bin", "test_trace.json", "test_trace_empty.json"
     };
     
     for (size_t i = 0; i < sizeof(cleanup_files) / sizeof(cleanup_files[0]); i++) {